@@ -15,14 +15,36 @@
 // ----------------------------------------------------------------------------
 
 // Periodic temperature reading delay
+// (only used when the Server-Sent Events stream is not available)
 const temperatureCaptureTime = 10000; // 10 seconds (in milliseconds)
 
+// A request that gets no response within this delay is abandoned,
+// then retried after a delay which doubles at each failure
+const requestTimeout = 5000;  // in milliseconds
+const requestRetries = 4;
+const retryMinDelay  = 500;   // in milliseconds
+const retryMaxDelay  = 30000; // in milliseconds
+
+// Name of the channel (and of the lock) shared by the tabs of the browser
+const feedName = 'thermostat-feed';
+
 // ----------------------------------------------------------------------------
 // Global variables
 // ----------------------------------------------------------------------------
 
-// Default asynchronous request manager (classical AJAX method)
-var xhttp = new XMLHttpRequest();
+// Latest request issued for each key (see `xhrRequest()`)
+var generations = {};
+
+// Temperature readings pushed by the ESP32 (Server-Sent Events)
+var source;
+
+// Periodic temperature reading timer (XHR fallback)
+var polling;
+
+// Temperature feed shared with the other tabs of the browser
+var feed;
+var leader = false;   // -> whether this tab is the one connected to the ESP32
+var latestTemperature; // -> last reading received, for the tabs that join
 
 /**
  * We will need to read some data or update some elements of the HTML page.
@@ -58,6 +80,11 @@ var btnReboot;
 // Initialization on full loading of the HTML page
 // ----------------------------------------------------------------------------
 
+/**
+ * The HTML page is static: the values to be displayed are requested from
+ * the ESP32 (`/state` route) before the panel appears.
+ */
+
 window.addEventListener('load', onLoad);
 
 function onLoad(event) {
@@ -65,8 +92,23 @@ function onLoad(event) {
     initTime();
     initThresholds();
     initButtons();
-    initProbe();
-    showPanel();
+    xhrRequest('/state', (json) => {
+        initState(JSON.parse(json));
+        initProbe();
+        showPanel();
+    });
+}
+
+// ----------------------------------------------------------------------------
+// Initialization of the displayed values with the current state of the ESP32
+// ----------------------------------------------------------------------------
+
+function initState(state) {
+    lower.dataset.min     = state.min;
+    upper.dataset.max     = state.max;
+    lower.value           = state.lower.toFixed(1);
+    upper.value           = state.upper.toFixed(1);
+    temperature.innerText = state.temp === null ? 'Error' : state.temp.toFixed(1);
 }
 
 // ----------------------------------------------------------------------------
@@ -138,7 +180,7 @@ function initThresholds() {
  * refreshed to take into account the new thresholds, and change the display colour
  * if necessary.
  * 
- * Finally, the new thresholds are transmitted to the ESP32 to be saved in the EEPROM.
+ * Finally, the new thresholds are transmitted to the ESP32 to be saved in the flash memory.
  */
 
 function saveThresholds() {
@@ -155,12 +197,13 @@ function saveThresholds() {
     // then temperature display color may change...
     setTemperature(temperature.innerText);
 
-    // finally, the new thresholds are sent to the ESP32 for storage in the EEPROM:
+    // finally, the new thresholds are sent to the ESP32 for storage in the flash memory:
     // asynchronous call of the remote routine with the classical method
-    xhrRequest(`/savethresholds?lower=${new_low}&upper=${new_upp}`);
+    // (a save still waiting to be retried is superseded by this one)
+    xhrRequest(`/savethresholds?lower=${new_low}&upper=${new_upp}`, null, { key: 'thresholds' });
 
     // for a more modern method, you can instead call this manager:
-    // asyncAwaitRequest(`/savethresholds?lower=${new_low}&upper=${new_upp}`);
+    // asyncAwaitRequest(`/savethresholds?lower=${new_low}&upper=${new_upp}`, null, { key: 'thresholds' });
 }
 
 // While the user is entering a value
@@ -190,10 +233,10 @@ function initButtons() {
 
 function onDefault(event) {
     // asynchronous call of the remote routine with the classical method
-    xhrRequest('/reset');
+    xhrRequest('/reset', null, { key: 'thresholds' });
 
     // for a more modern method, you can instead call this manager:
-    // asyncAwaitRequest('/reset');
+    // asyncAwaitRequest('/reset', null, { key: 'thresholds' });
 
     // refreshes all temperature displays
     lower.value = Number.parseFloat(lower.dataset.min).toFixed(1);
@@ -206,16 +249,105 @@ function onDefault(event) {
 
 function onReboot(event) {
     // sends reboot command to the ESP32
-    xhrRequest('/reboot');
+    // (only once: a retry could restart it a second time)
+    xhrRequest('/reboot', null, { retries: 0 });
 }
 
 // ----------------------------------------------------------------------------
 // Initialization and handling of the temperature sensor
 // ----------------------------------------------------------------------------
 
+/**
+ * The ESP32 pushes each new reading on the `/events` stream as soon as it
+ * has been taken. If the browser does not support Server-Sent Events, or if
+ * the stream is definitively closed, we fall back on periodic polling.
+ *
+ * When several tabs are open, only one of them (the leader, which holds the
+ * lock) is connected to the ESP32, and relays the readings to the others
+ * over a `BroadcastChannel`. When the leader is closed, the lock is granted
+ * to the next tab, which takes over. Without these APIs, each tab has its
+ * own feed.
+ */
+
 function initProbe() {
     setTemperature(temperature.innerText);
-    setInterval(getTemperature, temperatureCaptureTime);
+    if (window.BroadcastChannel && navigator.locks) {
+        initSharedFeed();
+    } else {
+        startFeed();
+    }
+}
+
+function startFeed() {
+    if (window.EventSource) {
+        initEventSource();
+    } else {
+        startPolling();
+    }
+}
+
+// Temperature feed shared by the tabs
+// -----------------------------------
+
+function initSharedFeed() {
+    feed = new BroadcastChannel(feedName);
+    feed.addEventListener('message', onFeedMessage);
+
+    // the current leader, if any, answers with the latest reading
+    feed.postMessage({ type: 'hello' });
+
+    // the lock is held as long as the tab is open
+    navigator.locks.request(feedName, () => {
+        leader = true;
+        startFeed();
+        return new Promise(() => {});
+    });
+}
+
+function onFeedMessage(event) {
+    let message = event.data;
+    if (message.type == 'temperature' && !leader) {
+        setTemperature(message.value);
+    } else if (message.type == 'hello' && leader && latestTemperature !== undefined) {
+        feed.postMessage({ type: 'temperature', value: latestTemperature });
+    }
+}
+
+// Called for each reading received from the ESP32
+function receiveTemperature(temp) {
+    latestTemperature = temp;
+    setTemperature(temp);
+    if (feed) feed.postMessage({ type: 'temperature', value: temp });
+}
+
+// Subscription to the readings pushed by the ESP32
+// ------------------------------------------------
+
+function initEventSource() {
+    source = new EventSource('/events');
+
+    source.addEventListener('temperature', (event) => { receiveTemperature(event.data); });
+
+    // the browser automatically reconnects to the stream,
+    // so polling is only needed while the stream is down
+    source.addEventListener('open', stopPolling);
+    source.addEventListener('error', () => {
+        if (source.readyState == EventSource.CLOSED) startPolling();
+    });
+}
+
+// Periodic polling of the temperature (fallback)
+// ----------------------------------------------
+
+function startPolling() {
+    if (!polling) polling = setInterval(getTemperature, temperatureCaptureTime);
+}
+
+function stopPolling() {
+    if (polling) {
+        clearInterval(polling);
+        polling = null;
+    }
 }
 
 // Sending the current temperature reading request
@@ -228,10 +360,11 @@ function getTemperature() {
      */
 
     // asynchronous call of the remote routine with the classical method
-    xhrRequest('/temp', (temp) => { setTemperature(temp); });
+    // (no retry: the next poll comes soon enough)
+    xhrRequest('/temp', receiveTemperature, { retries: 0 });
 
     // for a more modern method, you can instead call this manager:
-    // asyncAwaitRequest('/temp', (temp) => { setTemperature(temp); });
+    // asyncAwaitRequest('/temp', receiveTemperature, { retries: 0 });
 }
 
 // Updating the display when the value read on the sensor is received
@@ -266,30 +399,97 @@ function setTemperature(temp) {
 // AJAX requests
 // -------------------------------------------------------
 
+/**
+ * Each request has its own object, so that concurrent requests no longer
+ * abort one another. A request that fails (timeout, network error, or an
+ * overloaded ESP32 answering `503` or `429`) is retried after a growing
+ * delay, or after the delay given by the `Retry-After` header.
+ *
+ * Options:
+ * - `retries` number of retries (`requestRetries` by default)
+ * - `key`     a new request with the same key supersedes the previous one,
+ *             which is no longer retried (the latest thresholds win)
+ */
+
+function retryDelay(attempt, retryAfter) {
+    if (retryAfter) return Number.parseInt(retryAfter) * 1000;
+    let delay = Math.min(retryMinDelay * 2 ** attempt, retryMaxDelay);
+    // random jitter, so that the tabs do not all come back at the same time
+    return delay / 2 + Math.random() * delay / 2;
+}
+
+function newGeneration(key) {
+    if (!key) return 0;
+    generations[key] = (generations[key] || 0) + 1;
+    return generations[key];
+}
+
+function isSuperseded(key, generation) {
+    return key && generations[key] != generation;
+}
+
 // Using standard vanilla XHR (XMLHttpRequest method)
 // @see https://www.w3schools.com/xml/ajax_xmlhttprequest_send.asp
 
-function xhrRequest(path, callback) {
-    
-    xhttp.onreadystatechange = function() {
-        if (this.readyState == 4 && this.status == 200) {
-            // callback is optional!
-            typeof callback === 'function' && callback(this.responseText);
-        }
+function xhrRequest(path, callback, options = {}) {
+    let retries    = options.retries === undefined ? requestRetries : options.retries;
+    let generation = newGeneration(options.key);
+    let attempt    = 0;
+
+    let retry = (retryAfter) => {
+        if (attempt >= retries || isSuperseded(options.key, generation)) return;
+        setTimeout(send, retryDelay(attempt++, retryAfter));
+    };
+
+    let send = () => {
+        let xhr = new XMLHttpRequest();
+        xhr.timeout = requestTimeout;
+        xhr.onload = function() {
+            if (this.status == 200) {
+                // callback is optional!
+                typeof callback === 'function' && callback(this.responseText);
+            } else if (this.status == 503 || this.status == 429) {
+                retry(this.getResponseHeader('Retry-After'));
+            }
+        };
+        xhr.ontimeout = () => retry();
+        xhr.onerror   = () => retry();
+        xhr.open('GET', path, true);
+        xhr.send();
     };
 
-    xhttp.open('GET', path, true);
-    xhttp.send();
+    send();
 }
 
 // Using Async/Await Promises
 // @see: https://medium.com/@mattburgess/how-to-get-data-with-javascript-in-2018-f30ba04ad0da
 
-function asyncAwaitRequest(path, callback) {
+function asyncAwaitRequest(path, callback, options = {}) {
+    let retries    = options.retries === undefined ? requestRetries : options.retries;
+    let generation = newGeneration(options.key);
+
     (async () => {
-        let response = await fetch(path);
-        let temp     = await response.text();
-        // callback is optional!
-        typeof callback === 'function' && callback(temp);
+        for (let attempt = 0; ; attempt++) {
+            let retryAfter;
+            let controller = new AbortController();
+            let timer      = setTimeout(() => controller.abort(), requestTimeout);
+            try {
+                let response = await fetch(path, { signal: controller.signal });
+                if (response.ok) {
+                    let text = await response.text();
+                    // callback is optional!
+                    typeof callback === 'function' && callback(text);
+                    return;
+                }
+                if (response.status != 503 && response.status != 429) return;
+                retryAfter = response.headers.get('Retry-After');
+            } catch (error) {
+                // timeout or network error: retried below
+            } finally {
+                clearTimeout(timer);
+            }
+            if (attempt >= retries || isSuperseded(options.key, generation)) return;
+            await new Promise((resolve) => setTimeout(resolve, retryDelay(attempt, retryAfter)));
+        }
     })();
-}
\ No newline at end of file
+}
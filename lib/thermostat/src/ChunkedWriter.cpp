@@ -0,0 +1,57 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "ChunkedWriter.h"
+
+size_t ChunkedWriter::fill(uint8_t *buffer, size_t size) {
+    size_t filled = 0;
+
+    while (filled < size) {
+        if (position == length) {
+            if (finished) break;
+            length = position = 0;
+            // empty items are skipped
+            while (length == 0 && !finished) finished = !next();
+            if (length == 0) break;
+        }
+        size_t count = length - position;
+        if (count > size - filled) count = size - filled;
+        memcpy(buffer + filled, item + position, count);
+        position += count;
+        filled   += count;
+    }
+
+    return filled;
+}
+
+void ChunkedWriter::print(const char *text) {
+    size_t count = strlen(text);
+    if (length + count >= CHUNK_ITEM_SIZE) {
+        count = CHUNK_ITEM_SIZE - 1 - length;
+        truncations++;
+    }
+    memcpy(item + length, text, count);
+    length += count;
+}
+
+void ChunkedWriter::print(char c) {
+    if ((size_t) length + 1 < CHUNK_ITEM_SIZE) {
+        item[length++] = c;
+    } else {
+        truncations++;
+    }
+}
+
+void ChunkedWriter::printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(item + length, CHUNK_ITEM_SIZE - length, format, args);
+    va_end(args);
+
+    if (n < 0) return;
+    if ((size_t) length + n >= CHUNK_ITEM_SIZE) {
+        n = CHUNK_ITEM_SIZE - 1 - length;
+        truncations++;
+    }
+    length += n;
+}
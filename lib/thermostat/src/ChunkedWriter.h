@@ -0,0 +1,62 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - streamed responses
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_CHUNKED_WRITER_H
+#define THERMOSTAT_CHUNKED_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A document (JSON, CSV, Prometheus text...) is produced as a sequence of
+ * small items, a line or an element of an array, which the derived class
+ * formats one after the other in `next()`, as it walks through the data.
+ * Each item is formatted in a fixed buffer, and copied into the chunks of
+ * the response as they are requested by the web server: an item that does
+ * not entirely fit in a chunk is continued in the next one. The memory used
+ * is therefore the same whatever the size of the document.
+ *
+ * An item longer than `CHUNK_ITEM_SIZE` is truncated (and counted).
+ *
+ * The writer is the filler of a chunked response (its signature is the one
+ * of `AwsResponseFiller`), and is copied into the response along with its
+ * own cursor over the data.
+ */
+
+constexpr size_t CHUNK_ITEM_SIZE = 192; // in bytes, final null character included
+
+class ChunkedWriter {
+public:
+    ChunkedWriter() : item(), length(0), position(0), finished(false), truncations(0) {}
+    virtual ~ChunkedWriter() {}
+
+    // Returns the number of bytes written, 0 once the document is complete:
+    size_t fill(uint8_t *buffer, size_t size);
+
+    size_t operator()(uint8_t *buffer, size_t size, size_t /* index */) { return fill(buffer, size); }
+
+    // To be used by `next()` only:
+    void print(const char *text);
+    void print(char c);
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    uint16_t truncated() const { return truncations; }
+
+protected:
+    // Formats the next item, returns `false` if there is none left:
+    virtual bool next() = 0;
+
+private:
+    char     item[CHUNK_ITEM_SIZE];
+    uint16_t length;   // -> of the current item
+    uint16_t position; // -> first byte of the item that has not been sent yet
+    bool     finished;
+    uint16_t truncations;
+};
+
+#endif
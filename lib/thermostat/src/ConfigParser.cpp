@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ConfigParser.h"
+
+bool parseConfigNumber(const char *value, float_t &number) {
+    char *end;
+    number = strtof(value, &end);
+    return end != value && *end == '\0' && isfinite(number);
+}
+
+bool parseConfigBool(const char *value, bool &flag) {
+    switch (hashKey(value)) {
+        KEY_CASE(value, "true")  flag = true;  return true;
+        KEY_CASE(value, "1")     flag = true;  return true;
+        KEY_CASE(value, "false") flag = false; return true;
+        KEY_CASE(value, "0")     flag = false; return true;
+    }
+    return false;
+}
+
+bool parseConfigMode(const char *value, ControlMode &mode) {
+    switch (hashKey(value)) {
+        KEY_CASE(value, "bangbang") mode = ControlMode::BangBang; return true;
+        KEY_CASE(value, "pid")      mode = ControlMode::Pid;      return true;
+        KEY_CASE(value, "autotune") mode = ControlMode::Autotune; return true;
+    }
+    return false;
+}
+
+static constexpr uint32_t RULE_KEYS[SCHEDULE_MAX_RULES] = {
+    hashKey("rule0"),  hashKey("rule1"),  hashKey("rule2"),  hashKey("rule3"),
+    hashKey("rule4"),  hashKey("rule5"),  hashKey("rule6"),  hashKey("rule7"),
+    hashKey("rule8"),  hashKey("rule9"),  hashKey("rule10"), hashKey("rule11"),
+    hashKey("rule12"), hashKey("rule13"), hashKey("rule14"), hashKey("rule15")
+};
+
+static bool setRuleField(ConfigUpdate &update, uint32_t hash, const char *key, const char *value, bool &valid) {
+    for (uint8_t i = 0; i < SCHEDULE_MAX_RULES; i++) {
+        if (hash != RULE_KEYS[i]) continue;
+        char name[sizeof("rule15")];
+        snprintf(name, sizeof(name), "rule%u", i);
+        if (strcmp(key, name) != 0) return false;
+        valid = parseScheduleRule(value, update.rules[i]);
+        update.rulesSet |= 1 << i;
+        return true;
+    }
+    return false;
+}
+
+void setConfigField(ConfigUpdate &update, uint32_t hash, const char *key, const char *value) {
+    int8_t valid = -1; // -> -1 as long as the key is unknown
+    switch (hash) {
+        KEY_CASE(key, "lower")    valid = parseConfigNumber(value, update.lower);    break;
+        KEY_CASE(key, "upper")    valid = parseConfigNumber(value, update.upper);    break;
+        KEY_CASE(key, "mode")     valid = update.hasMode = parseConfigMode(value, update.mode); break;
+        KEY_CASE(key, "kp")       valid = parseConfigNumber(value, update.gains.kp); break;
+        KEY_CASE(key, "ti")       valid = parseConfigNumber(value, update.gains.ti); break;
+        KEY_CASE(key, "td")       valid = parseConfigNumber(value, update.gains.td); break;
+        KEY_CASE(key, "reset")    valid = parseConfigBool(value, update.reset);      break;
+        KEY_CASE(key, "reboot")   valid = parseConfigBool(value, update.reboot);     break;
+        KEY_CASE(key, "schedule") valid = update.hasSchedule = parseConfigBool(value, update.schedule); break;
+        default: {
+            bool rule;
+            if (setRuleField(update, hash, key, value, rule)) valid = rule;
+        }
+    }
+    if (update.error) return;
+    if (valid < 0) update.error = "unknown key";
+    else if (!valid) update.error = "invalid value";
+}
+
+bool isValidTempRange(float_t lower, float_t upper, float_t min, float_t max) {
+    return min <= lower && lower < upper && upper <= max;
+}
+
+ConfigParser::ConfigParser() : state(ExpectObject), hash(0), keyLength(0), length(0), escaped(false) {
+    update = EMPTY_CONFIG_UPDATE;
+}
+
+void ConfigParser::feed(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len && state != Failed; i++) feed((char) data[i]);
+}
+
+ConfigUpdate &ConfigParser::finish() {
+    if (state != Done) fail("malformed document");
+    return update;
+}
+
+void ConfigParser::fail(const char *error) {
+    if (!update.error) update.error = error;
+    state = Failed;
+}
+
+void ConfigParser::append(char c) {
+    if (length == CONFIG_VALUE_SIZE) fail("value too long");
+    else value[length++] = c;
+}
+
+void ConfigParser::appendKey(char c) {
+    hash = hashKeyChar(hash, c);
+    if (keyLength < CONFIG_KEY_SIZE) key[keyLength] = c;
+    if (keyLength <= CONFIG_KEY_SIZE) keyLength++;
+}
+
+void ConfigParser::endValue(bool bare) {
+    value[length] = '\0';
+    // a key that was too long is left empty, which no key is
+    key[keyLength > CONFIG_KEY_SIZE ? 0 : keyLength] = '\0';
+    if (!bare || strcmp(value, "null") != 0) setConfigField(update, hash, key, value);
+    state = update.error ? Failed : ExpectNext;
+}
+
+void ConfigParser::feed(char c) {
+    if (escaped) {
+        escaped = false;
+        if (state == InKey) appendKey(c);
+        else append(c);
+        return;
+    }
+
+    bool blank = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+
+    switch (state) {
+        case ExpectObject:
+            if (c == '{') state = ExpectFirstKey;
+            else if (!blank) fail("object expected");
+            break;
+
+        case ExpectFirstKey:
+            if (c == '}') { state = Done; break; }
+            // falls through
+        case ExpectKey:
+            if (c == '"') { hash = HASH_KEY_BASIS; keyLength = 0; state = InKey; }
+            else if (!blank) fail("key expected");
+            break;
+
+        case InKey:
+            if (c == '"') state = ExpectColon;
+            else if (c == '\\') escaped = true;
+            else appendKey(c);
+            break;
+
+        case ExpectColon:
+            if (c == ':') state = ExpectValue;
+            else if (!blank) fail("colon expected");
+            break;
+
+        case ExpectValue:
+            length = 0;
+            if (blank) break;
+            if (c == '"') state = InString;
+            else if (c == '{' || c == '[') fail("nested values are not supported");
+            else if (c == ',' || c == '}') fail("value expected");
+            else { append(c); state = InBare; }
+            break;
+
+        case InString:
+            if (c == '"') endValue(false);
+            else if (c == '\\') escaped = true;
+            else append(c);
+            break;
+
+        case InBare:
+            if (!blank && c != ',' && c != '}') { append(c); break; }
+            endValue(true);
+            if (state == ExpectNext) feed(c);
+            break;
+
+        case ExpectNext:
+            if (c == ',') state = ExpectKey;
+            else if (c == '}') state = Done;
+            else if (!blank) fail("comma expected");
+            break;
+
+        case Done:
+            if (!blank) fail("trailing characters");
+            break;
+
+        case Failed:
+            break;
+    }
+}
@@ -0,0 +1,114 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - configuration documents
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_CONFIG_PARSER_H
+#define THERMOSTAT_CONFIG_PARSER_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "HashKey.h"
+#include "ControlEngine.h"
+#include "Schedule.h"
+
+/**
+ * A configuration document is a set of key/value pairs. Recognized keys:
+ *
+ * - lower, upper (the temperature range)
+ * - mode         (control mode: `bangbang`, `pid` or `autotune`)
+ * - kp, ti, td   (gains of the PID, see `PidGains`)
+ * - schedule     (true to let the schedule set the temperature range)
+ * - rule0..15    (a rule of the schedule, see `parseScheduleRule()`)
+ * - reset        (true to return to the factory range first)
+ * - reboot       (true to restart the ESP32 once the settings are stored)
+ *
+ * The values are only parsed here: checking them against the bounds of the
+ * thermostat and applying them is up to the firmware. A new setting only
+ * requires a new `case` in `setConfigField()`.
+ */
+
+constexpr size_t CONFIG_KEY_SIZE   = 8;                  // longest key (`schedule`), in characters
+constexpr size_t CONFIG_VALUE_SIZE = SCHEDULE_RULE_SIZE; // longest value, in characters
+
+struct ConfigUpdate {
+    float_t      lower;    // -> NAN if not provided
+    float_t      upper;    // -> NAN if not provided
+    bool         reset;
+    bool         reboot;
+    const char  *error;    // -> first error met, NULL if none
+    bool         hasMode;
+    ControlMode  mode;
+    PidGains     gains;    // -> NAN for each gain not provided
+    bool         hasSchedule;
+    bool         schedule;
+    uint16_t     rulesSet; // -> bit n if `rules[n]` is provided
+    ScheduleRule rules[SCHEDULE_MAX_RULES];
+};
+
+constexpr ConfigUpdate EMPTY_CONFIG_UPDATE = {
+    NAN, NAN, false, false, NULL, false, ControlMode::BangBang, { NAN, NAN, NAN }, false, false, 0, {}
+};
+
+bool parseConfigNumber(const char *value, float_t &number);
+bool parseConfigBool(const char *value, bool &flag);
+bool parseConfigMode(const char *value, ControlMode &mode);
+void setConfigField(ConfigUpdate &update, uint32_t hash, const char *key, const char *value); // hash: `hashKey(key)`
+
+/**
+ * The temperature range is only checked when the update defines it (or
+ * returns to the factory one): an update of the other settings must not be
+ * refused because of a range that is already in force.
+ */
+
+inline bool setsTempRange(const ConfigUpdate &update) {
+    return update.reset || !isnan(update.lower) || !isnan(update.upper);
+}
+
+bool isValidTempRange(float_t lower, float_t upper, float_t min, float_t max); // false for NAN
+
+/**
+ * Streaming parser of a flat JSON object. The keys are hashed character by
+ * character (see `hashKey()`) as they are buffered; a key longer than any
+ * known one is not kept, it is bound to be unknown.
+ * Strings, numbers, booleans and `null` are accepted as values (a string is
+ * interpreted like a form value, escapes are taken literally), nested
+ * documents are not.
+ */
+
+class ConfigParser {
+public:
+    ConfigParser();
+
+    void feed(const uint8_t *data, size_t len);
+
+    // Once the whole body has been fed:
+    ConfigUpdate &finish();
+
+private:
+    enum State : uint8_t {
+        ExpectObject, ExpectFirstKey, ExpectKey, InKey, ExpectColon,
+        ExpectValue, InString, InBare, ExpectNext, Done, Failed
+    };
+
+    void fail(const char *error);
+    void appendKey(char c);
+    void append(char c);
+    void endValue(bool bare);
+    void feed(char c);
+
+    ConfigUpdate update;
+    State        state;
+    uint32_t     hash;
+    char         key[CONFIG_KEY_SIZE + 1];
+    uint8_t      keyLength;  // -> CONFIG_KEY_SIZE + 1 once the key is too long
+    char         value[CONFIG_VALUE_SIZE + 1];
+    uint8_t      length;
+    bool         escaped;
+};
+
+#endif
@@ -0,0 +1,10 @@
+#include "Control.h"
+
+TempZone evaluateZone(TempZone zone, float_t temp, float_t lower, float_t upper, float_t hysteresis) {
+    if (temp < lower) return TempZone::Low;
+    if (temp > upper) return TempZone::High;
+    if (zone == TempZone::Low  && temp < lower + hysteresis) return TempZone::Low;
+    if (zone == TempZone::High && temp > upper - hysteresis) return TempZone::High;
+
+    return TempZone::Normal;
+}
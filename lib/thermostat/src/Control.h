@@ -0,0 +1,24 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - threshold evaluation
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_CONTROL_H
+#define THERMOSTAT_CONTROL_H
+
+#include <math.h>
+#include <stdint.h>
+
+enum class TempZone : uint8_t { Low, Normal, High };
+
+/**
+ * An excursion begins as soon as a limit is crossed, but only ends when the
+ * temperature has come back inside the range by at least `hysteresis`.
+ */
+
+TempZone evaluateZone(TempZone zone, float_t temp, float_t lower, float_t upper, float_t hysteresis);
+
+#endif
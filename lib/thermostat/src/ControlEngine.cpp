@@ -0,0 +1,172 @@
+#include "ControlEngine.h"
+
+static constexpr int64_t OUTPUT_MAX = (int64_t) CONTROL_OUTPUT_MAX << 16;
+
+static int64_t clampOutput(int64_t value) {
+    return value < 0 ? 0 : value > OUTPUT_MAX ? OUTPUT_MAX : value;
+}
+
+static float_t clampGain(float_t value, float_t max) {
+    return !(value > 0) ? 0 : value > max ? max : value;
+}
+
+ControlEngine::ControlEngine(const ControlConfig &config, const PidGains &gains)
+    : config(config), currentMode(ControlMode::BangBang), currentOutput(0), target(0),
+      started(false), bumpless(false), lastTemp(0), lastUpdate(0), pTerm(0), iTerm(0), dTerm(0),
+      tuneStart(0), lastRise(0), tempMax(0), tempMin(0), tuneCycle(0), tuneMeasured(0),
+      periodSum(0), amplitudeSum(0) {
+    setGains(gains);
+}
+
+void ControlEngine::setGains(const PidGains &gains) {
+    pidGains.kp = clampGain(gains.kp, PID_MAX_KP);
+    pidGains.ti = clampGain(gains.ti, PID_MAX_TIME);
+    pidGains.td = clampGain(gains.td, PID_MAX_TIME);
+
+    kp = (int64_t) lroundf(pidGains.kp / 100 * 65536);
+    ti = (uint32_t) lroundf(pidGains.ti * 1000);
+    td = (uint32_t) lroundf(pidGains.td * 1000);
+    // a very short integral time must not disable the integral action
+    if (pidGains.ti > 0 && ti == 0) ti = 1;
+}
+
+void ControlEngine::setMode(ControlMode mode, uint32_t now) {
+    if (mode == ControlMode::Pid && currentMode != ControlMode::Pid) bumpless = true;
+
+    if (mode == ControlMode::Autotune) {
+        tuneStart    = now;
+        tuneCycle    = 0;
+        tuneMeasured = 0;
+        periodSum    = 0;
+        amplitudeSum = 0;
+        tempMax      = INT32_MIN;
+        tempMin      = INT32_MAX;
+    }
+
+    currentMode = mode;
+}
+
+void ControlEngine::hold() {
+    currentOutput = 0;
+    started       = false; // -> no derivative across the gap
+}
+
+uint16_t ControlEngine::update(int32_t temperature, int32_t lower, int32_t upper, uint32_t now) {
+    uint32_t dt = started ? now - lastUpdate : 0;
+
+    if (currentMode == ControlMode::BangBang) {
+        target = upper;
+    } else {
+        target = lower + (upper - lower) / 2;
+    }
+
+    if (currentMode != ControlMode::Pid) pTerm = iTerm = dTerm = 0;
+
+    switch (currentMode) {
+        case ControlMode::BangBang: currentOutput = updateBangBang(temperature, upper);      break;
+        case ControlMode::Pid:      currentOutput = updatePid(temperature, dt);              break;
+        case ControlMode::Autotune: currentOutput = updateAutotune(temperature, upper, now); break;
+    }
+
+    lastTemp   = temperature;
+    lastUpdate = now;
+    started    = true;
+
+    return currentOutput;
+}
+
+uint16_t ControlEngine::updateBangBang(int32_t temperature, int32_t upper) {
+    if (temperature > upper)                      return CONTROL_OUTPUT_MAX;
+    if (temperature <= upper - config.hysteresis) return 0;
+    return currentOutput;
+}
+
+uint16_t ControlEngine::updatePid(int32_t temperature, uint32_t dt) {
+    int32_t error = temperature - target; // -> positive when cooling is needed
+
+    pTerm = kp * error;
+    dTerm = dt > 0 ? kp * td * (temperature - lastTemp) / dt : 0;
+
+    if (ti == 0) {
+        iTerm = 0;
+    } else if (bumpless) {
+        iTerm = clampOutput(((int64_t) currentOutput << 16) - pTerm - dTerm);
+    } else if (dt > 0) {
+        int64_t increment = kp * error * dt / ti;
+        int64_t output    = pTerm + iTerm + increment + dTerm;
+        // while saturated, the integral is only allowed to move back
+        bool windup = (output > OUTPUT_MAX && increment > 0) || (output < 0 && increment < 0);
+        if (!windup) iTerm = clampOutput(iTerm + increment);
+    }
+    bumpless = false;
+
+    return (uint16_t) ((clampOutput(pTerm + iTerm + dTerm) + 0x8000) >> 16);
+}
+
+uint16_t ControlEngine::updateAutotune(int32_t temperature, int32_t upper, uint32_t now) {
+    if (now - tuneStart >= config.tuneTimeout) {
+        currentMode = ControlMode::BangBang;
+        return updateBangBang(temperature, upper);
+    }
+
+    if (temperature > tempMax) tempMax = temperature;
+    if (temperature < tempMin) tempMin = temperature;
+
+    if (currentOutput == 0 && temperature > target + config.tuneBand) {
+        // a new oscillation begins with each switch to full output
+        if (tuneCycle++ > 1) {
+            periodSum    += now - lastRise;
+            amplitudeSum += tempMax - tempMin;
+            tuneMeasured++;
+        }
+        lastRise = now;
+        tempMax  = tempMin = temperature;
+
+        if (tuneMeasured >= config.tuneCycles) {
+            finishAutotune();
+            return updatePid(temperature, 0);
+        }
+        return CONTROL_OUTPUT_MAX;
+    }
+
+    if (currentOutput > 0 && temperature < target - config.tuneBand) return 0;
+
+    return currentOutput;
+}
+
+/**
+ * The relay of amplitude d (half the output swing) makes the temperature
+ * oscillate with an amplitude a, which gives the ultimate gain
+ * Ku = 4 d / (π √(a² - ε²)), ε being the hysteresis of the relay, and the
+ * ultimate period Tu is the one of the oscillation. The classic
+ * Ziegler-Nichols rules then give Kp = 0.6 Ku, Ti = Tu / 2, Td = Tu / 8.
+ */
+
+void ControlEngine::finishAutotune() {
+    float_t d  = CONTROL_OUTPUT_MAX / 2.0f;
+    float_t a  = amplitudeSum / (2.0f * tuneMeasured) / 100; // in °C
+    float_t e  = config.tuneBand / 100.0f;
+    float_t r  = a > e ? sqrtf(a * a - e * e) : a;
+    float_t ku = 4 * d / ((float_t) M_PI * r);
+    float_t tu = periodSum / (1000.0f * tuneMeasured);        // in seconds
+
+    setGains({ 0.6f * ku, tu / 2, tu / 8 });
+    setMode(ControlMode::Pid, lastUpdate);
+}
+
+uint32_t relayOnTime(uint16_t output, uint32_t window, uint32_t minOnTime, uint32_t minOffTime) {
+    if (output > CONTROL_OUTPUT_MAX) output = CONTROL_OUTPUT_MAX;
+
+    uint32_t onTime = (uint32_t) ((uint64_t) window * output / CONTROL_OUTPUT_MAX);
+
+    if (onTime > 0 && onTime < minOnTime) {
+        onTime = 2 * onTime >= minOnTime ? minOnTime : 0;
+    }
+
+    uint32_t offTime = window - onTime;
+    if (offTime > 0 && offTime < minOffTime) {
+        onTime = 2 * offTime >= minOffTime ? window - minOffTime : window;
+    }
+
+    return onTime;
+}
@@ -0,0 +1,131 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - control engine
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_CONTROL_ENGINE_H
+#define THERMOSTAT_CONTROL_ENGINE_H
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * The engine is updated once per sample with the filtered temperature, and
+ * computes the cooling demand as an output between 0 and `CONTROL_OUTPUT_MAX`
+ * (in per mille), which `relayOnTime()` turns into a duty cycle of the relay.
+ * All the computations of an update are made in fixed point: temperatures in
+ * hundredths of a degree, and an internal resolution of 1/65536 per mille.
+ *
+ * - BangBang: the former behaviour of the thermostat, full output above the
+ *   upper limit, until the temperature has come back below it by the
+ *   hysteresis
+ * - Pid: regulation at the middle of the range, in the standard form
+ *   (proportional gain, integral and derivative times). The derivative acts
+ *   on the measurement, so that a change of the range does not cause a kick,
+ *   and the integral is frozen while the output is saturated (anti-windup).
+ *   The switch to this mode is bumpless: the integral takes over the output
+ *   of the previous mode.
+ * - Autotune: relay feedback (Åström-Hägglund). The output swings between 0
+ *   and full around the middle of the range, with `tuneBand` of hysteresis;
+ *   once `tuneCycles` oscillations have been measured (the first one is
+ *   discarded), the ultimate gain and period give Ziegler-Nichols gains,
+ *   and the engine switches to Pid. Without oscillations before
+ *   `tuneTimeout`, it returns to BangBang.
+ */
+
+constexpr uint16_t CONTROL_OUTPUT_MAX = 1000; // in per mille
+
+enum class ControlMode : uint8_t { BangBang, Pid, Autotune };
+
+struct PidGains {
+    float_t kp; // in per mille of output per °C
+    float_t ti; // in seconds (0 disables the integral action)
+    float_t td; // in seconds
+};
+
+// Beyond these, the fixed-point computations of the PID could overflow
+// (the gains are clamped by `setGains()`):
+
+constexpr float_t PID_MAX_KP   = 10000;     // in per mille of output per °C
+constexpr float_t PID_MAX_TIME = 10 * 3600; // in seconds, for ti and td
+
+struct ControlConfig {
+    int32_t  hysteresis;  // in hundredths of a degree
+    int32_t  tuneBand;    // in hundredths of a degree
+    uint8_t  tuneCycles;  // -> measured oscillations
+    uint32_t tuneTimeout; // in milliseconds
+};
+
+class ControlEngine {
+public:
+    ControlEngine(const ControlConfig &config, const PidGains &gains);
+
+    void setMode(ControlMode mode, uint32_t now);
+    void setGains(const PidGains &gains);
+
+    // `temperature`, `lower` and `upper` in hundredths of a degree;
+    // returns the new output
+    uint16_t update(int32_t temperature, int32_t lower, int32_t upper, uint32_t now);
+
+    // The output is released without any usable reading:
+    void hold();
+
+    ControlMode     mode()         const { return currentMode; }
+    uint16_t        output()       const { return currentOutput; }
+    const PidGains &gains()        const { return pidGains; }
+    int32_t         setpoint()     const { return target; }
+    uint8_t         tuneProgress() const { return tuneMeasured; } // -> measured oscillations
+
+    // PID terms of the last update, in per mille:
+    float_t proportional() const { return pTerm / 65536.0f; }
+    float_t integral()     const { return iTerm / 65536.0f; }
+    float_t derivative()   const { return dTerm / 65536.0f; }
+
+private:
+    uint16_t updateBangBang(int32_t temperature, int32_t upper);
+    uint16_t updatePid(int32_t temperature, uint32_t dt);
+    uint16_t updateAutotune(int32_t temperature, int32_t upper, uint32_t now);
+    void     finishAutotune();
+
+    const ControlConfig config;
+
+    PidGains    pidGains;
+    int64_t     kp;       // -> Q16 per mille per hundredth of a degree
+    uint32_t    ti;       // in milliseconds
+    uint32_t    td;       // in milliseconds
+    ControlMode currentMode;
+    uint16_t    currentOutput;
+    int32_t     target;
+
+    bool     started;     // -> whether `lastTemp` and `lastUpdate` are set
+    bool     bumpless;    // -> the integral has to take over the output
+    int32_t  lastTemp;
+    uint32_t lastUpdate;
+    int64_t  pTerm;       // -> Q16 per mille
+    int64_t  iTerm;
+    int64_t  dTerm;
+
+    // relay feedback:
+    uint32_t tuneStart;
+    uint32_t lastRise;     // -> `now` of the last switch to full output
+    int32_t  tempMax;      // -> extremes of the current oscillation
+    int32_t  tempMin;
+    uint8_t  tuneCycle;    // -> oscillations seen, including the first one
+    uint8_t  tuneMeasured;
+    uint64_t periodSum;    // in milliseconds
+    int64_t  amplitudeSum; // -> peak to peak, in hundredths of a degree
+};
+
+/**
+ * Time-proportioning: the relay is energized for the first `output` per
+ * mille of each window. An on-time (or off-time) shorter than the minimum
+ * imposed to the relay is rounded to none, or to the minimum, whichever is
+ * nearest, so that the relay is never asked for a switching it would refuse.
+ */
+
+uint32_t relayOnTime(uint16_t output, uint32_t window, uint32_t minOnTime, uint32_t minOffTime);
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - CRC32 of the persistent records
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_CRC32_H
+#define THERMOSTAT_CRC32_H
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <rom/crc.h>
+#else
+// Same CRC as the one of the ESP32 ROM (reflected, polynomial 0xEDB88320)
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *data, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    return ~crc;
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include "Format.h"
+
+void formatJsonValue(float_t value, bool valid, char *buffer, size_t size) {
+    if (valid && !isnan(value)) {
+        snprintf(buffer, size, "%.1f", value);
+    } else {
+        snprintf(buffer, size, "null");
+    }
+}
+
+void formatReadingJson(uint8_t sensor, const char *name, float_t temp, float_t humidity, bool valid, char *buffer, size_t size) {
+    char t[8];
+    char h[8];
+    formatJsonValue(temp, valid, t, sizeof(t));
+    formatJsonValue(humidity, valid, h, sizeof(h));
+    snprintf(buffer, size, "{\"sensor\":%u,\"name\":\"%s\",\"temp\":%s,\"humidity\":%s}", sensor, name, t, h);
+}
@@ -0,0 +1,24 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - formatting of the readings
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_FORMAT_H
+#define THERMOSTAT_FORMAT_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// JSON formatting of a value which may be unavailable (`null`)
+
+void formatJsonValue(float_t value, bool valid, char *buffer, size_t size);
+
+// JSON document describing the reading of a sensor
+
+void formatReadingJson(uint8_t sensor, const char *name, float_t temp, float_t humidity, bool valid, char *buffer, size_t size);
+
+#endif
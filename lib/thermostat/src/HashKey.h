@@ -0,0 +1,50 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - compile-time hashing of keys
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_HASH_KEY_H
+#define THERMOSTAT_HASH_KEY_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Rather than comparing the names (and values) of the query parameters with
+ * a chain of `String` comparisons, each of which allocates a temporary
+ * `String`, they are hashed once (FNV-1a) and dispatched with a `switch`
+ * whose `case` labels are hashed at compile time:
+ *
+ *     const char *name = param->name().c_str();
+ *     switch (hashKey(name)) {
+ *         KEY_CASE(name, "lower") ...; break;
+ *     }
+ *
+ * The hash only designates a candidate: `KEY_CASE()` then compares the text
+ * with it, so that a name which merely collides with a key (any 32-bit hash
+ * has collisions) is treated as an unknown one rather than acted on. Two keys of
+ * the same `switch` that would have the same hash would simply not compile
+ * (duplicate case value).
+ */
+
+constexpr uint32_t HASH_KEY_BASIS = 2166136261u;
+constexpr uint32_t HASH_KEY_PRIME = 16777619u;
+
+constexpr uint32_t hashKey(const char *key, uint32_t hash = HASH_KEY_BASIS) {
+    return *key ? hashKey(key + 1, (hash ^ (uint8_t) *key) * HASH_KEY_PRIME) : hash;
+}
+
+// `case` label of `key`, which leaves the `switch` unless `text` is `key`
+
+#define KEY_CASE(text, key) case hashKey(key): if (strcmp(text, key) != 0) break;
+
+// Incremental form, for the keys that are received character by character
+
+inline uint32_t hashKeyChar(uint32_t hash, char c) {
+    return (hash ^ (uint8_t) c) * HASH_KEY_PRIME;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include <stddef.h>
+#include <string.h>
+#include "Crc32.h"
+#include "Journal.h"
+
+static uint32_t headerCRC(const JournalHeader &header) {
+    return crc32_le(0, (const uint8_t*) &header, offsetof(JournalHeader, crc));
+}
+
+static bool isErased(const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t*) data;
+    for (size_t i = 0; i < size; i++) {
+        if (bytes[i] != 0xff) return false;
+    }
+    return true;
+}
+
+uint32_t journalCRC(const JournalRecord &record) {
+    return crc32_le(0, (const uint8_t*) &record, offsetof(JournalRecord, crc));
+}
+
+bool isValidJournalRecord(const JournalRecord &record) {
+    return record.crc == journalCRC(record);
+}
+
+bool Journal::readHeader(uint32_t sector, JournalHeader &header) const {
+    return flash->read(sector * JOURNAL_SECTOR_SIZE, &header, sizeof(header))
+        && header.magic      == JOURNAL_MAGIC
+        && header.version    == JOURNAL_VERSION
+        && header.recordSize == sizeof(JournalRecord)
+        && header.crc        == headerCRC(header);
+}
+
+uint32_t Journal::recordOffset(uint32_t sector, uint16_t slot) const {
+    return sector * JOURNAL_SECTOR_SIZE + sizeof(JournalHeader) + slot * sizeof(JournalRecord);
+}
+
+bool Journal::startSector(uint32_t sector, uint32_t first) {
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic      = JOURNAL_MAGIC;
+    header.version    = JOURNAL_VERSION;
+    header.recordSize = sizeof(JournalRecord);
+    header.first      = first;
+    header.crc        = headerCRC(header);
+
+    if (!flash->erase(sector * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE)) return false;
+    if (!flash->write(sector * JOURNAL_SECTOR_SIZE, &header, sizeof(header))) return false;
+
+    head      = sector;
+    headFirst = first;
+    return true;
+}
+
+bool Journal::begin(JournalFlash *partition, uint32_t size) {
+    flash   = partition;
+    sectors = size / JOURNAL_SECTOR_SIZE;
+
+    bool found = false;
+    for (uint32_t i = 0; i < sectors; i++) {
+        JournalHeader header;
+        if (!readHeader(i, header)) continue;
+        if (!found || header.first > headFirst) {
+            head      = i;
+            headFirst = header.first;
+        }
+        if (!found || header.first < oldest) oldest = header.first;
+        found = true;
+    }
+
+    if (sectors < 2) {
+        flash = NULL;
+    } else if (!found) {
+        oldest = next = 0;
+        if (!startSector(0, 0)) flash = NULL;
+    } else {
+        // the records are written in order: the end is the first erased slot
+        uint16_t slot = 0;
+        while (slot < JOURNAL_SECTOR_RECORDS) {
+            JournalRecord record;
+            if (!flash->read(recordOffset(head, slot), &record, sizeof(record))) break;
+            if (isErased(&record, sizeof(record))) break;
+            slot++;
+        }
+        next = headFirst + slot;
+        // sectors left over by a partition of another size
+        uint32_t capacity = (sectors - 1) * JOURNAL_SECTOR_RECORDS + slot;
+        if (next - oldest > capacity) oldest = next - capacity;
+    }
+
+    return flash != NULL;
+}
+
+bool Journal::append(JournalRecord records[], uint16_t count) {
+    if (flash == NULL) return false;
+
+    bool     written = true;
+    uint16_t done    = 0;
+
+    while (done < count) {
+        uint16_t slot = next - headFirst;
+        if (slot == JOURNAL_SECTOR_RECORDS) {
+            uint32_t      sector = (head + 1) % sectors;
+            JournalHeader header;
+            // once the ring is full, the records of the oldest sector are lost
+            if (readHeader(sector, header) && header.first + JOURNAL_SECTOR_RECORDS > oldest) {
+                oldest = header.first + JOURNAL_SECTOR_RECORDS;
+            }
+            if (!startSector(sector, next)) return false;
+            slot = 0;
+        }
+
+        uint16_t run = count - done;
+        if (run > JOURNAL_SECTOR_RECORDS - slot) run = JOURNAL_SECTOR_RECORDS - slot;
+
+        for (uint16_t i = 0; i < run; i++) {
+            JournalRecord &record = records[done + i];
+            record.sequence = next + i;
+            record.reserved = 0;
+            record.crc      = journalCRC(record);
+        }
+        // a failed write still uses up its slots, which will not be readable
+        if (!flash->write(recordOffset(head, slot), records + done, run * sizeof(JournalRecord))) written = false;
+
+        next += run;
+        done += run;
+    }
+
+    return written;
+}
+
+bool Journal::read(uint32_t sequence, JournalRecord &record) const {
+    if (flash == NULL || sequence < oldest || sequence >= next) return false;
+
+    // all the sectors before the head one are full
+    uint32_t back = sequence >= headFirst ? 0 : (headFirst - 1 - sequence) / JOURNAL_SECTOR_RECORDS + 1;
+    if (back >= sectors) return false;
+
+    uint32_t sector = (head + sectors - back) % sectors;
+    uint32_t first  = headFirst - back * JOURNAL_SECTOR_RECORDS;
+
+    return flash->read(recordOffset(sector, sequence - first), &record, sizeof(record))
+        && record.sequence == sequence
+        && isValidJournalRecord(record);
+}
@@ -0,0 +1,120 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - event journal
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment, where the
+ * tests provide their own flash memory.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_JOURNAL_H
+#define THERMOSTAT_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The journal is an append-only ring of fixed-size records, spread over the
+ * sectors of a dedicated flash partition. Each sector begins with a header
+ * giving the rank of its first record: at startup, the most recent sector is
+ * the one with the highest rank, and the end of the journal is its first
+ * erased slot. Once it is full, the next sector (the oldest one) is erased
+ * and takes over. Each sector is thus erased in turn, the same number of
+ * times, and never more than once per `sectors * JOURNAL_SECTOR_RECORDS`
+ * events (the writes themselves do not wear the flash memory).
+ *
+ * Each record carries its rank (`sequence`) and a CRC32, so that a record
+ * that has been torn by a power failure is never taken for valid: it is
+ * simply skipped, like the slots of the oldest erased sector.
+ */
+
+enum class JournalEvent : uint8_t {
+    Boot,           // -> source: reset reason
+    Reboot,         // -> requested by the operator
+    Reset,          // -> factory reset
+    Excursion,      // -> source: new zone, value: temperature, extra: limit crossed
+    SensorFailure,  // -> source: sensor, value: last good temperature
+    SensorRecovery, // -> source: sensor, value: temperature
+    RangeChanged,   // -> value: lower limit, extra: upper limit
+    ControlChanged, // -> source: mode, value: kp (in per mille per °C)
+    ScheduleChanged // -> source: rules set, value: whether the schedule is enabled
+};
+
+constexpr uint8_t JOURNAL_EVENT_COUNT = (uint8_t) JournalEvent::ScheduleChanged + 1;
+
+struct JournalRecord {
+    uint32_t sequence; // -> rank of the event, since the journal was formatted
+    uint32_t time;     // -> UNIX time, 0 if the clock was not set yet
+    uint32_t uptime;   // in seconds
+    uint8_t  type;     // -> `JournalEvent`
+    uint8_t  source;
+    int16_t  value;    // in tenths (of a degree, unless stated otherwise), INT16_MIN if none
+    int16_t  extra;
+    uint16_t reserved;
+    uint32_t crc;      // -> CRC32 of all the preceding bytes
+};
+
+static_assert(sizeof(JournalRecord) == 24, "JournalRecord must remain packed in 24 bytes");
+
+struct JournalHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t first;    // -> sequence of the first record of the sector
+    uint32_t crc;      // -> CRC32 of all the preceding bytes
+};
+
+constexpr uint32_t JOURNAL_MAGIC          = 0x4c4e524a; // -> "JRNL"
+constexpr uint16_t JOURNAL_VERSION        = 1;
+constexpr uint32_t JOURNAL_SECTOR_SIZE    = 4096;       // -> erase unit of the flash memory
+constexpr uint16_t JOURNAL_SECTOR_RECORDS = (JOURNAL_SECTOR_SIZE - sizeof(JournalHeader)) / sizeof(JournalRecord);
+
+// Access to the partition, offsets in bytes from its beginning:
+
+class JournalFlash {
+public:
+    virtual ~JournalFlash() {}
+
+    virtual bool read(uint32_t offset, void *data, size_t size) = 0;
+    virtual bool write(uint32_t offset, const void *data, size_t size) = 0;
+    virtual bool erase(uint32_t offset, size_t size) = 0;
+};
+
+class Journal {
+public:
+    Journal() : flash(NULL), sectors(0), head(0), headFirst(0), oldest(0), next(0) {}
+
+    // Scans the partition, and formats it if it holds no journal.
+    // At least 2 sectors are needed.
+    bool begin(JournalFlash *flash, uint32_t size);
+
+    // Writes a batch of records, stamped with their sequence and CRC. The
+    // slots of a failed write are used up, but if the next sector cannot be
+    // started, `end()` stops before the records that are left, which can be
+    // appended again:
+    bool append(JournalRecord records[], uint16_t count);
+
+    // A record that has been overwritten, or damaged, cannot be read:
+    bool read(uint32_t sequence, JournalRecord &record) const;
+
+    bool     ready() const { return flash != NULL; }
+    uint32_t first() const { return oldest; } // -> sequence of the oldest record kept
+    uint32_t end()   const { return next; }   // -> sequence of the next record
+
+private:
+    bool     readHeader(uint32_t sector, JournalHeader &header) const;
+    bool     startSector(uint32_t sector, uint32_t first);
+    uint32_t recordOffset(uint32_t sector, uint16_t slot) const;
+
+    JournalFlash *flash;
+    uint32_t      sectors;
+    uint32_t      head;      // -> sector being filled
+    uint32_t      headFirst; // -> sequence of its first record
+    uint32_t      oldest;
+    uint32_t      next;
+};
+
+uint32_t journalCRC(const JournalRecord &record);
+bool     isValidJournalRecord(const JournalRecord &record);
+
+#endif
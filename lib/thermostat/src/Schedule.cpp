@@ -0,0 +1,181 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Schedule.h"
+
+constexpr uint32_t MINUTES_PER_DAY = 24 * 60;
+constexpr uint8_t  EVERY_DAY       = 0x7f;
+constexpr uint8_t  SCAN_DAYS       = 8; // -> a weekly rule always starts within this many days
+
+// See http://howardhinnant.github.io/date_algorithms.html
+
+uint32_t civilDay(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int      era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = (unsigned) (year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (uint32_t) (era * 146097 + (int) doe - 719468);
+}
+
+void civilDate(uint32_t days, int &year, unsigned &month, unsigned &day) {
+    uint32_t z   = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp  = (5 * doy + 2) / 153;
+    day   = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year  = (int) (yoe + era * 400) + (month <= 2);
+}
+
+uint32_t localMinutes(int year, unsigned month, unsigned day, unsigned hour, unsigned minute) {
+    return civilDay(year, month, day) * MINUTES_PER_DAY + hour * 60 + minute;
+}
+
+// The period of the year is given as MMDD-MMDD:
+
+static bool parseMonthDay(const char *text, char **end, uint16_t &key) {
+    unsigned long value = strtoul(text, end, 10);
+    if (*end - text != 4) return false;
+    unsigned long month = value / 100, day = value % 100;
+    if (month < 1 || month > 12 || day < 1 || day > 31) return false;
+    key = (uint16_t) (month << 5 | day);
+    return true;
+}
+
+static bool parseTenths(const char *text, char **end, int16_t &tenths) {
+    float value = strtof(text, end);
+    if (*end == text || !isfinite(value) || fabsf(value) > 1000) return false;
+    tenths = (int16_t) lroundf(value * 10);
+    return true;
+}
+
+static bool parseRuleFields(const char *text, ScheduleRule &rule) {
+    const char *p = text;
+    if (*p == '*') {
+        rule.days = EVERY_DAY;
+        p++;
+    } else {
+        for (; *p >= '1' && *p <= '7'; p++) rule.days |= 1 << (*p - '1');
+    }
+    if (rule.days == 0 || *p != ' ') return false;
+
+    char *end;
+    unsigned long hour = strtoul(p, &end, 10);
+    if (end == p || *end != ':' || hour > 23) return false;
+    p = end + 1;
+    unsigned long minute = strtoul(p, &end, 10);
+    if (end - p != 2 || minute > 59) return false;
+    rule.minute = (uint16_t) (hour * 60 + minute);
+
+    if (*end != ' ' || !parseTenths(end, &end, rule.lower)) return false;
+    if (*end != ' ' || !parseTenths(end, &end, rule.upper)) return false;
+    if (rule.lower >= rule.upper) return false;
+
+    if (*end == ' ') {
+        if (!parseMonthDay(end + 1, &end, rule.first) || *end != '-') return false;
+        if (!parseMonthDay(end + 1, &end, rule.last)) return false;
+    }
+
+    return *end == '\0';
+}
+
+bool parseScheduleRule(const char *text, ScheduleRule &rule) {
+    memset(&rule, 0, sizeof(rule));
+    if (*text == '\0' || strcmp(text, "off") == 0) return true;
+
+    // an invalid rule leaves an empty slot
+    if (parseRuleFields(text, rule)) return true;
+    memset(&rule, 0, sizeof(rule));
+    return false;
+}
+
+void formatScheduleRule(const ScheduleRule &rule, char *buffer, size_t size) {
+    if (rule.days == 0) {
+        snprintf(buffer, size, "off");
+        return;
+    }
+
+    char days[8];
+    uint8_t n = 0;
+    if (rule.days == EVERY_DAY) {
+        days[n++] = '*';
+    } else {
+        for (uint8_t i = 0; i < 7; i++) if (rule.days & 1 << i) days[n++] = '1' + i;
+    }
+    days[n] = '\0';
+
+    int length = snprintf(buffer, size, "%s %02u:%02u %.1f %.1f", days,
+        rule.minute / 60, rule.minute % 60, rule.lower / 10.0, rule.upper / 10.0);
+    if (rule.first || rule.last) {
+        snprintf(buffer + length, size - length, " %02u%02u-%02u%02u",
+            rule.first >> 5, rule.first & 31, rule.last >> 5, rule.last & 31);
+    }
+}
+
+bool ruleAppliesOn(const ScheduleRule &rule, uint32_t day) {
+    if (!(rule.days & 1 << (day + 3) % 7)) return false; // -> 1970-01-01 was a Thursday
+    if (rule.first == 0 && rule.last == 0) return true;
+
+    int      year;
+    unsigned month, date;
+    civilDate(day, year, month, date);
+    uint16_t key = (uint16_t) (month << 5 | date);
+
+    return rule.first <= rule.last ? rule.first <= key && key <= rule.last
+                                   : key >= rule.first || key <= rule.last;
+}
+
+bool ScheduleEvaluator::update(const ScheduleTable &table, uint32_t now) {
+    // a clock that goes back (new time zone, end of the daylight saving time...)
+    // also requires a new scan
+    if (!due && evaluated <= now && now < next) return false;
+
+    bool   reached  = !due && evaluated <= now && scheduled;
+    int8_t previous = current;
+    evaluate(table, now);
+
+    bool changed = forced || reached || current != previous;
+    evaluated = now;
+    due       = false;
+    forced    = false;
+    return changed;
+}
+
+void ScheduleEvaluator::evaluate(const ScheduleTable &table, uint32_t now) {
+    uint32_t today  = now / MINUTES_PER_DAY;
+    uint16_t minute = now % MINUTES_PER_DAY;
+
+    // latest transition: the most recent day that has one
+    current = -1;
+    for (uint8_t back = 0; back < SCAN_DAYS && back <= today && current < 0; back++) {
+        uint16_t latest = 0;
+        for (uint8_t i = 0; i < SCHEDULE_MAX_RULES; i++) {
+            const ScheduleRule &rule = table.rules[i];
+            if (!ruleAppliesOn(rule, today - back)) continue;
+            if (back == 0 && rule.minute > minute) continue;
+            if (current < 0 || rule.minute >= latest) {
+                current = i;
+                latest  = rule.minute;
+            }
+        }
+    }
+
+    // next transition: the first day that has one (failing that, the table
+    // is scanned again at the end of the search window)
+    uint32_t horizon = (today + SCAN_DAYS) * MINUTES_PER_DAY;
+    next = horizon;
+    for (uint8_t ahead = 0; ahead < SCAN_DAYS && next == horizon; ahead++) {
+        for (uint8_t i = 0; i < SCHEDULE_MAX_RULES; i++) {
+            const ScheduleRule &rule = table.rules[i];
+            if (!ruleAppliesOn(rule, today + ahead)) continue;
+            if (ahead == 0 && rule.minute <= minute) continue;
+            uint32_t start = (today + ahead) * MINUTES_PER_DAY + rule.minute;
+            if (start < next) next = start;
+        }
+    }
+    scheduled = next != horizon;
+}
@@ -0,0 +1,91 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - scheduled temperature ranges
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_SCHEDULE_H
+#define THERMOSTAT_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A schedule is a fixed table of rules, each of which sets the temperature
+ * range at a given time of day, on some days of the week, and optionally
+ * only during a period of the year (a fermentation, a season...):
+ *
+ *     12345 07:30 12.0 14.0             -> weekdays at 7.30 am
+ *     67 09:00 11.0 13.5 0301-0415      -> weekends, from March 1st to April 15th
+ *     * 22:00 10.0 12.0 1101-0228       -> every day, in winter
+ *
+ * (ISO weekdays, 1 for Monday, `*` for every day). The range in force is the
+ * one of the latest transition, the last rule of the table winning when
+ * several ones start at the same minute. Times are counted in local minutes
+ * since 1970-01-01 (see `localMinutes()`), which the evaluator only compares
+ * with the next transition, computed in advance: the table is only scanned
+ * again once that transition has been reached.
+ */
+
+constexpr uint8_t SCHEDULE_MAX_RULES = 16;
+constexpr size_t  SCHEDULE_RULE_SIZE = 40; // longest textual rule, in characters
+
+struct ScheduleRule {
+    uint8_t  days;     // -> bit n for ISO weekday n + 1, 0 if the slot is empty
+    uint8_t  reserved;
+    uint16_t minute;   // -> start, in minutes after midnight
+    uint16_t first;    // -> period of the year, as (month << 5) | day,
+    uint16_t last;     //    0 for all year (wraps around the new year if first > last)
+    int16_t  lower;    // in tenths of a degree
+    int16_t  upper;
+};
+
+static_assert(sizeof(ScheduleRule) == 12, "ScheduleRule must remain packed in 12 bytes");
+
+struct ScheduleTable {
+    bool         enabled;
+    ScheduleRule rules[SCHEDULE_MAX_RULES];
+};
+
+// Civil calendar (proleptic Gregorian), days counted from 1970-01-01:
+
+uint32_t civilDay(int year, unsigned month, unsigned day);
+void     civilDate(uint32_t days, int &year, unsigned &month, unsigned &day);
+uint32_t localMinutes(int year, unsigned month, unsigned day, unsigned hour, unsigned minute);
+
+// An empty value (or `off`) designates an empty slot:
+
+bool parseScheduleRule(const char *text, ScheduleRule &rule);
+void formatScheduleRule(const ScheduleRule &rule, char *buffer, size_t size);
+bool ruleAppliesOn(const ScheduleRule &rule, uint32_t day);
+
+class ScheduleEvaluator {
+public:
+    ScheduleEvaluator() : current(-1), evaluated(0), next(0), scheduled(false), due(true), forced(false) {}
+
+    // Returns `true` if a transition has been reached since the last call
+    // (even one to the rule already in force, which applies it again), if
+    // the rule in force has changed, or if the table has been invalidated
+    // meanwhile:
+    bool update(const ScheduleTable &table, uint32_t now);
+
+    // The table has been modified:
+    void invalidate() { due = true; forced = true; }
+
+    int8_t   active()         const { return current; } // -> -1 if no rule applies
+    uint32_t nextTransition() const { return next; }
+
+private:
+    void evaluate(const ScheduleTable &table, uint32_t now);
+
+    int8_t   current;
+    uint32_t evaluated; // -> `now` of the last scan of the table
+    uint32_t next;      // -> next transition (or next scan), in local minutes
+    bool     scheduled; // -> `next` is the start of a rule, not the end of the search window
+    bool     due;
+    bool     forced;
+};
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - sensor driver interface
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment, where the
+ * tests provide their own fake sensors.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_SENSOR_H
+#define THERMOSTAT_SENSOR_H
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * All the probes are driven through the same interface, which splits a
+ * reading in two steps, so that the conversions of the sensors that can
+ * measure on their own overlap with each other:
+ *
+ * - `startConversion()` triggers a measurement and returns the time (in
+ *   milliseconds) the sensor needs before it can be collected, or 0 if the
+ *   sensor is read synchronously by `collect()`
+ * - `collect()` retrieves the result, and returns `false` on failure
+ *
+ * Unavailable values are set to NAN (a DS18B20 does not measure humidity).
+ */
+
+struct Reading {
+    float_t temperature;
+    float_t humidity;
+};
+
+class Sensor {
+public:
+    explicit Sensor(const char *name) : name(name) {}
+    virtual ~Sensor() {}
+
+    virtual void     begin() = 0;
+    virtual uint32_t startConversion() = 0;
+    virtual bool     collect(Reading &reading) = 0;
+
+    const char * const name;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include <string.h>
+#include "Crc32.h"
+#include "Settings.h"
+
+uint32_t settingsCRC(const SettingsRecord &record) {
+    return crc32_le(0, (const uint8_t*) &record, offsetof(SettingsRecord, crc));
+}
+
+void makeSettingsRecord(SettingsRecord &record, float_t lower, float_t upper) {
+    memset(&record, 0, sizeof(record)); // -> the padding bytes are covered by the CRC
+    record.version = SETTINGS_VERSION;
+    record.lower   = lower;
+    record.upper   = upper;
+    record.crc     = settingsCRC(record);
+}
+
+bool isValidSettingsRecord(const SettingsRecord &record) {
+    return record.version == SETTINGS_VERSION && record.crc == settingsCRC(record);
+}
+
+uint32_t controlCRC(const ControlRecord &record) {
+    return crc32_le(0, (const uint8_t*) &record, offsetof(ControlRecord, crc));
+}
+
+void makeControlRecord(ControlRecord &record, ControlMode mode, const PidGains &gains) {
+    memset(&record, 0, sizeof(record));
+    record.version = CONTROL_SETTINGS_VERSION;
+    record.mode    = (uint8_t) mode;
+    record.gains   = gains;
+    record.crc     = controlCRC(record);
+}
+
+bool isValidControlRecord(const ControlRecord &record) {
+    return record.version == CONTROL_SETTINGS_VERSION
+        && record.mode <= (uint8_t) ControlMode::Autotune
+        && record.crc == controlCRC(record);
+}
+
+uint32_t scheduleCRC(const ScheduleRecord &record) {
+    return crc32_le(0, (const uint8_t*) &record, offsetof(ScheduleRecord, crc));
+}
+
+void makeScheduleRecord(ScheduleRecord &record, const ScheduleTable &table) {
+    memset(&record, 0, sizeof(record));
+    record.version       = SCHEDULE_VERSION;
+    record.table.enabled = table.enabled; // -> field by field, so that the padding stays zeroed
+    memcpy(record.table.rules, table.rules, sizeof(table.rules));
+    record.crc           = scheduleCRC(record);
+}
+
+bool isValidScheduleRecord(const ScheduleRecord &record) {
+    return record.version == SCHEDULE_VERSION && record.crc == scheduleCRC(record);
+}
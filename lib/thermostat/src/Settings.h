@@ -0,0 +1,68 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - persistent settings layout
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_SETTINGS_H
+#define THERMOSTAT_SETTINGS_H
+
+#include <math.h>
+#include <stdint.h>
+#include "ControlEngine.h"
+#include "Schedule.h"
+
+/**
+ * The record carries a version number and a CRC32, so that a record written
+ * by another version of the firmware (or damaged) is never taken for valid.
+ * It is stored as is, as a blob, in the flash memory.
+ */
+
+constexpr uint8_t SETTINGS_VERSION = 1;
+
+struct SettingsRecord {
+    uint8_t  version;
+    float_t  lower;
+    float_t  upper;
+    uint32_t crc; // -> CRC32 of all the preceding bytes
+};
+
+uint32_t settingsCRC(const SettingsRecord &record);
+void     makeSettingsRecord(SettingsRecord &record, float_t lower, float_t upper);
+bool     isValidSettingsRecord(const SettingsRecord &record);
+
+/**
+ * The settings of the control engine are stored apart, in a record of their
+ * own, built the same way.
+ */
+
+constexpr uint8_t CONTROL_SETTINGS_VERSION = 1;
+
+struct ControlRecord {
+    uint8_t  version;
+    uint8_t  mode;  // -> `ControlMode`
+    PidGains gains;
+    uint32_t crc;   // -> CRC32 of all the preceding bytes
+};
+
+uint32_t controlCRC(const ControlRecord &record);
+void     makeControlRecord(ControlRecord &record, ControlMode mode, const PidGains &gains);
+bool     isValidControlRecord(const ControlRecord &record);
+
+// And so is the schedule:
+
+constexpr uint8_t SCHEDULE_VERSION = 1;
+
+struct ScheduleRecord {
+    uint8_t       version;
+    ScheduleTable table;
+    uint32_t      crc; // -> CRC32 of all the preceding bytes
+};
+
+uint32_t scheduleCRC(const ScheduleRecord &record);
+void     makeScheduleRecord(ScheduleRecord &record, const ScheduleTable &table);
+bool     isValidScheduleRecord(const ScheduleRecord &record);
+
+#endif
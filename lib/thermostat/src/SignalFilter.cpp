@@ -0,0 +1,43 @@
+#include "SignalFilter.h"
+
+void SignalFilter::reset() {
+    count     = 0;
+    head      = 0;
+    rejects   = 0;
+    filtered  = NAN;
+    timestamp = 0;
+}
+
+SignalFilter::Verdict SignalFilter::update(float_t raw, uint32_t now) {
+    if (isnan(raw)) return Missing;
+
+    if (count > 0) {
+        float_t elapsed = (now - timestamp) / 1000.0f;
+        if (fabsf(raw - filtered) > config.tolerance + config.maxRate * elapsed) {
+            if (++rejects < config.maxRejects) return Rejected;
+            reset(); // -> the signal has actually stepped
+        }
+    }
+
+    window[head] = raw;
+    head = (head + 1) % config.window;
+    if (count < config.window) count++;
+
+    float_t m = median();
+    filtered  = isnan(filtered) ? m : filtered + config.alpha * (m - filtered);
+    timestamp = now;
+    rejects   = 0;
+    return Accepted;
+}
+
+// insertion sort of a copy of the window, which holds a handful of values
+
+float_t SignalFilter::median() const {
+    float_t sorted[FILTER_MAX_WINDOW];
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > window[i]; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = window[i];
+    }
+    return count & 1 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+}
@@ -0,0 +1,66 @@
+/**
+ * ----------------------------------------------------------------------------
+ * ESP32 Web Controlled Thermostat - signal filtering
+ * ----------------------------------------------------------------------------
+ * Hardware-independent: also built by the `native` environment.
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef THERMOSTAT_SIGNAL_FILTER_H
+#define THERMOSTAT_SIGNAL_FILTER_H
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Each measured quantity has its own filter, which works in place on a
+ * fixed-size window: no dynamic allocation is ever made. A NAN reading is
+ * reported as missing and leaves the filter untouched.
+ *
+ * 1. a reading that strays from the filtered value by more than the
+ *    tolerance, plus the maximum rate of change times the time elapsed since
+ *    the last accepted reading, is rejected as an outlier, unless
+ *    `maxRejects` readings in a row are, in which case the signal has really
+ *    moved and the filter starts over from the new level
+ * 2. the median of the last `window` accepted readings removes the
+ *    remaining spikes
+ * 3. an exponential moving average of factor `alpha` smooths out the
+ *    quantization noise (1 disables it)
+ */
+
+constexpr uint8_t FILTER_MAX_WINDOW = 9; // -> capacity of the median window
+
+struct FilterConfig {
+    uint8_t window;     // -> median window, in readings
+    float_t alpha;      // -> EMA smoothing factor
+    float_t tolerance;  // -> accepted deviation, whatever the elapsed time
+    float_t maxRate;    // -> accepted deviation per second
+    uint8_t maxRejects; // -> consecutive outliers that make a step
+};
+
+class SignalFilter {
+public:
+    enum Verdict : uint8_t { Accepted, Rejected, Missing };
+
+    explicit SignalFilter(const FilterConfig &config) : config(config) { reset(); }
+
+    void    reset();
+    Verdict update(float_t raw, uint32_t now);
+
+    float_t  value() const { return filtered; }
+    uint32_t age(uint32_t now) const { return now - timestamp; }
+
+private:
+    float_t median() const;
+
+    const FilterConfig config;
+
+    float_t  window[FILTER_MAX_WINDOW];
+    uint8_t  count;
+    uint8_t  head;
+    uint8_t  rejects;
+    float_t  filtered;
+    uint32_t timestamp; // -> `millis()` of the last accepted reading
+};
+
+#endif
@@ -11,11 +11,45 @@
  */
 
 #include <EEPROM.h>
+#include <Preferences.h>
 #include <SPIFFS.h>
 #include <DHT.h>
+#include <OneWire.h>
+#include <DallasTemperature.h>
+#include <Wire.h>
+#include <Adafruit_BME280.h>
 #include <WiFi.h>
+#include <esp_wifi.h>
+#include <esp_sleep.h>
+#include <ESPmDNS.h>
+#include <AsyncUDP.h>
+#include <AsyncMqttClient.h>
 #include <ESPAsyncWebServer.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <rom/crc.h>
+#include <esp_heap_caps.h>
+#include <freertos/ringbuf.h>
+#include <freertos/event_groups.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
 #include <Arduino.h>
+#include <new>
+#include <algorithm>
+#include <HashKey.h>
+#include <Sensor.h>
+#include <SignalFilter.h>
+#include <Control.h>
+#include <ControlEngine.h>
+#include <Schedule.h>
+#include <Settings.h>
+#include <Format.h>
+#include <ChunkedWriter.h>
+#include <Journal.h>
+#include <ConfigParser.h>
+#ifdef EMBEDDED_ASSETS
+#include <EmbeddedAssets.h> // -> generated by tools/compress_assets.py
+#endif
 
 // ----------------------------------------------------------------------------
 // Macros
@@ -27,18 +61,109 @@
 /**
  * We are going to use 2 LEDs:
  * - one as a WiFi network connection indicator
- * - one as an activity indicator for temperature sensor read requests from
- *   the client browser
+ * - one as an activity indicator for temperature sensor readings
+ *
+ * Neither of them is polled by the main loop: the first one is driven by a
+ * LEDC channel (the PWM peripheral) at a very low frequency, and the second
+ * one is turned off by a one-shot timer.
  */
 
 #define INIT_LED LED_BUILTIN
 #define TEMP_LED GPIO_NUM_23
 
-// DHT11 temperature sensor
-// ------------------------
+// Temperature sensors
+// -------------------
+
+/**
+ * Several probes can be connected at the same time (see the `sensors` table
+ * in the global variables):
+ * - DHT11 / DHT22 sensors, each on its own pin
+ * - DS18B20 sensors, all on the same OneWire bus
+ * - SHT3x and BME280 sensors, on the I2C bus
+ */
+
+#define DHT_PIN      GPIO_NUM_32
+#define DHT_TYPE     DHT11
+#define ONE_WIRE_PIN GPIO_NUM_4
+#define I2C_SDA_PIN  GPIO_NUM_21
+#define I2C_SCL_PIN  GPIO_NUM_22
+
+// Cooling unit relay
+// ------------------
+
+/**
+ * The relay drives the cooling unit of the cellar: it is energized when the
+ * temperature rises above the upper limit set by the operator.
+ */
+
+#define RELAY_PIN GPIO_NUM_33
+
+// Task model
+// ----------
+
+/**
+ * The work is split between the two cores of the ESP32:
+ *
+ * - the network core runs the WiFi and lwIP tasks (ESP-IDF), the AsyncTCP
+ *   task, which executes all the HTTP handlers and the MQTT client callbacks
+ *   (pinned by the `CONFIG_ASYNC_TCP_RUNNING_CORE` build flag), the MQTT
+ *   publisher, the broadcaster of the `/events` stream and the logger
+ * - the control core runs the sampler, which reads the sensors and runs the
+ *   control loop at a high priority, and the settings persistence task
+ *
+ * The HTTP handlers never touch the sensors: they only read the latest
+ * snapshots from memory. And the DHT protocol, which disables interrupts
+ * while it is bit-banged, can no longer delay the network stack.
+ *
+ * The Arduino loop task has nothing left to do: it is deleted once the
+ * initialization is over, so that the control core can idle between two
+ * samples.
+ */
+
+#define NETWORK_CORE 0
+#define CONTROL_CORE 1
+
+// Logging
+// -------
+
+/**
+ * The messages of a level higher than `LOG_LEVEL` are removed at compile
+ * time (with their arguments, which are then never evaluated). The level can
+ * be set from `platformio.ini` with `build_flags = -D LOG_LEVEL=...`, and
+ * release builds may use `LOG_LEVEL_NONE` to strip them all.
+ *
+ * The remaining messages are not written directly on the serial port, which
+ * would block the caller as soon as the UART FIFO is full: they are queued in
+ * a ring buffer drained by a low priority task (see `logPrintf()`).
+ */
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logPrintf(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
 
-#define DHT_PIN  GPIO_NUM_32
-#define DHT_TYPE DHT11
 
 // ----------------------------------------------------------------------------
 // Global constants
@@ -50,503 +175,4607 @@
 /**
  * The thermostat will be configured to operate within a temperature range
  * defined by a lower and an upper values that can be set by the operator.
- * The operator will be able to save these values in the EEPROM. An `INIT_FLAG`
- * backup indicator will allow the firmware to determine if this backup has
- * been performed at least once.
+ * The operator will be able to save these values in the flash memory.
+ * The absence of a backup (or an invalid one) means that the factory
+ * settings must be used.
  * 
  * In addition, we define here the extreme values that the upper and lower
  * limits of operator-defined temperatures must not be exceeded.
  */
 
-constexpr uint8_t INIT_FLAG = 42; // 😉 "The Hitchhiker's Guide to the Galaxy" (Douglas Adams)
 constexpr float_t MIN_TEMP  = 10; // ideal temperatures
 constexpr float_t MAX_TEMP  = 14; // for a wine cellar
 
-// Definition of the 3 memory slots to be reserved in the EEPROM
-// -------------------------------------------------------------
+// Settings persistence
+// --------------------
+
+/**
+ * The settings are stored with the `Preferences` library, i.e. in the NVS
+ * partition of the flash memory, which appends the new entries to its pages
+ * and levels their wear, rather than erasing a whole sector at each write.
+ *
+ * Moreover, the changes are not written immediately but by a background
+ * task, once the operator has stopped changing them for `SETTINGS_DEBOUNCE`
+ * milliseconds (and in any case no later than `SETTINGS_MAX_DELAY`).
+ */
+
+constexpr char        SETTINGS_NAMESPACE[] = "thermostat";
+constexpr char        SETTINGS_KEY[]       = "range";
+constexpr char        CONTROL_KEY[]        = "control";
+constexpr char        SCHEDULE_KEY[]       = "schedule";
+constexpr uint32_t    SETTINGS_DEBOUNCE    = 5000;  // in milliseconds
+constexpr uint32_t    SETTINGS_MAX_DELAY   = 30000; // in milliseconds
+constexpr uint32_t    PERSISTER_STACK      = 4096;  // in bytes
+constexpr UBaseType_t PERSISTER_PRIORITY   = 1;
+
+// Event journal
+// -------------
+
+/**
+ * The events that matter for a post-mortem (excursions, sensor failures,
+ * boots, reboots and factory resets, changes of the settings) are recorded
+ * in a journal (see `Journal` in lib/thermostat), in a dedicated partition
+ * of the flash memory (see partitions.csv), where they survive the reboots.
+ *
+ * They are first queued in memory, and then written in batches by the
+ * sampling task, as soon as `JOURNAL_BATCH` of them are pending, and in any
+ * case no later than `JOURNAL_FLUSH_DELAY` after the first one (and before
+ * a requested reboot). `/events/log` serves them `JOURNAL_PAGE_SIZE` at a
+ * time, the most recent first.
+ */
+
+constexpr char     JOURNAL_PARTITION[] = "journal";
+constexpr uint8_t  JOURNAL_QUEUE_SIZE  = 32;    // -> pending events
+constexpr uint8_t  JOURNAL_BATCH       = 8;     // -> events written at once
+constexpr uint32_t JOURNAL_FLUSH_DELAY = 30000; // in milliseconds
+constexpr uint8_t  JOURNAL_PAGE_SIZE   = 32;    // -> events per page
+
+// Legacy EEPROM layout
+// --------------------
+
+/**
+ * Previous versions of the firmware stored the temperature range in the
+ * 3 slots below of the emulated EEPROM. An `INIT_FLAG` backup indicator
+ * allowed the firmware to determine if this backup had been performed at
+ * least once. These values are imported into the new settings at the first
+ * startup.
+ */
+
+constexpr uint8_t INIT_FLAG = 42; // 😉 "The Hitchhiker's Guide to the Galaxy" (Douglas Adams)
 
 constexpr uint8_t EEPROM_SIZE    = sizeof(uint8_t) + (2 * sizeof(float_t));
 constexpr uint8_t ADDR_INIT_FLAG = 0;
 constexpr uint8_t ADDR_MIN_TEMP  = sizeof(uint8_t);
 constexpr uint8_t ADDR_MAX_TEMP  = sizeof(uint8_t) + sizeof(float_t);
 
+// LED indicators
+// --------------
+
+/**
+ * The WiFi LED is driven by the LEDC channel below, with a resolution high
+ * enough to reach frequencies below 1 Hz. The sensor LED is lit for
+ * `TEMP_FLASH_DURATION` at each acquisition.
+ */
+
+constexpr uint8_t  BEACON_CHANNEL      = 0;
+constexpr uint8_t  BEACON_RESOLUTION   = 20; // in bits
+constexpr uint32_t TEMP_FLASH_DURATION = 50; // in milliseconds
+
+// Temperature sampling
+// --------------------
+
+/**
+ * The DHT11 cannot be read more than once per second, and a DS18B20 takes
+ * 750 ms to convert a temperature at full resolution, so the sampling period
+ * must never be shorter than that. A reading is considered stale when no
+ * successful sample has been taken for `SAMPLE_MAX_AGE` milliseconds.
+ */
+
+constexpr uint32_t    SAMPLING_PERIOD  = 2000; // in milliseconds
+constexpr uint32_t    SAMPLE_MAX_AGE   = 3 * SAMPLING_PERIOD;
+constexpr uint32_t    SAMPLER_STACK    = 4096; // in bytes
+constexpr UBaseType_t SAMPLER_PRIORITY = 5;
+
+// Autonomous control loop
+// -----------------------
+
+/**
+ * The thresholds are evaluated by the sampling task, once per sample.
+ *
+ * Once a limit has been crossed, the temperature has to come back inside the
+ * range by at least `HYSTERESIS` degrees before the excursion is considered
+ * over, so that a reading hovering around a limit does not make the relay
+ * chatter. In addition, the relay is never switched before it has spent a
+ * minimum time in its current state, which protects the compressor against
+ * short-cycling.
+ */
+
+constexpr float_t  HYSTERESIS         = 0.5;           // in °C
+constexpr uint32_t MIN_RELAY_ON_TIME  = 5 * 60 * 1000; // in milliseconds
+constexpr uint32_t MIN_RELAY_OFF_TIME = 3 * 60 * 1000; // in milliseconds
+
+// Control engine
+// --------------
+
+/**
+ * The relay is driven by the control engine (see `ControlEngine` in
+ * lib/thermostat), in `CONTROL_MODE` until another mode is chosen with
+ * `/config`. `bangbang` is the behaviour described above, `pid` regulates
+ * at the middle of the range with the `PID_*` gains (or the ones found by an
+ * `autotune`), and its output is applied by time-proportioning: the relay
+ * is energized for the first part of each `CONTROL_WINDOW`, in proportion
+ * to the output, without ever breaking the minimum on/off times.
+ */
+
+constexpr ControlMode CONTROL_MODE     = ControlMode::BangBang;
+constexpr float_t     PID_KP           = 400;                 // in ‰ of output per °C
+constexpr float_t     PID_TI           = 1800;                // in seconds
+constexpr float_t     PID_TD           = 60;                  // in seconds
+constexpr uint32_t    CONTROL_WINDOW   = 15 * 60 * 1000;      // in milliseconds
+constexpr float_t     AUTOTUNE_BAND    = 0.2;                 // in °C
+constexpr uint8_t     AUTOTUNE_CYCLES  = 3;                   // -> measured oscillations
+constexpr uint32_t    AUTOTUNE_TIMEOUT = 12 * 60 * 60 * 1000; // in milliseconds
+
+static_assert(CONTROL_WINDOW >= MIN_RELAY_ON_TIME + MIN_RELAY_OFF_TIME, "CONTROL_WINDOW must hold the minimum on and off times");
+
+// Clock and schedule
+// ------------------
+
+/**
+ * The clock is set by SNTP once the WiFi is connected, and the local time
+ * follows the POSIX `TIMEZONE` rule (central Europe here). The schedule
+ * (see `Schedule` in lib/thermostat) is only evaluated once the clock is
+ * set: until then, the stored temperature range applies.
+ */
+
+constexpr char   TIMEZONE[]        = "CET-1CEST,M3.5.0,M10.5.0/3";
+constexpr char   NTP_SERVER[]      = "pool.ntp.org";
+constexpr char   NTP_FALLBACK[]    = "time.google.com";
+constexpr time_t CLOCK_VALID_AFTER = 1577836800; // -> 2020-01-01, any earlier time means the clock is not set
+
+// Sensor driving the control loop
+// -------------------------------
+
+constexpr uint8_t CONTROL_SENSOR = 0; // -> index in the `sensors` table
+
+// Signal filtering
+// ----------------
+
+/**
+ * The readings of every sensor go through a filter before they reach the
+ * control loop and the web user interface:
+ *
+ * 1. a reading that strays from the filtered value by more than the
+ *    tolerance, plus the maximum rate of change times the time elapsed since
+ *    the last accepted reading, is rejected as an outlier, unless
+ *    `FILTER_MAX_REJECTS` readings in a row are, in which case the signal
+ *    has really moved and the filter starts over from the new level
+ * 2. the median of the last `FILTER_WINDOW` accepted readings removes the
+ *    remaining spikes
+ * 3. an exponential moving average of factor `FILTER_ALPHA` smooths out the
+ *    quantization noise (1 disables it)
+ *
+ * Failed and rejected readings leave the last good value in place, until it
+ * becomes stale (see `SAMPLE_MAX_AGE`).
+ */
+
+constexpr uint8_t FILTER_WINDOW      = 5; // in readings (at most `FILTER_MAX_WINDOW`)
+constexpr float_t FILTER_ALPHA       = 0.4;
+constexpr uint8_t FILTER_MAX_REJECTS = 3;
+
+constexpr float_t TEMP_TOLERANCE     = 1.5;  // in °C
+constexpr float_t TEMP_MAX_RATE      = 0.05; // in °C per second
+constexpr float_t HUMIDITY_TOLERANCE = 5;    // in %
+constexpr float_t HUMIDITY_MAX_RATE  = 0.5;  // in % per second
+
+static_assert(FILTER_WINDOW > 0 && FILTER_WINDOW <= FILTER_MAX_WINDOW, "FILTER_WINDOW must fit in the median window");
+
+// Duration of a single-shot SHT3x measurement (high repeatability)
+// ----------------------------------------------------------------
+
+constexpr uint32_t SHT3X_CONVERSION_TIME = 16; // in milliseconds
+
+// History of readings
+// -------------------
+
+/**
+ * One sample out of `HISTORY_PERIOD / SAMPLING_PERIOD` is kept in a ring
+ * buffer allocated once and for all, which covers the last 24 hours.
+ * Each sensor has its own buffer of `HISTORY_SIZE * 8` bytes, and so has the
+ * control loop: all of them are static, and must fit in `HISTORY_MEMORY`
+ * (a full day for up to 4 sensors). Beyond that, `HISTORY_SIZE` must be
+ * reduced.
+ */
+
+constexpr uint32_t HISTORY_PERIOD = 60 * 1000; // in milliseconds
+constexpr uint16_t HISTORY_SIZE   = 24 * 60;   // number of samples
+constexpr uint32_t HISTORY_MEMORY = 64 * 1024; // in bytes
+
 // WiFi credentials
 // ----------------
 
 constexpr char WIFI_SSID[] = "your WiFi SSID";
 constexpr char WIFI_PASS[] = "your WiFi password";
 
+// WiFi connection parameters
+// --------------------------
+
+/**
+ * A static IP address saves the DHCP exchange at each connection. The
+ * addresses to be used are defined below with the global variables.
+ *
+ * When the connection is lost (or cannot be established), a new attempt is
+ * made after a delay which doubles at each failure, up to a maximum value.
+ *
+ * Between two beacons of the access point, the modem sleeps: this divides
+ * its consumption by about 4, at the cost of a few tens of milliseconds of
+ * latency on the incoming requests (`WIFI_PS_NONE` keeps it awake).
+ */
+
+constexpr bool           WIFI_STATIC_IP       = false;
+constexpr uint32_t       WIFI_RETRY_MIN_DELAY = 500;   // in milliseconds
+constexpr uint32_t       WIFI_RETRY_MAX_DELAY = 30000; // in milliseconds
+constexpr uint32_t       WIFI_CACHE_MAGIC     = 0x57694669; // "WiFi"
+constexpr wifi_ps_type_t WIFI_POWER_SAVE      = WIFI_PS_MIN_MODEM;
+
 // Web server listening port
 // -------------------------
 
-constexpr uint16_t HTTP_PORT = 80;
+constexpr uint16_t HTTP_PORT = 80;
+
+// Admission control
+// -----------------
+
+/**
+ * The requests are divided into 3 classes, which are shed in turn as the
+ * load increases, with a fast `503 Service Unavailable`:
+ *
+ * - the bulky ones (static assets, history) first
+ * - then the readings (`/temp`, `/state`, `/metrics`)
+ * - the commands (`/savethresholds`, `/config`, `/reboot`...) last
+ *
+ * The caps apply to the requests whose connection is still open. Below
+ * `ADMISSION_MIN_HEAP`, only the commands are accepted.
+ *
+ * Moreover, each source address has a bucket of tokens, refilled at a
+ * steady rate: a request takes one token (a command takes more, since it
+ * writes the flash memory), and is refused with `429 Too Many Requests` when
+ * the bucket is empty. Only the most recent addresses are tracked.
+ *
+ * A request with a body (`/config`, `/update`) is admitted as soon as the
+ * body begins, before any of it is processed: a refused upload is never
+ * written into the flash memory.
+ */
+
+constexpr uint8_t  ADMISSION_MAX_BULK     = 4;  // concurrent requests
+constexpr uint8_t  ADMISSION_MAX_READINGS = 8;  // concurrent requests
+constexpr uint8_t  ADMISSION_MAX_COMMANDS = 10; // concurrent requests
+constexpr uint32_t ADMISSION_MIN_HEAP     = 24 * 1024; // in bytes
+constexpr uint8_t  ADMISSION_RETRY_AFTER  = 1;  // in seconds
+constexpr uint8_t  EVENTS_MAX_CLIENTS     = 8;  // -> subscribers of the `/events` stream
+constexpr uint8_t  RATE_LIMIT_CLIENTS     = 8;  // -> source addresses tracked at once
+constexpr uint8_t  RATE_LIMIT_BURST       = 20; // in tokens (a page load takes 7)
+constexpr uint8_t  RATE_LIMIT_RATE        = 4;  // in tokens per second
+constexpr uint8_t  RATE_LIMIT_COMMAND     = 5;  // in tokens
+constexpr uint8_t  ADMISSION_MAX_BODIES   = 16; // -> one per TCP connection of lwIP (`CONFIG_LWIP_MAX_ACTIVE_TCP`)
+
+// The `/events` stream is fed by a task of the network core (see `broadcastTemperatures()`):
+
+constexpr uint32_t    BROADCASTER_STACK    = 4096; // in bytes
+constexpr UBaseType_t BROADCASTER_PRIORITY = 4;    // -> above the AsyncTCP task (3)
+
+// Fleet discovery and telemetry
+// -----------------------------
+
+/**
+ * Each thermostat advertises itself over mDNS as `<prefix>-<xxxxxx>.local`
+ * (the last 3 bytes of its MAC address), with a `_thermostat._tcp` service
+ * pointing to its web server.
+ *
+ * In addition, each filtered sample can be pushed as a single UDP datagram
+ * to a collector (unicast or multicast, address defined with the global
+ * variables), so that a whole fleet can be ingested without any TCP
+ * connection.
+ */
+
+constexpr char     MDNS_HOSTNAME_PREFIX[] = "thermostat";
+constexpr bool     TELEMETRY_ENABLED      = false;
+constexpr uint16_t TELEMETRY_PORT         = 5005;
+constexpr uint32_t TELEMETRY_MAGIC        = 0x4D524854; // "THRM" (little-endian)
+constexpr uint8_t  TELEMETRY_VERSION      = 1;
+
+// MQTT publishing
+// ---------------
+
+/**
+ * The optional MQTT client uses the `<MQTT_TOPIC_PREFIX>/<device name>/`
+ * topics:
+ *
+ * - `state` (retained) the latest reading of the control sensor and the
+ *   state of the control loop, every `MQTT_STATE_PERIOD`
+ * - `events` (QoS 1) the threshold crossings
+ * - `status` (retained) `online`, or `offline` as last will
+ * - `config/set` (subscribed) a configuration document, with the same
+ *   syntax and effect as `POST /config`
+ *
+ * The sampler never waits for the broker: its messages are queued in a
+ * bounded outbox (the oldest ones are dropped when it is full), which a
+ * background task publishes in batches of `MQTT_BATCH` messages as soon as
+ * the broker is reachable. QoS 1 messages only leave the outbox once they
+ * have been acknowledged, and are published again after a reconnection.
+ *
+ * With `MQTT_SPOOL`, the outbox overflows into a SPIFFS file while the
+ * broker is unreachable, instead of dropping messages. The file is replayed
+ * first on reconnection.
+ */
+
+constexpr bool        MQTT_ENABLED        = false;
+constexpr char        MQTT_HOST[]         = "192.168.1.10";
+constexpr uint16_t    MQTT_PORT           = 1883;
+constexpr char        MQTT_USER[]         = ""; // -> no authentication if empty
+constexpr char        MQTT_PASS[]         = "";
+constexpr char        MQTT_TOPIC_PREFIX[] = "thermostat";
+constexpr uint32_t    MQTT_STATE_PERIOD   = 60000; // in milliseconds
+constexpr uint32_t    MQTT_RETRY_DELAY    = 5000;  // in milliseconds
+constexpr uint8_t     MQTT_OUTBOX_SIZE    = 32;    // in messages
+constexpr size_t      MQTT_PAYLOAD_SIZE   = 160;   // in bytes
+constexpr uint8_t     MQTT_BATCH          = 8;     // -> also bounds the unacknowledged messages
+constexpr uint32_t    MQTT_BATCH_PERIOD   = 100;   // in milliseconds
+constexpr bool        MQTT_SPOOL          = false;
+constexpr char        MQTT_SPOOL_FILE[]   = "/mqtt.spool";
+constexpr size_t      MQTT_SPOOL_MAX      = 64 * 1024; // in bytes
+constexpr uint32_t    MQTT_STACK          = 4096; // in bytes
+constexpr UBaseType_t MQTT_PRIORITY       = 1;
+
+// Low-power mode
+// --------------
+
+/**
+ * Built with `-D LOW_POWER` (the `lowpower` environment of platformio.ini),
+ * the device becomes a battery-powered probe: it spends most of its time in
+ * deep sleep, and wakes up every `LOW_POWER_PERIOD` to read its sensors. The
+ * samples are kept in RTC memory, and the WiFi is only brought up every
+ * `LOW_POWER_UPLOAD_WAKES` wakes, to push the batch as telemetry datagrams
+ * and/or MQTT messages (whichever are enabled). The relay, the web server
+ * and the history are not used.
+ *
+ * The batch holds the samples of 2 uploads, so that a missed upload does not
+ * lose anything. Beyond that, the oldest samples are dropped.
+ */
+
+constexpr uint32_t LOW_POWER_PERIOD         = 300;   // in seconds
+constexpr uint8_t  LOW_POWER_UPLOAD_WAKES   = 12;    // -> one upload per hour
+constexpr uint8_t  LOW_POWER_BATCH          = 2 * LOW_POWER_UPLOAD_WAKES; // in samples
+constexpr uint32_t LOW_POWER_WIFI_TIMEOUT   = 10000; // in milliseconds
+constexpr uint32_t LOW_POWER_UPLOAD_TIMEOUT = 5000;  // in milliseconds
+constexpr uint32_t LOW_POWER_FLUSH_DELAY    = 100;   // in milliseconds, for the last frames to leave
+constexpr uint32_t LOW_POWER_CPU_FREQUENCY  = 80;    // in MHz (the lowest one at which the WiFi works)
+
+static_assert(LOW_POWER_BATCH < MQTT_OUTBOX_SIZE, "The whole batch must fit in the MQTT outbox");
+
+// Browser cache lifetime of the static assets
+// -------------------------------------------
+
+/**
+ * Once this delay has expired, the browser revalidates its copy with the
+ * ETag of the file, which only costs a `304 Not Modified` response as long
+ * as the file has not been updated on SPIFFS (or the firmware, when the
+ * assets are embedded in it).
+ */
+
+constexpr char ASSET_CACHE_CONTROL[] = "public, max-age=86400"; // 24 hours
+
+// Over-the-air updates
+// --------------------
+
+/**
+ * `POST /update` writes a new firmware (or SPIFFS image) into the flash
+ * memory as it is uploaded. The credentials must be changed before the
+ * devices are deployed.
+ *
+ * A new firmware is on probation until it has been running for
+ * `OTA_HEALTH_DELAY`: if it restarts more than `OTA_MAX_BOOTS` times before
+ * that (crash, watchdog...), the previous one is booted again.
+ */
+
+constexpr char     OTA_USER[]       = "admin";
+constexpr char     OTA_PASS[]       = "thermostat";
+constexpr char     OTA_BOOTS_KEY[]  = "otaBoots"; // -> boots of the firmware on probation (settings namespace)
+constexpr uint8_t  OTA_MAX_BOOTS    = 3;
+constexpr uint32_t OTA_HEALTH_DELAY = 120000; // in milliseconds
+
+// Batch configuration
+// -------------------
+
+/**
+ * The `/config` documents are parsed on the fly, as the body is received
+ * (see `ConfigParser`): only the value being read has to be buffered.
+ * Larger documents are rejected anyway.
+ */
+
+constexpr size_t CONFIG_MAX_BODY = 1024; // in bytes
+
+// Metrics
+// -------
+
+/**
+ * Upper bounds (in microseconds) of the buckets of the latency histograms
+ * exposed on the `/metrics` route (the last bucket, `+Inf`, is implicit).
+ */
+
+constexpr uint8_t  LATENCY_BUCKETS = 8;
+constexpr uint32_t LATENCY_BOUNDS[LATENCY_BUCKETS] = { 100, 250, 500, 1000, 5000, 10000, 50000, 100000 };
+
+/**
+ * The histograms are too coarse to compare two versions of the firmware. When
+ * built with `-D PROFILING` (the `profiling` environment of platformio.ini),
+ * the firmware also keeps the latest durations of each probe, whose
+ * percentiles are served on the `/profile` route (see tools/loadtest.py).
+ */
+
+constexpr uint16_t PROFILE_SAMPLES = 256; // per probe
+
+// Logging
+// -------
+
+/**
+ * When the ring buffer is full, new messages are dropped (and counted)
+ * rather than making the caller wait.
+ */
+
+constexpr size_t      LOG_BUFFER_SIZE = 4096; // in bytes
+constexpr size_t      LOG_LINE_SIZE   = 160;  // in bytes
+constexpr uint32_t    LOGGER_STACK    = 2048; // in bytes
+constexpr UBaseType_t LOGGER_PRIORITY = 1;
+
+// Startup
+// -------
+
+/**
+ * Apart from the serial monitor and the outputs, the initialization stages
+ * are run by short-lived tasks, each one as soon as the stages it depends on
+ * are complete (see `setup()`). Their stack is the one of the Arduino loop
+ * task, which used to run them all.
+ */
+
+constexpr uint32_t    BOOT_STACK    = 8192; // in bytes
+constexpr UBaseType_t BOOT_PRIORITY = 2;
+
+// Serial monitor
+// --------------
+
+constexpr char PREAMBLE[] = R"PREAMBLE(
+
+-------------------------------
+ESP32 Web Controlled Thermostat
+-------------------------------
+   © 2020 Stéphane Calderoni
+-------------------------------
+
+-------------------------------
+     Initialization process
+-------------------------------
+)PREAMBLE";
+
+constexpr char CLOSING[] = "\n-------------------------------\n";
+
+// ----------------------------------------------------------------------------
+// Sensor drivers
+// ----------------------------------------------------------------------------
+
+/**
+ * The drivers of the supported probes, which implement the `Sensor`
+ * interface (lib/thermostat).
+ */
+
+// DHT11 / DHT22
+// -------------
+
+/**
+ * The DHT protocol is bit-banged with interrupts disabled, the reading is
+ * therefore synchronous (a few milliseconds). The humidity comes from the
+ * same data frame as the temperature, which the library keeps for 2 seconds.
+ */
+
+class DHTSensor : public Sensor {
+public:
+    DHTSensor(const char *name, uint8_t pin, uint8_t type) : Sensor(name), dht(pin, type) {}
+
+    void begin() override {
+        dht.begin();
+    }
+
+    uint32_t startConversion() override {
+        return 0;
+    }
+
+    bool collect(Reading &reading) override {
+        reading.temperature = dht.readTemperature();
+        reading.humidity    = isnan(reading.temperature) ? NAN : dht.readHumidity();
+        return !isnan(reading.temperature);
+    }
+
+private:
+    DHT dht;
+};
+
+// DS18B20 (OneWire)
+// -----------------
+
+/**
+ * The sensor is designated by its index on the bus, and its address is
+ * looked up again as long as it has not been found (the probe may be
+ * plugged after startup).
+ */
+
+class DS18B20Sensor : public Sensor {
+public:
+    DS18B20Sensor(const char *name, DallasTemperature &bus, uint8_t index) : Sensor(name), bus(bus), index(index), found(false) {}
+
+    void begin() override {
+        bus.begin();
+        bus.setWaitForConversion(false);
+        lookup();
+    }
+
+    uint32_t startConversion() override {
+        if (!found && !lookup()) return 0;
+        bus.requestTemperaturesByAddress(address);
+        return bus.millisToWaitForConversion(bus.getResolution(address));
+    }
+
+    bool collect(Reading &reading) override {
+        float_t temp = found ? bus.getTempC(address) : DEVICE_DISCONNECTED_C;
+        reading.temperature = temp == DEVICE_DISCONNECTED_C ? NAN : temp;
+        reading.humidity    = NAN;
+        if (isnan(reading.temperature)) found = false;
+        return !isnan(reading.temperature);
+    }
+
+private:
+    bool lookup() {
+        found = bus.getAddress(address, index);
+        return found;
+    }
+
+    DallasTemperature &bus;
+    uint8_t           index;
+    DeviceAddress     address;
+    bool              found;
+};
+
+// SHT3x (I2C)
+// -----------
+
+/**
+ * Single-shot measurements, without clock stretching, so that the I2C bus
+ * is released during the conversion. Each measured value is followed by a
+ * CRC-8 (polynomial 0x31, initialization 0xff).
+ */
+
+class SHT3xSensor : public Sensor {
+public:
+    SHT3xSensor(const char *name, TwoWire &wire, uint8_t address) : Sensor(name), wire(wire), address(address), started(false) {}
+
+    void begin() override {}
+
+    uint32_t startConversion() override {
+        wire.beginTransmission(address);
+        wire.write(0x24); // -> single shot, high repeatability,
+        wire.write(0x00); //    clock stretching disabled
+        started = wire.endTransmission() == 0;
+        return SHT3X_CONVERSION_TIME;
+    }
+
+    bool collect(Reading &reading) override {
+        uint8_t data[6];
+        reading.temperature = NAN;
+        reading.humidity    = NAN;
+
+        if (!started || wire.requestFrom(address, (uint8_t) sizeof(data)) != sizeof(data)) return false;
+        for (uint8_t i = 0; i < sizeof(data); i++) data[i] = wire.read();
+        if (crc8(data) != data[2] || crc8(data + 3) != data[5]) return false;
+
+        reading.temperature = -45 + 175 * ((data[0] << 8) | data[1]) / 65535.0f;
+        reading.humidity    =       100 * ((data[3] << 8) | data[4]) / 65535.0f;
+        return true;
+    }
+
+private:
+    static uint8_t crc8(const uint8_t *data) {
+        uint8_t crc = 0xff;
+        for (uint8_t i = 0; i < 2; i++) {
+            crc ^= data[i];
+            for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+        return crc;
+    }
+
+    TwoWire &wire;
+    uint8_t  address;
+    bool     started;
+};
+
+// BME280 (I2C)
+// ------------
+
+/**
+ * The sensor runs in normal mode: it measures continuously on its own, once
+ * per second, and collecting a reading just consists in fetching its
+ * registers.
+ */
+
+class BME280Sensor : public Sensor {
+public:
+    BME280Sensor(const char *name, TwoWire &wire, uint8_t address) : Sensor(name), wire(wire), address(address), found(false) {}
+
+    void begin() override {
+        found = bme.begin(address, &wire);
+        if (found) {
+            bme.setSampling(
+                Adafruit_BME280::MODE_NORMAL,
+                Adafruit_BME280::SAMPLING_X1, // -> temperature
+                Adafruit_BME280::SAMPLING_X1, // -> pressure
+                Adafruit_BME280::SAMPLING_X1, // -> humidity
+                Adafruit_BME280::FILTER_OFF,
+                Adafruit_BME280::STANDBY_MS_1000
+            );
+        }
+    }
+
+    uint32_t startConversion() override {
+        return 0;
+    }
+
+    bool collect(Reading &reading) override {
+        reading.temperature = found ? bme.readTemperature() : NAN;
+        reading.humidity    = found ? bme.readHumidity()    : NAN;
+        return !isnan(reading.temperature);
+    }
+
+private:
+    Adafruit_BME280 bme;
+    TwoWire        &wire;
+    uint8_t         address;
+    bool            found;
+};
+
+// ----------------------------------------------------------------------------
+// Signal filtering
+// ----------------------------------------------------------------------------
+
+/**
+ * Each sensor has a filter for each of the quantities it measures (see
+ * `SignalFilter` in lib/thermostat).
+ */
+
+constexpr FilterConfig TEMP_FILTER     = { FILTER_WINDOW, FILTER_ALPHA, TEMP_TOLERANCE,     TEMP_MAX_RATE,     FILTER_MAX_REJECTS };
+constexpr FilterConfig HUMIDITY_FILTER = { FILTER_WINDOW, FILTER_ALPHA, HUMIDITY_TOLERANCE, HUMIDITY_MAX_RATE, FILTER_MAX_REJECTS };
+
+struct SensorFilter {
+    SignalFilter temperature{TEMP_FILTER};
+    SignalFilter humidity{HUMIDITY_FILTER};
+};
+
+// ----------------------------------------------------------------------------
+// Global variables
+// ----------------------------------------------------------------------------
+
+// Temperature sensors
+// -------------------
+
+/**
+ * Declare here the probes that are actually connected. The first one of the
+ * table (or more precisely the one of index `CONTROL_SENSOR`) is the one that
+ * drives the control loop and that is displayed by the web user interface.
+ * For example:
+ *
+ *     DS18B20Sensor rackSensor("rack", oneWireBus, 0);
+ *     SHT3xSensor   doorSensor("door", Wire, 0x44);
+ *     BME280Sensor  roomSensor("room", Wire, 0x76);
+ */
+
+OneWire           oneWire(ONE_WIRE_PIN);
+DallasTemperature oneWireBus(&oneWire);
+
+DHTSensor cellarSensor("cellar", DHT_PIN, DHT_TYPE);
+
+Sensor *sensors[] = {
+    &cellarSensor
+};
+
+constexpr uint8_t SENSOR_COUNT = sizeof(sensors) / sizeof(sensors[0]);
+
+static_assert(CONTROL_SENSOR < SENSOR_COUNT, "CONTROL_SENSOR must designate one of the sensors");
+
+// Temperature range supported by the thermostat
+// ---------------------------------------------
+
+struct TempRange {
+    bool    initialized;
+    float_t lower;
+    float_t upper;
+};
+
+TempRange    tempRange;
+TempRange    savedRange; // -> what is currently stored in the flash memory
+portMUX_TYPE rangeMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Persistent settings record
+// --------------------------
+
+/**
+ * The layout of the record is defined by `SettingsRecord` (lib/thermostat).
+ */
+
+Preferences       preferences;
+SemaphoreHandle_t settingsLock; // -> serializes the writes in the flash memory
+TaskHandle_t      persister;    // -> background task that writes the settings
+
+// Event journal
+// -------------
+
+/**
+ * The events are queued by any task, under `journalMux`, and then written
+ * by the sampling task, under `journalLock`, which also protects the reads
+ * of the web server. A pending event keeps its place (its sequence) in the
+ * journal: it is already served by `/events/log`.
+ */
+
+class PartitionFlash : public JournalFlash {
+public:
+    const esp_partition_t *partition = NULL;
+
+    bool read(uint32_t offset, void *data, size_t size) override {
+        return esp_partition_read(partition, offset, data, size) == ESP_OK;
+    }
+
+    bool write(uint32_t offset, const void *data, size_t size) override {
+        return esp_partition_write(partition, offset, data, size) == ESP_OK;
+    }
+
+    bool erase(uint32_t offset, size_t size) override {
+        return esp_partition_erase_range(partition, offset, size) == ESP_OK;
+    }
+};
+
+struct JournalQueue {
+    JournalRecord records[JOURNAL_QUEUE_SIZE];
+    uint32_t      head;    // -> sequence of the oldest pending event
+    uint32_t      tail;    // -> sequence of the next event
+    uint32_t      since;   // -> `millis()` of the oldest pending event
+    uint32_t      dropped; // -> events lost because the queue was full
+};
+
+PartitionFlash    journalFlash;
+Journal           journal;
+JournalQueue      journalQueue;
+SemaphoreHandle_t journalLock;
+portMUX_TYPE      journalMux = portMUX_INITIALIZER_UNLOCKED;
+
+const char *JOURNAL_EVENT_NAMES[JOURNAL_EVENT_COUNT] = {
+    "boot", "reboot", "reset", "excursion", "sensor_failure", "sensor_recovery", "range", "control", "schedule"
+};
+
+// -> `esp_reset_reason_t`
+const char *RESET_REASON_NAMES[] = {
+    "unknown", "power_on", "external", "software", "panic", "interrupt_watchdog",
+    "task_watchdog", "watchdog", "deep_sleep", "brownout", "sdio"
+};
+
+// State of the control loop
+// -------------------------
+
+struct ControlState {
+    TempZone zone;        // -> position of the temperature relative to the range
+    bool     relayOn;     // -> whether the cooling unit is currently energized
+    uint32_t lastSwitch;  // -> `millis()` of the last relay switching
+    uint32_t windowStart; // -> `millis()` of the start of the time-proportioning window
+};
+
+ControlState control = { TempZone::Normal, false, 0, 0 };
+
+const char *ZONE_NAMES[] = { "low", "normal", "high" };
+
+// Control engine
+// --------------
+
+/**
+ * The engine is updated by the sampling task, and its mode and gains may be
+ * changed at any time by the web server, hence the lock. Its settings are
+ * stored in their own record (`ControlRecord`, see lib/thermostat).
+ */
+
+ControlEngine engine(
+    { (int32_t) lroundf(HYSTERESIS * 100), (int32_t) lroundf(AUTOTUNE_BAND * 100), AUTOTUNE_CYCLES, AUTOTUNE_TIMEOUT },
+    { PID_KP, PID_TI, PID_TD });
+
+ControlRecord savedControl; // -> what is currently stored in the flash memory
+portMUX_TYPE  controlMux = portMUX_INITIALIZER_UNLOCKED;
+
+const char *CONTROL_MODE_NAMES[] = { "bangbang", "pid", "autotune" };
+const char *CONTROL_TERM_NAMES[] = { "proportional", "integral", "derivative" };
+
+// Schedule of the temperature range
+// ---------------------------------
+
+/**
+ * The table is edited by the web server and evaluated by the sampling task,
+ * hence the lock. Each transition sets the temperature range as the
+ * operator would, which may still change it until the next transition.
+ */
+
+ScheduleTable     schedule;
+ScheduleTable     savedSchedule; // -> what is currently stored in the flash memory
+ScheduleEvaluator scheduler;
+portMUX_TYPE      scheduleMux  = portMUX_INITIALIZER_UNLOCKED;
+bool              clockStarted = false;
+
+// Latest temperature readings
+// ---------------------------
+
+/**
+ * Each sensor has its own snapshot, written by the sampling task and read by
+ * the HTTP handlers (which run in the AsyncTCP task). It is small enough to
+ * be copied as a whole inside a critical section, so that readers never see
+ * a torn value.
+ */
+
+struct TempSnapshot {
+    float_t  temperature; // -> filtered temperature (NAN if none yet)
+    float_t  humidity;    // -> filtered relative humidity (NAN if stale)
+    uint32_t timestamp;   // -> `millis()` of the last accepted reading
+    uint32_t sequence;    // -> incremented at each sampling attempt
+    bool     error;       // -> the last reading has failed or was rejected
+};
+
+TempSnapshot snapshots[SENSOR_COUNT];
+TempSnapshot broadcastSnapshots[SENSOR_COUNT]; // -> latest readings handed over to the broadcaster
+portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t broadcaster = NULL;
+
+/**
+ * The `/temp` response of each sensor is rendered once per sample by the
+ * sampling task, instead of once per request: all the dashboards that ask
+ * for it during the same sampling period share it. Its ETag identifies the
+ * sample (the boot identifier makes it unique across restarts), and it may
+ * be cached until the next one is due.
+ */
+
+struct TempResponse {
+    char     body[8];  // -> as formatted by `formatTemperature()`
+    char     etag[24];
+    uint32_t expires;  // -> `millis()` at which the next sample is due
+    bool     valid;
+};
+
+TempResponse tempResponses[SENSOR_COUNT];
+uint32_t     bootId; // -> random, drawn at startup
+portMUX_TYPE responseMux = portMUX_INITIALIZER_UNLOCKED;
+
+// History of readings
+// -------------------
+
+/**
+ * Each sample is quantized to fit in 8 bytes:
+ * - the uptime in seconds at which it was taken
+ * - the temperature in tenths of a degree (`HISTORY_NO_TEMP` if unavailable)
+ * - the relative humidity in tenths of a percent (`HISTORY_NO_HUMIDITY` if unavailable)
+ *
+ * All the sensors are recorded at the same time, in their own ring buffer.
+ * `historyTotal` counts all the samples ever recorded, which allows a reader
+ * to designate a sample by its absolute rank, and to know whether it has
+ * been overwritten in the meantime.
+ */
+
+struct HistorySample {
+    uint32_t uptime;
+    int16_t  temperature;
+    uint16_t humidity;
+};
+
+static_assert(sizeof(HistorySample) == 8, "HistorySample must remain packed in 8 bytes");
+
+constexpr int16_t  HISTORY_NO_TEMP     = INT16_MIN;
+constexpr uint16_t HISTORY_NO_HUMIDITY = UINT16_MAX;
+
+/**
+ * The state of the control loop is recorded at the same time, in a ring
+ * buffer of its own, with samples of the same size:
+ * - the uptime in seconds at which it was taken
+ * - the output of the control engine, in per mille
+ * - the control mode (see `ControlMode`, `HISTORY_NO_MODE` if unavailable)
+ * - 1 if the cooling unit was powered
+ */
+
+struct ControlSample {
+    uint32_t uptime;
+    uint16_t output;
+    uint8_t  mode;
+    uint8_t  relay;
+};
+
+static_assert(sizeof(ControlSample) == sizeof(HistorySample), "ControlSample must have the size of a HistorySample");
+
+constexpr uint8_t HISTORY_NO_MODE = UINT8_MAX;
+
+HistorySample history[SENSOR_COUNT][HISTORY_SIZE];
+ControlSample controlHistory[HISTORY_SIZE];
+uint32_t      historyTotal = 0;
+portMUX_TYPE  historyMux   = portMUX_INITIALIZER_UNLOCKED;
+
+static_assert(sizeof(history) + sizeof(controlHistory) <= HISTORY_MEMORY, "The history does not fit in HISTORY_MEMORY: reduce HISTORY_SIZE");
+
+// Sensor reading LED indicator
+// ----------------------------
+
+esp_timer_handle_t tempBeaconTimer; // -> turns the LED off after a flash
+
+// Static assets of the web user interface
+// ---------------------------------------
+
+/**
+ * The files are looked up on SPIFFS once and for all at startup: the gzipped
+ * variant produced by `tools/compress_assets.py` is preferred if it exists,
+ * and its ETag is derived from its CRC32 and its size.
+ *
+ * When built with `-D EMBEDDED_ASSETS` (the `embedded` environment of
+ * platformio.ini), the same files are generated as constant arrays, which
+ * are served straight from the memory-mapped flash: no file system lookup,
+ * no file handle, and a single image to flash (or to update over the air).
+ */
+
+struct StaticAsset {
+    const char    *url;
+    const char    *file;
+    const char    *mime;
+    char           path[32]; // -> file actually served
+    bool           gzipped;
+    char           etag[20];
+    const uint8_t *data;     // -> embedded content (`EMBEDDED_ASSETS` only)
+    size_t         size;
+};
+
+StaticAsset assets[] = {
+    { "/",            "/index.html",  "text/html"              },
+    { "/index.js",    "/index.js",    "application/javascript" },
+    { "/index.css",   "/index.css",   "text/css"               },
+    { "/D7MR.woff2",  "/D7MR.woff2",  "font/woff2"             },
+    { "/favicon.ico", "/favicon.ico", "image/x-icon"           }
+};
+
+// Over-the-air updates
+// --------------------
+
+struct OtaUpload {
+    AsyncWebServerRequest *request; // -> upload in progress, NULL if none
+    int                    command; // -> `U_FLASH` or `U_SPIFFS`
+    size_t                 written; // in bytes
+    uint32_t               start;   // -> `millis()` at the beginning of the upload
+    const char            *error;   // -> first error met, NULL if none
+};
+
+OtaUpload          otaUpload;
+esp_timer_handle_t otaHealthTimer; // -> validates the firmware on probation
+
+// WiFi connection
+// ---------------
+
+/**
+ * Static addresses (only used if `WIFI_STATIC_IP` is set).
+ */
+
+const IPAddress WIFI_LOCAL_IP(192, 168, 1, 200);
+const IPAddress WIFI_GATEWAY(192, 168, 1, 1);
+const IPAddress WIFI_SUBNET(255, 255, 255, 0);
+const IPAddress WIFI_DNS(192, 168, 1, 1);
+
+/**
+ * The BSSID and channel of the access point are kept in the part of the RTC
+ * memory that is not initialized at startup, so that they survive a software
+ * restart, a brownout (and a deep sleep). A reconnection can then skip the
+ * scanning of all the channels, which is the longest step. After a power-on,
+ * the cache holds garbage, which the magic number rules out.
+ */
+
+struct WiFiCache {
+    uint32_t magic;    // -> `WIFI_CACHE_MAGIC` when the cache is valid
+    uint8_t  bssid[6];
+    uint8_t  channel;
+};
+
+RTC_NOINIT_ATTR WiFiCache wifiCache;
+
+volatile bool wifiConnected  = false;
+uint32_t      wifiRetryDelay = WIFI_RETRY_MIN_DELAY;
+uint32_t      wifiStartTime;  // -> `millis()` at the beginning of the connection attempt
+TimerHandle_t wifiRetryTimer; // -> triggers the next connection attempt
+
+// Fleet discovery and telemetry
+// -----------------------------
+
+/**
+ * The telemetry datagram has a fixed layout (little-endian, no padding):
+ *
+ * - a header identifying the device and the sample, with the state of the
+ *   control loop
+ * - one record per sensor, in the order of the `sensors` table, with the
+ *   same encoding as the history samples
+ */
+
+const IPAddress TELEMETRY_COLLECTOR(239, 255, 42, 42); // -> multicast group or unicast address
+
+struct __attribute__((packed)) TelemetryHeader {
+    uint32_t magic;    // -> `TELEMETRY_MAGIC`
+    uint8_t  version;  // -> `TELEMETRY_VERSION`
+    uint8_t  sensors;  // -> number of records that follow
+    uint8_t  mac[6];   // -> identifies the device
+    uint32_t uptime;   // in seconds
+    uint32_t sequence; // -> sample number, which reveals the lost datagrams
+    int16_t  lower;    // -> temperature range, in tenths of a degree
+    int16_t  upper;
+    uint8_t  zone;     // -> 0: low, 1: normal, 2: high
+    uint8_t  relay;    // -> 1 if the cooling unit is powered
+};
+
+struct __attribute__((packed)) TelemetryRecord {
+    int16_t  temperature; // in tenths of a degree (`HISTORY_NO_TEMP` if unavailable)
+    uint16_t humidity;    // in tenths of a percent (`HISTORY_NO_HUMIDITY` if unavailable)
+};
+
+struct __attribute__((packed)) TelemetryDatagram {
+    TelemetryHeader header;
+    TelemetryRecord records[SENSOR_COUNT];
+};
+
+// Low-power mode
+// --------------
+
+/**
+ * The batch survives the deep sleep in RTC memory, whereas the rest of the
+ * RAM is lost: the firmware restarts from `setup()` at each wake.
+ */
+
+struct LowPowerSample {
+    uint32_t        time; // in seconds since power-on (the RTC keeps counting in deep sleep)
+    TelemetryRecord records[SENSOR_COUNT];
+};
+
+struct LowPowerBatch {
+    uint32_t       wakes;    // -> since power-on
+    uint32_t       sequence; // -> number of samples taken since power-on
+    uint8_t        count;    // -> samples waiting to be pushed (the latest ones)
+    LowPowerSample samples[LOW_POWER_BATCH];
+};
+
+RTC_DATA_ATTR LowPowerBatch lowPowerBatch;
+
+char     deviceName[24]; // -> `<MDNS_HOSTNAME_PREFIX>-<xxxxxx>`
+bool     mdnsStarted = false;
+AsyncUDP telemetry;
+
+// MQTT publishing
+// ---------------
+
+/**
+ * The outbox is a ring of fixed-size messages, indexed by free-running
+ * counters: the messages in [ head , sent ) have been published and wait
+ * for their acknowledgement (or for the older ones to be acknowledged),
+ * those in [ sent , tail ) have not been published yet. It is shared by the
+ * sampler, the publishing task and the MQTT client callbacks.
+ */
+
+enum MqttTopic : uint8_t { MQTT_STATE, MQTT_EVENTS, MQTT_TOPIC_COUNT };
+
+const char *MQTT_TOPIC_NAMES[MQTT_TOPIC_COUNT] = { "state", "events" };
+
+struct MqttMessage {
+    uint8_t  topic;    // -> `MqttTopic`
+    uint8_t  qos;
+    bool     retain;
+    bool     done;     // -> can leave the outbox
+    uint16_t packetId; // -> to match the acknowledgement
+    uint16_t length;
+    char     payload[MQTT_PAYLOAD_SIZE];
+};
+
+struct MqttOutbox {
+    MqttMessage messages[MQTT_OUTBOX_SIZE];
+    uint32_t    head;
+    uint32_t    sent;
+    uint32_t    tail;
+    uint32_t    published;
+    uint32_t    dropped;
+};
+
+MqttOutbox   mqttOutbox;
+portMUX_TYPE outboxMux = portMUX_INITIALIZER_UNLOCKED;
+
+AsyncMqttClient mqtt;
+TaskHandle_t    mqttPublisher = NULL;
+char            mqttTopics[MQTT_TOPIC_COUNT][48];
+char            mqttStatusTopic[48];
+char            mqttConfigTopic[48];
+uint32_t        mqttSpoolOffset  = 0;     // -> next record of the spool file to replay
+bool            mqttSpoolPending = false; // -> the spool file is not empty
+
+// Metrics
+// -------
+
+/**
+ * Each monitored operation has its own latency histogram (the buckets are
+ * not cumulative here, they are accumulated when the metrics are exported).
+ *
+ * The HTTP routes are only ever handled by the AsyncTCP task, so their
+ * histograms do not need to be protected. The ones of the sensor and of the
+ * settings are updated by other tasks, hence the `metricsMux`.
+ */
+
+struct LatencyHistogram {
+    uint32_t buckets[LATENCY_BUCKETS + 1];
+    uint32_t count;
+    uint64_t sum; // -> in microseconds
+};
+
+enum Route : uint8_t {
+    ROUTE_ROOT,
+    ROUTE_STATIC,
+    ROUTE_STATE,
+    ROUTE_TEMP,
+    ROUTE_HISTORY,
+    ROUTE_SAVE_THRESHOLDS,
+    ROUTE_RESET,
+    ROUTE_REBOOT,
+    ROUTE_METRICS,
+    ROUTE_CONFIG,
+    ROUTE_UPDATE,
+    ROUTE_SCHEDULE,
+    ROUTE_EVENTS_LOG,
+    ROUTE_COUNT
+};
+
+const char *ROUTE_NAMES[ROUTE_COUNT] = {
+    "/",
+    "static",
+    "/state",
+    "/temp",
+    "/history",
+    "/savethresholds",
+    "/reset",
+    "/reboot",
+    "/metrics",
+    "/config",
+    "/update",
+    "/schedule",
+    "/events/log"
+};
+
+enum RouteClass : uint8_t { ROUTE_BULK, ROUTE_READING, ROUTE_COMMAND };
+
+const RouteClass ROUTE_CLASSES[ROUTE_COUNT] = {
+    ROUTE_BULK,    // -> /
+    ROUTE_BULK,    // -> static
+    ROUTE_READING, // -> /state
+    ROUTE_READING, // -> /temp
+    ROUTE_BULK,    // -> /history
+    ROUTE_COMMAND, // -> /savethresholds
+    ROUTE_COMMAND, // -> /reset
+    ROUTE_COMMAND, // -> /reboot
+    ROUTE_READING, // -> /metrics
+    ROUTE_COMMAND, // -> /config
+    ROUTE_COMMAND, // -> /update
+    ROUTE_READING, // -> /schedule
+    ROUTE_BULK     // -> /events/log
+};
+
+struct Metrics {
+    LatencyHistogram routes[ROUTE_COUNT];
+    LatencyHistogram sensorReads[SENSOR_COUNT];
+    uint32_t         sensorFailures[SENSOR_COUNT];
+    uint32_t         sensorOutliers[SENSOR_COUNT];
+    LatencyHistogram settingsCommits;
+    uint32_t         activeRequests;
+    uint32_t         shedRequests;      // -> refused because of the load (503)
+    uint32_t         throttledRequests; // -> refused by the rate limiter (429)
+    uint32_t         refusedSubscribers;
+};
+
+Metrics      metrics;
+portMUX_TYPE metricsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Admission control
+// -----------------
+
+/**
+ * Only used by the AsyncTCP task, like `metrics.activeRequests`.
+ */
+
+struct TokenBucket {
+    uint32_t address;
+    uint32_t tokens;  // in thousandths of a token
+    uint32_t updated; // -> `millis()` of the last refill
+};
+
+TokenBucket tokenBuckets[RATE_LIMIT_CLIENTS];
+
+// Verdict given to a request when its body begins, until its request handler
+// is called (or the client is disconnected):
+
+struct BodyAdmission {
+    AsyncWebServerRequest *request;
+    bool                   admitted;
+};
+
+BodyAdmission bodyAdmissions[ADMISSION_MAX_BODIES];
+char          bodyRefused; // -> `_tempObject` of a request refused for want of a free slot
+
+/**
+ * Profiling probes: the time spent in each handler (entry to exit), the
+ * lifetime of each connection (handler entry to disconnection, which covers
+ * the sending of the response) and each sensor reading.
+ */
+
+constexpr uint16_t PROFILE_HANDLERS    = 0;
+constexpr uint16_t PROFILE_CONNECTIONS = PROFILE_HANDLERS + ROUTE_COUNT;
+constexpr uint16_t PROFILE_SENSORS     = PROFILE_CONNECTIONS + ROUTE_COUNT;
+constexpr uint16_t PROFILE_PROBES      = PROFILE_SENSORS + SENSOR_COUNT;
+
+#ifdef PROFILING
+struct ProfileProbe {
+    uint32_t samples[PROFILE_SAMPLES]; // -> circular buffer, in microseconds
+    uint32_t count;                    // -> number of samples since the last reset
+};
+
+ProfileProbe profile[PROFILE_PROBES];
+portMUX_TYPE profileMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+// Logging
+// -------
+
+RingbufHandle_t logBuffer  = NULL;
+uint32_t        logDropped = 0; // -> number of messages dropped, under `metricsMux`
+
+// Startup
+// -------
+
+enum BootStage : uint8_t {
+    BOOT_SERIAL,
+    BOOT_OUTPUTS,    // -> LEDs and relay
+    BOOT_SETTINGS,   // -> settings, event journal and validation of the firmware
+    BOOT_SENSORS,
+    BOOT_SPIFFS,
+    BOOT_WIFI,       // -> interface started, the association goes on in the background
+    BOOT_SAMPLER,    // -> sampling and persistence tasks
+    BOOT_WEB_SERVER,
+    BOOT_MQTT,
+    BOOT_STAGE_COUNT
+};
+
+const char *BOOT_STAGE_NAMES[BOOT_STAGE_COUNT] = {
+    "serial",
+    "outputs",
+    "settings",
+    "sensors",
+    "spiffs",
+    "wifi",
+    "sampler",
+    "web_server",
+    "mqtt"
+};
+
+// Times in microseconds since the startup, 0 until they are reached:
+
+struct BootTiming {
+    uint32_t start;
+    uint32_t end;
+};
+
+EventGroupHandle_t bootEvents;                    // -> one bit per stage, set once it is complete
+BootTiming         bootTimings[BOOT_STAGE_COUNT];
+uint32_t           bootReady;                     // -> end of the last stage
+uint32_t           bootConnected;                 // -> first WiFi connection
+
+// Firmware operating modules
+// --------------------------
+
+AsyncWebServer server(HTTP_PORT);   // -> Web server
+AsyncEventSource events("/events"); // -> Server-Sent Events stream
+
+// ----------------------------------------------------------------------------
+// Logging
+// ----------------------------------------------------------------------------
+
+/**
+ * The message is formatted in the stack of the caller, and then copied as a
+ * single item in the ring buffer, without ever waiting: the FreeRTOS ring
+ * buffer only holds its spinlock for the duration of the copy.
+ */
+
+void logPrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+void logPrintf(const char *format, ...) {
+    char    line[LOG_LINE_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+
+    if (length < 0) return;
+    if (length > (int) sizeof(line) - 2) length = sizeof(line) - 2;
+    line[length++] = '\n';
+
+    if (logBuffer == NULL || xRingbufferSend(logBuffer, line, length, 0) != pdTRUE) {
+        // any task, on either core, may be logging
+        portENTER_CRITICAL(&metricsMux);
+        logDropped++;
+        portEXIT_CRITICAL(&metricsMux);
+    }
+}
+
+// Background writing of the messages on the serial port
+
+void drainLog(void *parameter) {
+    for (;;) {
+        size_t size;
+        void  *item = xRingbufferReceive(logBuffer, &size, portMAX_DELAY);
+        if (item != NULL) {
+            Serial.write((const uint8_t*) item, size);
+            vRingbufferReturnItem(logBuffer, item);
+        }
+    }
+}
+
+/**
+ * Writes synchronously all the pending messages,
+ * which must not be lost when the ESP32 is about to restart.
+ */
+
+void flushLog() {
+    size_t size;
+    void  *item;
+    while ((item = xRingbufferReceive(logBuffer, &size, 0)) != NULL) {
+        Serial.write((const uint8_t*) item, size);
+        vRingbufferReturnItem(logBuffer, item);
+    }
+    Serial.flush();
+}
+
+// ----------------------------------------------------------------------------
+// Event journal
+// ----------------------------------------------------------------------------
+
+/**
+ * Queues an event without ever waiting (nor writing in the flash memory).
+ * When the queue is full, the new event is dropped (and counted): the
+ * beginning of an incident is the part that matters.
+ */
+
+void logEvent(JournalEvent type, uint8_t source = 0, float_t value = NAN, float_t extra = NAN) {
+    if (!journal.ready()) return;
+
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    time_t now    = time(NULL);
+    record.time   = now < CLOCK_VALID_AFTER ? 0 : now;
+    record.uptime = millis() / 1000;
+    record.type   = (uint8_t) type;
+    record.source = source;
+    record.value  = isnan(value) ? INT16_MIN : (int16_t) lroundf(constrain(value, -3276.7f, 3276.7f) * 10);
+    record.extra  = isnan(extra) ? INT16_MIN : (int16_t) lroundf(constrain(extra, -3276.7f, 3276.7f) * 10);
+
+    portENTER_CRITICAL(&journalMux);
+    JournalQueue &queue = journalQueue;
+    if (queue.tail - queue.head == JOURNAL_QUEUE_SIZE) {
+        queue.dropped++;
+    } else {
+        if (queue.tail == queue.head) queue.since = millis();
+        record.sequence = queue.tail;
+        queue.records[queue.tail++ % JOURNAL_QUEUE_SIZE] = record;
+    }
+    portEXIT_CRITICAL(&journalMux);
+}
+
+/**
+ * Writes the pending events, `JOURNAL_BATCH` at a time, if there are enough
+ * of them or if the oldest one has waited long enough (or in any case, if
+ * `force` is set).
+ */
+
+void flushJournal(bool force = false) {
+    if (!journal.ready()) return;
+
+    portENTER_CRITICAL(&journalMux);
+    uint32_t pending = journalQueue.tail - journalQueue.head;
+    bool     due     = pending >= JOURNAL_BATCH || (pending > 0 && millis() - journalQueue.since >= JOURNAL_FLUSH_DELAY);
+    portEXIT_CRITICAL(&journalMux);
+
+    if (!due && !(force && pending > 0)) return;
+
+    xSemaphoreTake(journalLock, portMAX_DELAY);
+    for (;;) {
+        JournalRecord batch[JOURNAL_BATCH];
+        portENTER_CRITICAL(&journalMux);
+        uint32_t head  = journalQueue.head;
+        uint8_t  count = min(journalQueue.tail - head, (uint32_t) JOURNAL_BATCH);
+        for (uint8_t i = 0; i < count; i++) batch[i] = journalQueue.records[(head + i) % JOURNAL_QUEUE_SIZE];
+        portEXIT_CRITICAL(&journalMux);
+
+        if (count == 0) break;
+        if (!journal.append(batch, count)) LOG_ERROR("** Failed to write the event journal!");
+
+        // the slots of a failed write are used up, but the events for which
+        // no sector could be started are kept, and retried at the next flush
+        uint32_t end = journal.end();
+        portENTER_CRITICAL(&journalMux);
+        journalQueue.head  = end;
+        journalQueue.since = millis();
+        portEXIT_CRITICAL(&journalMux);
+
+        if (end - head < count) break;
+    }
+    xSemaphoreGive(journalLock);
+}
+
+// Reads an event, whether it is still pending or already written.
+
+bool readEvent(uint32_t sequence, JournalRecord &record) {
+    xSemaphoreTake(journalLock, portMAX_DELAY);
+    bool found = journal.read(sequence, record);
+    if (!found) {
+        portENTER_CRITICAL(&journalMux);
+        found = sequence >= journalQueue.head && sequence < journalQueue.tail;
+        if (found) record = journalQueue.records[sequence % JOURNAL_QUEUE_SIZE];
+        portEXIT_CRITICAL(&journalMux);
+    }
+    xSemaphoreGive(journalLock);
+    return found;
+}
+
+// ----------------------------------------------------------------------------
+// Initialization procedures
+// ----------------------------------------------------------------------------
+
+// Serial monitor initialization
+// -----------------------------
+
+/**
+ * There is no need to wait for the serial monitor: the messages are queued
+ * until the logger task writes them (see `logPrintf()`).
+ */
+
+void initSerial() {
+#ifdef LOW_POWER
+    // before the UART is configured, which depends on the clock:
+    setCpuFrequencyMhz(LOW_POWER_CPU_FREQUENCY);
+#endif
+    Serial.begin(115200);
+    Serial.println(PREAMBLE);
+
+    logBuffer = xRingbufferCreate(LOG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+    xTaskCreatePinnedToCore(
+        drainLog,        // -> task function
+        "logger",        // -> task name
+        LOGGER_STACK,    // -> stack size
+        NULL,            // -> task parameter
+        LOGGER_PRIORITY, // -> task priority
+        NULL,            // -> task handle
+        NETWORK_CORE     // -> core on which the task runs
+    );
+}
+
+// LED indicator initialization
+// ----------------------------
+
+/**
+ * The WiFi LED is lit `onTime` milliseconds every `period` milliseconds,
+ * by the LEDC peripheral alone.
+ */
+
+void setWiFiBeacon(uint32_t period, uint32_t onTime) {
+    ledcSetup(BEACON_CHANNEL, 1000.0 / period, BEACON_RESOLUTION);
+    ledcWrite(BEACON_CHANNEL, ((uint64_t) onTime << BEACON_RESOLUTION) / period);
+}
+
+/**
+ * The sensor LED is turned on at each acquisition, and turned off by a
+ * one-shot timer.
+ */
+
+void turnTempBeaconOff(void *parameter) {
+    digitalWrite(TEMP_LED, LOW);
+}
+
+void flashTempBeacon() {
+    digitalWrite(TEMP_LED, HIGH);
+    esp_timer_stop(tempBeaconTimer);
+    esp_timer_start_once(tempBeaconTimer, TEMP_FLASH_DURATION * 1000);
+}
+
+void initLEDs() {
+    pinMode(TEMP_LED, OUTPUT);
+    esp_timer_create_args_t timer = { turnTempBeaconOff, NULL, ESP_TIMER_TASK, "tempBeacon" };
+    esp_timer_create(&timer, &tempBeaconTimer);
+
+    ledcAttachPin(INIT_LED, BEACON_CHANNEL);
+    setWiFiBeacon(250, 50); // -> not connected yet
+
+    LOG_INFO("1. LED indicators activated");
+}
+
+// Relay initialization
+// --------------------
+
+void initRelay() {
+    pinMode(RELAY_PIN, OUTPUT);
+    digitalWrite(RELAY_PIN, LOW);
+    // the relay may be energized as soon as the first excursion is detected
+    control.lastSwitch = millis() - MIN_RELAY_OFF_TIME;
+    LOG_INFO("2. Cooling unit relay released");
+}
+
+// Settings initialization
+// -----------------------
+
+/**
+ * If the temperature range has been saved in the EEPROM by a previous
+ * version of the firmware, it is moved once and for all into the settings.
+ */
+
+bool importLegacyEEPROM(SettingsRecord &record) {
+    if (!EEPROM.begin(EEPROM_SIZE) || EEPROM.readByte(ADDR_INIT_FLAG) != INIT_FLAG) return false;
+
+    makeSettingsRecord(record, EEPROM.readFloat(ADDR_MIN_TEMP), EEPROM.readFloat(ADDR_MAX_TEMP));
+    preferences.putBytes(SETTINGS_KEY, &record, sizeof(record));
+
+    // otherwise, the legacy values would come back after a factory reset
+    EEPROM.writeByte(ADDR_INIT_FLAG, 0xff);
+    EEPROM.commit();
+
+    return true;
+}
+
+void initSettings() {
+    settingsLock = xSemaphoreCreateMutex();
+    preferences.begin(SETTINGS_NAMESPACE, false);
+
+    SettingsRecord record;
+    bool valid = preferences.getBytes(SETTINGS_KEY, &record, sizeof(record)) == sizeof(record)
+              && isValidSettingsRecord(record);
+
+    if (valid) {
+        LOG_INFO("3. Settings loaded");
+    } else if (importLegacyEEPROM(record)) {
+        valid = true;
+        LOG_INFO("3. Settings imported from EEPROM");
+    } else {
+        LOG_INFO("3. No settings stored (factory settings)");
+    }
+
+    // the temperature range to be taken over by the thermostat is deduced from this:
+    tempRange.initialized = valid;
+    tempRange.lower       = valid ? record.lower : MIN_TEMP;
+    tempRange.upper       = valid ? record.upper : MAX_TEMP;
+    savedRange            = tempRange;
+
+    // an interrupted autotune starts over
+    ControlRecord controlRecord;
+    bool stored = preferences.getBytes(CONTROL_KEY, &controlRecord, sizeof(controlRecord)) == sizeof(controlRecord)
+               && isValidControlRecord(controlRecord);
+
+    if (stored) {
+        engine.setGains(controlRecord.gains);
+    } else {
+        makeControlRecord(controlRecord, CONTROL_MODE, engine.gains());
+    }
+    engine.setMode((ControlMode) controlRecord.mode, millis());
+    savedControl = controlRecord;
+
+    LOG_INFO("-> Control mode: %s", CONTROL_MODE_NAMES[controlRecord.mode]);
+
+    ScheduleRecord scheduleRecord;
+    stored = preferences.getBytes(SCHEDULE_KEY, &scheduleRecord, sizeof(scheduleRecord)) == sizeof(scheduleRecord)
+          && isValidScheduleRecord(scheduleRecord);
+
+    if (stored) {
+        schedule = scheduleRecord.table;
+    } else {
+        memset(&schedule, 0, sizeof(schedule));
+    }
+    savedSchedule = schedule;
+
+    uint8_t rules = 0;
+    for (const ScheduleRule &rule : schedule.rules) rules += rule.days != 0;
+    LOG_INFO("-> Schedule %s (%u rules)", schedule.enabled ? "enabled" : "disabled", rules);
+}
+
+// Event journal
+// -------------
+
+/**
+ * Without its partition (on a board whose partition table has only ever
+ * been updated over the air), the events are simply not recorded.
+ */
+
+void initJournal() {
+    journalLock = xSemaphoreCreateMutex();
+    journalFlash.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOURNAL_PARTITION);
+
+    if (!journalFlash.partition) {
+        LOG_ERROR("-> No [%s] partition, the events will not be recorded", JOURNAL_PARTITION);
+        return;
+    }
+    if (!journal.begin(&journalFlash, journalFlash.partition->size)) {
+        LOG_ERROR("** Failed to open the event journal!");
+        return;
+    }
+
+    journalQueue.head = journalQueue.tail = journal.end();
+    LOG_INFO("-> Event journal opened (%u events)", journal.end() - journal.first());
+
+    logEvent(JournalEvent::Boot, esp_reset_reason());
+}
+
+// Validation of a new firmware
+// ----------------------------
+
+/**
+ * The boots of a new firmware are counted until it has been running for
+ * `OTA_HEALTH_DELAY`. Beyond `OTA_MAX_BOOTS`, it is considered as failing,
+ * and the previous firmware, which is still in the other OTA partition, is
+ * booted again. This does not depend on the rollback support of the
+ * bootloader, which the Arduino core does not enable.
+ */
+
+void confirmFirmware(void *arg) {
+    xSemaphoreTake(settingsLock, portMAX_DELAY);
+    preferences.remove(OTA_BOOTS_KEY);
+    xSemaphoreGive(settingsLock);
+
+    esp_ota_mark_app_valid_cancel_rollback(); // -> in case the bootloader supports it
+    LOG_INFO("New firmware validated");
+}
+
+void checkFirmware() {
+    uint8_t boots = preferences.getUChar(OTA_BOOTS_KEY, 0);
+    if (boots == 0) return;
+
+    if (boots > OTA_MAX_BOOTS) {
+        preferences.remove(OTA_BOOTS_KEY);
+        const esp_partition_t *previous = esp_ota_get_next_update_partition(NULL);
+        if (previous && esp_ota_set_boot_partition(previous) == ESP_OK) {
+            LOG_ERROR("New firmware failed to start %u times, rolling back to %s", OTA_MAX_BOOTS, previous->label);
+            flushLog();
+            ESP.restart();
+        }
+        LOG_ERROR("New firmware failed to start %u times, but there is no firmware to roll back to", OTA_MAX_BOOTS);
+        return;
+    }
+
+    preferences.putUChar(OTA_BOOTS_KEY, boots + 1);
+
+    esp_timer_create_args_t timer = { confirmFirmware, NULL, ESP_TIMER_TASK, "otaHealth" };
+    esp_timer_create(&timer, &otaHealthTimer);
+    esp_timer_start_once(otaHealthTimer, OTA_HEALTH_DELAY * 1000ULL);
+
+    LOG_INFO("-> New firmware on probation (boot %u of %u)", boots, OTA_MAX_BOOTS);
+}
+
+void initTempRange() {
+    LOG_INFO("4. Temperature range set to [ %.1f°C , %.1f°C ]", tempRange.lower, tempRange.upper);
+}
+
+// Temperature sensors initialization
+// ----------------------------------
+
+void initTempSensor() {
+    Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        sensors[i]->begin();
+        snapshots[i] = { NAN, NAN, 0, 0, true };
+    }
+    LOG_INFO("5. %u temperature sensor(s) activated", SENSOR_COUNT);
+}
+
+// SPIFFS initialization
+// ---------------------
+
+/**
+ * The web user interface will be stored on the ESP32 Flash memory file system
+ * as 5 separate files :
+ * - index.html  (the interface structure)
+ * - index.css   (the graphical layout of the interface)
+ * - index.js    (the dynamic interface management program)
+ * - D7MR.woff2  (the font used for numeric displays)
+ * - favicon.ico (the tiny icon for the browser)
+ *
+ * When they are embedded in the firmware, the volume only holds the MQTT
+ * spool: it is not mounted at all without it, and a volume that cannot be
+ * mounted is formatted instead of blocking the startup.
+ */
+
+void initSPIFFS() {
+#ifdef EMBEDDED_ASSETS
+    if (!MQTT_SPOOL) {
+        LOG_INFO("6. Web assets embedded in the firmware, SPIFFS is not used");
+    } else if (SPIFFS.begin(true)) {
+        LOG_INFO("6. SPIFFS volume is mounted (MQTT spool)");
+    } else {
+        LOG_ERROR("Cannot mount SPIFFS volume: the MQTT outbox will not be spooled");
+    }
+#else
+    if (!SPIFFS.begin()) {
+        LOG_ERROR("Cannot mount SPIFFS volume...");
+        setWiFiBeacon(200, 20);
+        for (;;) vTaskDelay(portMAX_DELAY);
+    }
+    LOG_INFO("6. SPIFFS volume is mounted");
+#endif
+}
+
+// WiFi connection initialization
+// ------------------------------
+
+/**
+ * A connection to the ambient WiFi network is required here to be able to
+ * interact with an operator (who will access ESP32 through a web browser).
+ *
+ * The connection is entirely driven by the WiFi events: the initialization
+ * does not wait for it to be established, so that the thermostat starts
+ * regulating the temperature right away, even if the access point is down.
+ */
+
+bool hasWiFiCache() {
+    return wifiCache.magic == WIFI_CACHE_MAGIC;
+}
+
+void connectWiFi() {
+    wifiStartTime = millis();
+    if (hasWiFiCache()) {
+        WiFi.begin(WIFI_SSID, WIFI_PASS, wifiCache.channel, wifiCache.bssid);
+    } else {
+        WiFi.begin(WIFI_SSID, WIFI_PASS);
+    }
+}
+
+void retryWiFi(TimerHandle_t timer) {
+    connectWiFi();
+}
+
+/**
+ * The SNTP client is started with the first connection, and then keeps the
+ * clock synchronized on its own.
+ */
+
+void startClock() {
+    if (clockStarted) return;
+    configTzTime(TIMEZONE, NTP_SERVER, NTP_FALLBACK);
+    clockStarted = true;
+}
+
+/**
+ * The mDNS responder is started with the first connection, and then follows
+ * the reconnections on its own.
+ */
+
+void startDiscovery() {
+    if (mdnsStarted) return;
+
+    if (!MDNS.begin(deviceName)) {
+        LOG_ERROR("Cannot start the mDNS responder");
+        return;
+    }
+
+    char count[4];
+    snprintf(count, sizeof(count), "%u", SENSOR_COUNT);
+    MDNS.addService("http",       "tcp", HTTP_PORT);
+    MDNS.addService("thermostat", "tcp", HTTP_PORT);
+    MDNS.addServiceTxt("thermostat", "tcp", "path",    "/temp");
+    MDNS.addServiceTxt("thermostat", "tcp", "sensors", count);
+    if (TELEMETRY_ENABLED) {
+        char port[6];
+        snprintf(port, sizeof(port), "%u", TELEMETRY_PORT);
+        MDNS.addServiceTxt("thermostat", "tcp", "telemetry", port);
+    }
+
+    mdnsStarted = true;
+    LOG_INFO("-> Advertised as %s.local", deviceName);
+}
+
+void onWiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info) {
+    wifiConnected  = true;
+    wifiRetryDelay = WIFI_RETRY_MIN_DELAY;
+    setWiFiBeacon(2000, 50);
+
+    memcpy(wifiCache.bssid, WiFi.BSSID(), sizeof(wifiCache.bssid));
+    wifiCache.channel = WiFi.channel();
+    wifiCache.magic   = WIFI_CACHE_MAGIC;
+
+    LOG_INFO("-> WiFi connected in %u ms => %s", millis() - wifiStartTime, WiFi.localIP().toString().c_str());
+    if (bootConnected == 0) bootConnected = esp_timer_get_time();
+
+#ifndef LOW_POWER
+    startClock();
+    startDiscovery();
+#endif
+}
+
+/**
+ * If the connection attempt fails, the cached access point may have changed
+ * channel (or may have been replaced): the next attempt will perform a full
+ * scan. If an established connection is lost, the cache is kept for a first
+ * attempt.
+ */
+
+void onWiFiDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
+    if (!wifiConnected) wifiCache.magic = 0;
+    wifiConnected = false;
+    setWiFiBeacon(250, 50);
+
+    LOG_ERROR("-> WiFi disconnected (reason %u), retrying in %u ms", info.disconnected.reason, wifiRetryDelay);
+    xTimerChangePeriod(wifiRetryTimer, pdMS_TO_TICKS(wifiRetryDelay), 0);
+    wifiRetryDelay = min(2 * wifiRetryDelay, WIFI_RETRY_MAX_DELAY);
+}
+
+void initWiFi() {
+    wifiRetryTimer = xTimerCreate("wifi", pdMS_TO_TICKS(WIFI_RETRY_MIN_DELAY), pdFALSE, NULL, retryWiFi);
+
+    WiFi.persistent(false);       // -> no need to write the credentials in flash at each connection
+    WiFi.setAutoReconnect(false); // -> reconnections are handled by `onWiFiDisconnected()`
+    WiFi.onEvent(onWiFiGotIP, SYSTEM_EVENT_STA_GOT_IP);
+    WiFi.onEvent(onWiFiDisconnected, SYSTEM_EVENT_STA_DISCONNECTED);
+    WiFi.mode(WIFI_STA);
+    esp_wifi_set_ps(WIFI_POWER_SAVE);
+
+    // the device name is derived from the MAC address, which is now available:
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(deviceName, sizeof(deviceName), "%s-%02x%02x%02x", MDNS_HOSTNAME_PREFIX, mac[3], mac[4], mac[5]);
+    WiFi.setHostname(deviceName);
+
+    if (WIFI_STATIC_IP) WiFi.config(WIFI_LOCAL_IP, WIFI_GATEWAY, WIFI_SUBNET, WIFI_DNS);
+
+    LOG_INFO("7. Connecting to [%s] network in the background%s", WIFI_SSID, hasWiFiCache() ? " (cached access point)" : "");
+    connectWiFi();
+}
+
+// ----------------------------------------------------------------------------
+// Metrics collection
+// ----------------------------------------------------------------------------
+
+void observeLatency(LatencyHistogram &histogram, uint32_t duration) {
+    uint8_t i = 0;
+    while (i < LATENCY_BUCKETS && duration > LATENCY_BOUNDS[i]) i++;
+    histogram.buckets[i]++;
+    histogram.count++;
+    histogram.sum += duration;
+}
+
+// The following ones are called by tasks other than the AsyncTCP one
+
+#ifdef PROFILING
+void recordProfile(uint16_t probe, uint32_t duration) {
+    portENTER_CRITICAL(&profileMux);
+    ProfileProbe &p = profile[probe];
+    p.samples[p.count++ % PROFILE_SAMPLES] = duration;
+    portEXIT_CRITICAL(&profileMux);
+}
+#else
+inline void recordProfile(uint16_t probe, uint32_t duration) {}
+#endif
+
+void observeSensorRead(uint8_t sensor, uint32_t duration, bool failed) {
+    portENTER_CRITICAL(&metricsMux);
+    observeLatency(metrics.sensorReads[sensor], duration);
+    if (failed) metrics.sensorFailures[sensor]++;
+    portEXIT_CRITICAL(&metricsMux);
+    recordProfile(PROFILE_SENSORS + sensor, duration);
+}
+
+void observeOutlier(uint8_t sensor) {
+    portENTER_CRITICAL(&metricsMux);
+    metrics.sensorOutliers[sensor]++;
+    portEXIT_CRITICAL(&metricsMux);
+}
+
+void observeSettingsCommit(uint32_t duration) {
+    portENTER_CRITICAL(&metricsMux);
+    observeLatency(metrics.settingsCommits, duration);
+    portEXIT_CRITICAL(&metricsMux);
+}
+
+// ----------------------------------------------------------------------------
+// MQTT outbox
+// ----------------------------------------------------------------------------
+
+/**
+ * Queues a message without ever waiting. When the outbox is full, the oldest
+ * message is dropped, unless it is waiting for its acknowledgement, in which
+ * case the new one is.
+ */
+
+void queueMqttMessage(MqttTopic topic, uint8_t qos, bool retain, const char *payload) {
+    if (!MQTT_ENABLED) return;
+
+    size_t length = min(strlen(payload), MQTT_PAYLOAD_SIZE);
+
+    portENTER_CRITICAL(&outboxMux);
+    MqttOutbox &outbox = mqttOutbox;
+    bool queued = true;
+    if (outbox.tail - outbox.head == MQTT_OUTBOX_SIZE) {
+        if (outbox.sent == outbox.head) {
+            outbox.head++;
+            outbox.sent++;
+        } else {
+            queued = false;
+        }
+        outbox.dropped++;
+    }
+    if (queued) {
+        MqttMessage &message = outbox.messages[outbox.tail++ % MQTT_OUTBOX_SIZE];
+        message.topic    = topic;
+        message.qos      = qos;
+        message.retain   = retain;
+        message.done     = false;
+        message.packetId = 0;
+        message.length   = length;
+        memcpy(message.payload, payload, length);
+    }
+    portEXIT_CRITICAL(&outboxMux);
+
+    if (queued && mqttPublisher) xTaskNotifyGive(mqttPublisher);
+}
+
+// ----------------------------------------------------------------------------
+// Temperature handling
+// ----------------------------------------------------------------------------
+
+// Sensor reading
+// --------------
+
+/**
+ * The conversions of all the sensors that can measure on their own are
+ * triggered first. The synchronous sensors are read while these conversions
+ * are in progress, and the others are then collected once the longest
+ * conversion is over. The whole acquisition therefore takes the longest
+ * conversion time plus the synchronous readings, instead of the sum of all
+ * of them.
+ *
+ * An acquisition triggers a flash of the LED indicator.
+ *
+ * This routine must only be called from the sampling task.
+ */
+
+void readSensors(Reading readings[], bool success[]) {
+    uint32_t conversion[SENSOR_COUNT];
+    uint32_t longest = 0;
+    uint32_t start   = millis();
+
+    flashTempBeacon();
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        conversion[i] = sensors[i]->startConversion();
+        longest = max(longest, conversion[i]);
+    }
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        // first the synchronous sensors, then the others
+        if (pass == 1) {
+            uint32_t elapsed = millis() - start;
+            if (elapsed < longest) vTaskDelay(pdMS_TO_TICKS(longest - elapsed));
+        }
+        for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+            if ((conversion[i] > 0) != (pass == 1)) continue;
+            uint32_t begin = micros();
+            success[i] = sensors[i]->collect(readings[i]);
+            observeSensorRead(i, micros() - begin, !success[i]);
+        }
+    }
+}
+
+// Access to the latest readings
+// -----------------------------
+
+TempSnapshot getTempSnapshot(uint8_t sensor = CONTROL_SENSOR) {
+    portENTER_CRITICAL(&snapshotMux);
+    TempSnapshot snapshot = snapshots[sensor];
+    portEXIT_CRITICAL(&snapshotMux);
+    return snapshot;
+}
+
+/**
+ * The reading is only usable if the last one was accepted by the filter, or
+ * if the last accepted one is recent enough (a single failed DHT11 read
+ * should not make the whole interface display an error).
+ */
+
+bool hasValidTemperature(const TempSnapshot &snapshot) {
+    if (isnan(snapshot.temperature)) return false;
+    return !snapshot.error || millis() - snapshot.timestamp < SAMPLE_MAX_AGE;
+}
+
+// Triggers
+// --------
+
+/**
+ * When temperatures are outside the range allowed by the operator,
+ * special actions may be desired. These must be defined here.
+ * 
+ * The triggers are called by the sampling task, once per sample for as long
+ * as the excursion lasts, whether or not a client browser is connected.
+ * They must therefore return quickly.
+ */
+
+void lowTemperatureTrigger () {
+    // trigger whatever you want here...
+}
+
+void highTemperatureTrigger () {
+    // trigger whatever you want here...
+}
+
+// Relay control
+// -------------
+
+/**
+ * The relay is only switched if it has spent enough time in its current
+ * state. Otherwise the request is simply ignored, and will be renewed at the
+ * next sample if it is still relevant.
+ */
+
+void driveRelay(bool on) {
+    if (on == control.relayOn) return;
+
+    uint32_t now     = millis();
+    uint32_t minTime = control.relayOn ? MIN_RELAY_ON_TIME : MIN_RELAY_OFF_TIME;
+
+    if (now - control.lastSwitch >= minTime) {
+        control.relayOn    = on;
+        control.lastSwitch = now;
+        digitalWrite(RELAY_PIN, on ? HIGH : LOW);
+    }
+}
+
+// Threshold crossings are published as MQTT events:
+
+void publishZoneChange(TempZone from, TempZone to, float_t temp) {
+    char payload[MQTT_PAYLOAD_SIZE];
+    snprintf(payload, sizeof(payload), "{\"uptime\":%u,\"event\":\"zone\",\"from\":\"%s\",\"to\":\"%s\",\"temp\":%.1f}",
+        millis() / 1000, ZONE_NAMES[(uint8_t) from], ZONE_NAMES[(uint8_t) to], temp);
+    queueMqttMessage(MQTT_EVENTS, 1, false, payload);
+}
+
+// So is the end of an autotune, with the gains found:
+
+void publishAutotune(const PidGains &gains) {
+    char payload[MQTT_PAYLOAD_SIZE];
+    snprintf(payload, sizeof(payload), "{\"uptime\":%u,\"event\":\"autotune\",\"kp\":%.1f,\"ti\":%.0f,\"td\":%.0f}",
+        millis() / 1000, gains.kp, gains.ti, gains.td);
+    queueMqttMessage(MQTT_EVENTS, 1, false, payload);
+}
+
+/**
+ * The relay is energized for the first part of each window given by the
+ * output of the engine, which is computed anew at each sample.
+ */
+
+void driveControl(const TempSnapshot &snapshot, const TempRange &range) {
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&controlMux);
+    ControlMode mode   = engine.mode();
+    uint16_t    output = engine.update(
+        lroundf(snapshot.temperature * 100), lroundf(range.lower * 100), lroundf(range.upper * 100), now);
+    bool        tuned  = mode == ControlMode::Autotune && engine.mode() == ControlMode::Pid;
+    PidGains    gains  = engine.gains();
+    portEXIT_CRITICAL(&controlMux);
+
+    if (tuned) {
+        LOG_INFO("Autotune done: kp = %.1f, ti = %.0f s, td = %.0f s", gains.kp, gains.ti, gains.td);
+        publishAutotune(gains);
+        if (persister) xTaskNotifyGive(persister);
+    }
+
+    if (now - control.windowStart >= CONTROL_WINDOW) control.windowStart = now;
+    driveRelay(now - control.windowStart < relayOnTime(output, CONTROL_WINDOW, MIN_RELAY_ON_TIME, MIN_RELAY_OFF_TIME));
+}
+
+/**
+ * Without a usable reading, no decision can be made on the thresholds, and
+ * the cooling unit is released as soon as its minimum on-time allows it.
+ */
+
+void checkForTriggers(const TempSnapshot &snapshot) {
+    if (!hasValidTemperature(snapshot)) {
+        portENTER_CRITICAL(&controlMux);
+        engine.hold();
+        portEXIT_CRITICAL(&controlMux);
+        driveRelay(false);
+        return;
+    }
+
+    portENTER_CRITICAL(&rangeMux);
+    TempRange range = tempRange;
+    portEXIT_CRITICAL(&rangeMux);
+
+    // see `evaluateZone()` in lib/thermostat about the hysteresis:
+    TempZone previous = control.zone;
+    control.zone = evaluateZone(control.zone, snapshot.temperature, range.lower, range.upper, HYSTERESIS);
+    if (control.zone != previous) {
+        publishZoneChange(previous, control.zone, snapshot.temperature);
+        // the limit that has been crossed, on the way out or back
+        TempZone side = control.zone == TempZone::Normal ? previous : control.zone;
+        logEvent(JournalEvent::Excursion, (uint8_t) control.zone, snapshot.temperature,
+            side == TempZone::High ? range.upper : range.lower);
+    }
+
+    switch (control.zone) {
+        case TempZone::Low:    lowTemperatureTrigger();  break;
+        case TempZone::High:   highTemperatureTrigger(); break;
+        case TempZone::Normal: break;
+    }
+
+    driveControl(snapshot, range);
+}
+
+// Scheduled temperature ranges
+// ----------------------------
+
+/**
+ * Evaluated once per sample: most of the time, this amounts to comparing the
+ * local time with the next transition, which the evaluator has computed in
+ * advance.
+ */
+
+bool getLocalMinutes(uint32_t &minutes) {
+    time_t now = time(NULL);
+    if (now < CLOCK_VALID_AFTER) return false;
+
+    struct tm local;
+    localtime_r(&now, &local);
+    minutes = localMinutes(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min);
+    return true;
+}
+
+void publishScheduleChange(int8_t rule, float_t lower, float_t upper) {
+    char payload[MQTT_PAYLOAD_SIZE];
+    snprintf(payload, sizeof(payload), "{\"uptime\":%u,\"event\":\"schedule\",\"rule\":%d,\"lower\":%.1f,\"upper\":%.1f}",
+        millis() / 1000, rule, lower, upper);
+    queueMqttMessage(MQTT_EVENTS, 1, false, payload);
+}
+
+void applySchedule() {
+    uint32_t now;
+    if (!getLocalMinutes(now)) return;
+
+    portENTER_CRITICAL(&scheduleMux);
+    bool         changed = schedule.enabled && scheduler.update(schedule, now);
+    int8_t       active  = scheduler.active();
+    ScheduleRule rule    = active < 0 ? ScheduleRule{} : schedule.rules[active];
+    portEXIT_CRITICAL(&scheduleMux);
+
+    if (!changed || active < 0) return;
+
+    float_t lower = rule.lower / 10.0f;
+    float_t upper = rule.upper / 10.0f;
+    LOG_INFO("Schedule: rule %d sets [ %.1f°C , %.1f°C ]", active, lower, upper);
+    publishScheduleChange(active, lower, upper);
+
+    portENTER_CRITICAL(&rangeMux);
+    tempRange = { true, lower, upper };
+    portEXIT_CRITICAL(&rangeMux);
+    xTaskNotifyGive(persister); // -> stored like a change made by the operator
+}
+
+// Recording of the history
+// ------------------------
+
+HistorySample quantize(const TempSnapshot &snapshot, uint32_t uptime) {
+    HistorySample sample;
+    sample.uptime      = uptime;
+    sample.temperature = snapshot.error ? HISTORY_NO_TEMP : (int16_t) lroundf(snapshot.temperature * 10);
+    sample.humidity    = snapshot.error || isnan(snapshot.humidity)
+                       ? HISTORY_NO_HUMIDITY
+                       : (uint16_t) lroundf(snapshot.humidity * 10);
+    return sample;
+}
+
+void recordHistory(const TempSnapshot snapshots[]) {
+    uint32_t uptime = millis() / 1000;
+
+    portENTER_CRITICAL(&controlMux);
+    ControlSample state = { uptime, engine.output(), (uint8_t) engine.mode(), control.relayOn };
+    portEXIT_CRITICAL(&controlMux);
+
+    portENTER_CRITICAL(&historyMux);
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        history[i][historyTotal % HISTORY_SIZE] = quantize(snapshots[i], uptime);
+    }
+    controlHistory[historyTotal % HISTORY_SIZE] = state;
+    historyTotal++;
+    portEXIT_CRITICAL(&historyMux);
+}
+
+/**
+ * Copies the sample of absolute rank `rank` of a sensor and returns `false`
+ * if it is no longer (or not yet) in the ring buffer.
+ */
+
+bool getHistorySample(uint8_t sensor, uint32_t rank, HistorySample &sample) {
+    bool available;
+    portENTER_CRITICAL(&historyMux);
+    available = rank < historyTotal && historyTotal - rank <= HISTORY_SIZE;
+    if (available) sample = history[sensor][rank % HISTORY_SIZE];
+    portEXIT_CRITICAL(&historyMux);
+    return available;
+}
+
+bool getControlSample(uint32_t rank, ControlSample &sample) {
+    bool available;
+    portENTER_CRITICAL(&historyMux);
+    available = rank < historyTotal && historyTotal - rank <= HISTORY_SIZE;
+    if (available) sample = controlHistory[rank % HISTORY_SIZE];
+    portEXIT_CRITICAL(&historyMux);
+    return available;
+}
+
+uint32_t getHistoryTotal() {
+    portENTER_CRITICAL(&historyMux);
+    uint32_t total = historyTotal;
+    portEXIT_CRITICAL(&historyMux);
+    return total;
+}
+
+// Broadcasting of readings
+// ------------------------
+
+/**
+ * Each new reading is pushed once to all the browsers subscribed to the
+ * `/events` stream, instead of each of them having to poll `/temp`.
+ * The sequence number of the sample is used as the event identifier.
+ *
+ * The `temperature` events carry the reading of the control sensor (the one
+ * displayed by the web user interface), and the `sensor` events carry the
+ * readings of each sensor as a small JSON document.
+ *
+ * The web server library walks the list of subscribers without any lock,
+ * while the AsyncTCP task adds and deletes them: the sampling task therefore
+ * only hands the readings over (the latest ones win), and the events are
+ * sent by a task of the network core, with a priority above the one of the
+ * AsyncTCP task, which cannot delete a subscriber in the middle of a walk.
+ */
+
+void formatTemperature(const TempSnapshot &snapshot, char *buffer, size_t size) {
+    if (hasValidTemperature(snapshot)) {
+        snprintf(buffer, size, "%.1f", snapshot.temperature);
+    } else {
+        snprintf(buffer, size, "Error");
+    }
+}
+
+void formatSensorJson(uint8_t sensor, const TempSnapshot &snapshot, char *buffer, size_t size) {
+    formatReadingJson(sensor, sensors[sensor]->name, snapshot.temperature, snapshot.humidity,
+        hasValidTemperature(snapshot), buffer, size);
+}
+
+void renderTempResponse(uint8_t sensor, const TempSnapshot &snapshot, uint32_t expires) {
+    TempResponse response;
+    formatTemperature(snapshot, response.body, sizeof(response.body));
+    snprintf(response.etag, sizeof(response.etag), "\"%08x-%u\"", bootId, snapshot.sequence);
+    response.expires = expires;
+    response.valid   = hasValidTemperature(snapshot);
+
+    portENTER_CRITICAL(&responseMux);
+    tempResponses[sensor] = response;
+    portEXIT_CRITICAL(&responseMux);
+}
+
+void broadcastTemperatures(const TempSnapshot snapshots[]) {
+    if (broadcaster == NULL) return;
+
+    portENTER_CRITICAL(&snapshotMux);
+    memcpy(broadcastSnapshots, snapshots, sizeof(broadcastSnapshots));
+    portEXIT_CRITICAL(&snapshotMux);
+
+    xTaskNotifyGive(broadcaster);
+}
+
+void pushTemperatures(void *parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (events.count() == 0) continue;
+
+        TempSnapshot current[SENSOR_COUNT];
+        portENTER_CRITICAL(&snapshotMux);
+        memcpy(current, broadcastSnapshots, sizeof(current));
+        portEXIT_CRITICAL(&snapshotMux);
+
+        char data[80];
+        formatTemperature(current[CONTROL_SENSOR], data, sizeof(data));
+        events.send(data, "temperature", current[CONTROL_SENSOR].sequence);
+
+        for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+            formatSensorJson(i, current[i], data, sizeof(data));
+            events.send(data, "sensor", current[i].sequence);
+        }
+    }
+}
+
+void startBroadcaster() {
+    xTaskCreatePinnedToCore(
+        pushTemperatures,     // -> task function
+        "broadcaster",        // -> task name
+        BROADCASTER_STACK,    // -> stack size
+        NULL,                 // -> task parameter
+        BROADCASTER_PRIORITY, // -> task priority
+        &broadcaster,         // -> task handle
+        NETWORK_CORE          // -> core on which the task runs
+    );
+}
+
+// MQTT state
+// ----------
+
+void publishMqttState(const TempSnapshot &snapshot, uint32_t uptime, uint8_t qos = 0) {
+    char temp[8];
+    char humidity[8];
+    bool valid = hasValidTemperature(snapshot);
+    formatJsonValue(snapshot.temperature, valid, temp, sizeof(temp));
+    formatJsonValue(snapshot.humidity, valid, humidity, sizeof(humidity));
+
+    portENTER_CRITICAL(&rangeMux);
+    TempRange range = tempRange;
+    portEXIT_CRITICAL(&rangeMux);
+
+    char payload[MQTT_PAYLOAD_SIZE];
+    snprintf(payload, sizeof(payload),
+        "{\"uptime\":%u,\"temp\":%s,\"humidity\":%s,\"lower\":%.1f,\"upper\":%.1f,\"zone\":\"%s\",\"relay\":%s}",
+        uptime, temp, humidity, range.lower, range.upper,
+        ZONE_NAMES[(uint8_t) control.zone], control.relayOn ? "true" : "false");
+    queueMqttMessage(MQTT_STATE, qos, true, payload);
+}
+
+// Telemetry datagrams
+// -------------------
+
+/**
+ * A single datagram per sample, sent without waiting for anything: lwIP
+ * simply drops it if the collector cannot be reached.
+ */
+
+void makeTelemetryHeader(TelemetryHeader &header, uint32_t uptime, uint32_t sequence) {
+    portENTER_CRITICAL(&rangeMux);
+    TempRange range = tempRange;
+    portEXIT_CRITICAL(&rangeMux);
+
+    header.magic    = TELEMETRY_MAGIC;
+    header.version  = TELEMETRY_VERSION;
+    header.sensors  = SENSOR_COUNT;
+    WiFi.macAddress(header.mac);
+    header.uptime   = uptime;
+    header.sequence = sequence;
+    header.lower    = (int16_t) lroundf(range.lower * 10);
+    header.upper    = (int16_t) lroundf(range.upper * 10);
+    header.zone     = (uint8_t) control.zone;
+    header.relay    = control.relayOn;
+}
+
+void sendTelemetry(const TempSnapshot snapshots[]) {
+    if (!TELEMETRY_ENABLED || !wifiConnected) return;
+
+    static uint32_t sequence = 0;
+    uint32_t uptime = millis() / 1000;
+
+    TelemetryDatagram datagram;
+    makeTelemetryHeader(datagram.header, uptime, sequence++);
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        HistorySample sample = quantize(snapshots[i], uptime);
+        datagram.records[i].temperature = sample.temperature;
+        datagram.records[i].humidity    = sample.humidity;
+    }
+
+    telemetry.writeTo((const uint8_t*) &datagram, sizeof(datagram), TELEMETRY_COLLECTOR, TELEMETRY_PORT);
+}
+
+// Background sampling task
+// ------------------------
+
+/**
+ * The task wakes up at a fixed cadence (`vTaskDelayUntil` compensates for
+ * the time spent reading the sensors), publishes the readings in the shared
+ * snapshots, runs the control loop on the one of the control sensor,
+ * broadcasts them to the subscribed browsers and to the telemetry
+ * collector, and finally queues them for the MQTT broker and records them
+ * in the history from time to time.
+ */
+
+void sampleTemperature(void *parameter) {
+    TickType_t lastWake    = xTaskGetTickCount();
+    uint32_t   lastHistory = millis() - HISTORY_PERIOD;
+    uint32_t   lastState   = millis() - MQTT_STATE_PERIOD;
+
+    TempSnapshot current[SENSOR_COUNT];
+    SensorFilter filters[SENSOR_COUNT];
+    Reading      readings[SENSOR_COUNT];
+    bool         success[SENSOR_COUNT];
+    bool         accepted[SENSOR_COUNT];
+    bool         valid[SENSOR_COUNT]; // -> whether the reading was usable, at the previous sample
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) valid[i] = true;
+
+    for (;;) {
+        uint32_t cycle = millis();
+        readSensors(readings, success);
+        uint32_t now = millis();
+
+        for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+            accepted[i] = false;
+            if (!success[i]) continue;
+            accepted[i] = filters[i].temperature.update(readings[i].temperature, now) == SignalFilter::Accepted;
+            filters[i].humidity.update(readings[i].humidity, now);
+            if (!accepted[i]) observeOutlier(i);
+        }
+
+        portENTER_CRITICAL(&snapshotMux);
+        for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+            TempSnapshot &snapshot = snapshots[i];
+            snapshot.sequence++;
+            snapshot.error = !accepted[i];
+            if (accepted[i]) {
+                snapshot.temperature = filters[i].temperature.value();
+                snapshot.timestamp   = now;
+            }
+            snapshot.humidity = filters[i].humidity.age(now) < SAMPLE_MAX_AGE ? filters[i].humidity.value() : NAN;
+            current[i] = snapshot;
+        }
+        portEXIT_CRITICAL(&snapshotMux);
+
+        for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+            renderTempResponse(i, current[i], cycle + SAMPLING_PERIOD);
+            if (hasValidTemperature(current[i]) != valid[i]) {
+                valid[i] = !valid[i];
+                logEvent(valid[i] ? JournalEvent::SensorRecovery : JournalEvent::SensorFailure, i, current[i].temperature);
+            }
+        }
+
+        applySchedule();
+        checkForTriggers(current[CONTROL_SENSOR]);
+        broadcastTemperatures(current);
+        sendTelemetry(current);
+
+        if (now - lastState >= MQTT_STATE_PERIOD) {
+            lastState = now;
+            publishMqttState(current[CONTROL_SENSOR], now / 1000);
+        }
+
+        if (now - lastHistory >= HISTORY_PERIOD) {
+            lastHistory = now;
+            recordHistory(current);
+        }
+
+        flushJournal();
+
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SAMPLING_PERIOD));
+    }
+}
+
+void startSampler() {
+    bootId = esp_random();
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) renderTempResponse(i, snapshots[i], millis());
+
+    xTaskCreatePinnedToCore(
+        sampleTemperature, // -> task function
+        "sampler",         // -> task name
+        SAMPLER_STACK,     // -> stack size
+        NULL,              // -> task parameter
+        SAMPLER_PRIORITY,  // -> task priority
+        NULL,              // -> task handle
+        CONTROL_CORE       // -> core on which the task runs
+    );
+}
+
+// Temperature range backup
+// ------------------------
+
+/**
+ * The lower and upper temperature limits (and the settings of the control
+ * engine, and the schedule) are only written if the current values differ
+ * from the values already stored in the flash memory. There is
+ * no need to write anything if this is not necessary. Without any
+ * operator-defined range (after a factory reset), the record is removed.
+ *
+ * This routine may be called by the persistence task, as well as just before
+ * a reboot, hence the lock.
+ */
+
+void commitSettings() {
+    xSemaphoreTake(settingsLock, portMAX_DELAY);
+
+    portENTER_CRITICAL(&rangeMux);
+    TempRange range = tempRange;
+    portEXIT_CRITICAL(&rangeMux);
+
+    portENTER_CRITICAL(&controlMux);
+    ControlMode mode  = engine.mode();
+    PidGains    gains = engine.gains();
+    portEXIT_CRITICAL(&controlMux);
+
+    bool unchanged = range.initialized == savedRange.initialized
+                  && (!range.initialized || (range.lower == savedRange.lower && range.upper == savedRange.upper));
+
+    bool controlUnchanged = (uint8_t) mode == savedControl.mode
+                         && memcmp(&gains, &savedControl.gains, sizeof(gains)) == 0;
+
+    portENTER_CRITICAL(&scheduleMux);
+    ScheduleTable table = schedule;
+    portEXIT_CRITICAL(&scheduleMux);
+
+    bool scheduleUnchanged = table.enabled == savedSchedule.enabled
+                          && memcmp(table.rules, savedSchedule.rules, sizeof(table.rules)) == 0;
+
+    if (unchanged && controlUnchanged && scheduleUnchanged) {
+        LOG_INFO("Settings already stored (no change)");
+    } else {
+        uint32_t start = micros();
+        if (!unchanged && range.initialized) {
+            SettingsRecord record;
+            makeSettingsRecord(record, range.lower, range.upper);
+            preferences.putBytes(SETTINGS_KEY, &record, sizeof(record));
+            LOG_INFO("-> Settings have been stored");
+        } else if (!unchanged) {
+            preferences.remove(SETTINGS_KEY);
+            LOG_INFO("-> Settings have been erased");
+        }
+        if (!unchanged) logEvent(JournalEvent::RangeChanged, range.initialized, range.lower, range.upper);
+        if (!controlUnchanged) {
+            makeControlRecord(savedControl, mode, gains);
+            preferences.putBytes(CONTROL_KEY, &savedControl, sizeof(savedControl));
+            logEvent(JournalEvent::ControlChanged, (uint8_t) mode, gains.kp);
+            LOG_INFO("-> Control settings have been stored");
+        }
+        if (!scheduleUnchanged) {
+            ScheduleRecord record;
+            makeScheduleRecord(record, table);
+            preferences.putBytes(SCHEDULE_KEY, &record, sizeof(record));
+            savedSchedule = table;
+            uint8_t rules = 0;
+            for (const ScheduleRule &rule : table.rules) rules += rule.days != 0;
+            logEvent(JournalEvent::ScheduleChanged, rules, table.enabled);
+            LOG_INFO("-> Schedule has been stored");
+        }
+        observeSettingsCommit(micros() - start);
+    }
+
+    savedRange = range;
+    xSemaphoreGive(settingsLock);
+}
+
+// Background persistence task
+// ---------------------------
+
+/**
+ * The task sleeps until it is notified of a change, and then waits for the
+ * operator to stop changing the settings before writing them: each new
+ * notification restarts the debounce window.
+ */
+
+void persistSettings(void *parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t firstChange = millis();
+
+        for (;;) {
+            uint32_t elapsed = millis() - firstChange;
+            if (elapsed >= SETTINGS_MAX_DELAY) break;
+            uint32_t timeout = min(SETTINGS_DEBOUNCE, SETTINGS_MAX_DELAY - elapsed);
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout)) == 0) break;
+        }
+
+        commitSettings();
+    }
+}
+
+void startPersister() {
+    xTaskCreatePinnedToCore(
+        persistSettings,    // -> task function
+        "persister",        // -> task name
+        PERSISTER_STACK,    // -> stack size
+        NULL,               // -> task parameter
+        PERSISTER_PRIORITY, // -> task priority
+        &persister,         // -> task handle
+        CONTROL_CORE        // -> core on which the task runs
+    );
+}
+
+// Changes of the temperature range
+// --------------------------------
+
+/**
+ * This routine returns immediately: the factory range is applied at once,
+ * and the persistence task is simply notified that it will have to be saved
+ * (see also `applyConfig()`).
+ */
+
+void resetTempRange() {
+    portENTER_CRITICAL(&rangeMux);
+    tempRange.initialized = false;
+    tempRange.lower       = MIN_TEMP;
+    tempRange.upper       = MAX_TEMP;
+    portEXIT_CRITICAL(&rangeMux);
+
+    xTaskNotifyGive(persister);
+}
+
+// ----------------------------------------------------------------------------
+// HTTP route definition & request processing
+// ----------------------------------------------------------------------------
+
+// Parsing of a numeric parameter, without any temporary `String`
+// (the names are dispatched with `hashKey()` and `KEY_CASE()`, see lib/thermostat)
+
+float_t parseFloat(const AsyncWebParameter *param) {
+    return strtof(param->value().c_str(), NULL);
+}
+
+// Parsing of a sensor index (the control sensor by default)
+
+bool parseSensor(AsyncWebServerRequest *request, uint8_t &sensor) {
+    unsigned long index = CONTROL_SENSOR;
+    for (size_t i = 0; i < request->params(); i++) {
+        AsyncWebParameter *param = request->getParam(i);
+        const char *name = param->name().c_str();
+        switch (hashKey(name)) {
+            KEY_CASE(name, "sensor") {
+                const char *value = param->value().c_str();
+                char       *end;
+                index = strtoul(value, &end, 10);
+                // anything but a plain index is invalid
+                if (end == value || *end != '\0' || *value == '-') index = SENSOR_COUNT;
+                break;
+            }
+        }
+    }
+    if (index >= SENSOR_COUNT) return false;
+    sensor = (uint8_t) index;
+    return true;
+}
+
+// Current state of the thermostat
+// --------------------------------
+
+/**
+ * The HTML page (index.html) is a purely static file, which can therefore be
+ * compressed and cached by the browser like the other assets. Once loaded,
+ * the page fetches the values that must be displayed from this route, as a
+ * small JSON document:
+ *
+ * - temp    (the latest temperature of the control sensor, or null)
+ * - min     (factory setting of the minimum temperature)
+ * - max     (factory setting of the maximum temperature)
+ * - lower   (the lower limit of the temperature range set by the operator)
+ * - upper   (the upper limit of the temperature range set by the operator)
+ * - sensors (the latest readings of all the sensors)
+ *
+ * The document is streamed, one sensor at a time.
+ */
+
+struct StateWriter : ChunkedWriter {
+    uint8_t item = 0; // -> 0 for the header, then 1 + index of the sensor
+
+    bool next() override {
+        if (item == 0) {
+            char temp[8];
+            TempSnapshot snapshot = getTempSnapshot();
+            formatJsonValue(snapshot.temperature, hasValidTemperature(snapshot), temp, sizeof(temp));
+
+            portENTER_CRITICAL(&rangeMux);
+            TempRange range = tempRange;
+            portEXIT_CRITICAL(&rangeMux);
+
+            portENTER_CRITICAL(&controlMux);
+            ControlMode mode   = engine.mode();
+            uint16_t    output = engine.output();
+            portEXIT_CRITICAL(&controlMux);
+
+            printf("{\"temp\":%s,\"min\":%.1f,\"max\":%.1f,\"lower\":%.1f,\"upper\":%.1f,\"mode\":\"%s\",\"output\":%u,\"sensors\":[",
+                temp, MIN_TEMP, MAX_TEMP, range.lower, range.upper, CONTROL_MODE_NAMES[(uint8_t) mode], output);
+        } else if (item <= SENSOR_COUNT) {
+            char json[80];
+            formatSensorJson(item - 1, getTempSnapshot(item - 1), json, sizeof(json));
+            if (item > 1) print(',');
+            print(json);
+        } else if (item == SENSOR_COUNT + 1) {
+            print("]}");
+        } else {
+            return false;
+        }
+        item++;
+        return true;
+    }
+};
+
+void onState(AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", StateWriter());
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+}
+
+// Static assets
+// -------------
+
+#ifdef EMBEDDED_ASSETS
+void initStaticAsset(StaticAsset &asset) {
+    for (const EmbeddedFile &file : EMBEDDED_FILES) {
+        if (strcmp(file.path, asset.file) == 0) {
+            asset.data    = file.data;
+            asset.size    = file.size;
+            asset.gzipped = file.gzipped;
+            snprintf(asset.path, sizeof(asset.path), "%s", file.path);
+            snprintf(asset.etag, sizeof(asset.etag), "%s", file.etag);
+            return;
+        }
+    }
+    LOG_ERROR("%s is not embedded in the firmware", asset.file);
+}
+#else
+void initStaticAsset(StaticAsset &asset) {
+    snprintf(asset.path, sizeof(asset.path), "%s.gz", asset.file);
+    asset.gzipped = SPIFFS.exists(asset.path);
+    if (!asset.gzipped) snprintf(asset.path, sizeof(asset.path), "%s", asset.file);
+
+    uint32_t crc  = 0;
+    uint32_t size = 0;
+    File file = SPIFFS.open(asset.path);
+    if (file) {
+        uint8_t buffer[256];
+        size_t  n;
+        while ((n = file.read(buffer, sizeof(buffer))) > 0) {
+            crc   = crc32_le(crc, buffer, n);
+            size += n;
+        }
+        file.close();
+    }
+    snprintf(asset.etag, sizeof(asset.etag), "\"%08x-%x\"", crc, size);
+}
+#endif
+
+/**
+ * If the browser already has the current version of the file,
+ * we simply confirm that it can keep using it.
+ */
+
+void onStaticAsset(AsyncWebServerRequest *request, const StaticAsset &asset) {
+    AsyncWebServerResponse *response;
+
+    if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset.etag) {
+        response = request->beginResponse(304);
+    } else {
+#ifdef EMBEDDED_ASSETS
+        if (!asset.data) {
+            request->send(404);
+            return;
+        }
+        response = request->beginResponse_P(200, asset.mime, asset.data, asset.size);
+#else
+        response = request->beginResponse(SPIFFS, asset.path, asset.mime);
+#endif
+        if (asset.gzipped) response->addHeader("Content-Encoding", "gzip");
+    }
+
+    response->addHeader("Cache-Control", ASSET_CACHE_CONTROL);
+    response->addHeader("ETag", asset.etag);
+    request->send(response);
+}
+
+// Method of fallback in case no request could be resolved
+// -------------------------------------------------------
+
+void onNotFound(AsyncWebServerRequest *request) {
+    request->send(404);
+}
+
+// Sensor temperature reading query manager
+// ----------------------------------------
+
+/**
+ * The sensor is no longer read here: the handler simply returns the latest
+ * reading taken by the sampling task, so that it responds immediately,
+ * whatever the number of clients polling the server.
+ *
+ * The control sensor is used by default, another one can be designated by
+ * its index: `/temp?sensor=1`.
+ *
+ * The response is the one rendered for the latest sample (see
+ * `TempResponse`). A browser which already has it gets a `304 Not Modified`,
+ * and none needs to ask again before the next sample.
+ */
+
+void onTemp(AsyncWebServerRequest *request) {
+    LOG_DEBUG("Received temperature request");
+    uint8_t sensor;
+    if (!parseSensor(request, sensor)) {
+        request->send(404);
+        return;
+    }
+
+    portENTER_CRITICAL(&responseMux);
+    TempResponse cached = tempResponses[sensor];
+    portEXIT_CRITICAL(&responseMux);
+
+    int32_t  left = cached.expires - millis();
+    char     cacheControl[24];
+    snprintf(cacheControl, sizeof(cacheControl), "max-age=%u", left > 0 ? (unsigned) left / 1000 : 0);
+
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == cached.etag) {
+        response = request->beginResponse(304);
+    } else {
+        if (!cached.valid) {
+            LOG_ERROR("** Failed to read from sensor [%s]!", sensors[sensor]->name);
+        } else {
+            LOG_DEBUG("-> Latest [%s] sensor readout: %s°C", sensors[sensor]->name, cached.body);
+        }
+        response = request->beginResponse(200, "text/plain", cached.body);
+    }
+
+    response->addHeader("Cache-Control", cacheControl);
+    response->addHeader("ETag", cached.etag);
+    request->send(response);
+}
+
+// Subscription to the Server-Sent Events stream
+// ---------------------------------------------
+
+/**
+ * A newly connected browser immediately receives the latest readings,
+ * without having to wait for the next sample.
+ */
+
+void onEventsConnect(AsyncEventSourceClient *client) {
+    // the new client is already counted:
+    if (events.count() > EVENTS_MAX_CLIENTS) {
+        metrics.refusedSubscribers++;
+        client->close();
+        return;
+    }
+
+    char data[80];
+    TempSnapshot snapshot = getTempSnapshot();
+    formatTemperature(snapshot, data, sizeof(data));
+    client->send(data, "temperature", snapshot.sequence);
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        snapshot = getTempSnapshot(i);
+        formatSensorJson(i, snapshot, data, sizeof(data));
+        client->send(data, "sensor", snapshot.sequence);
+    }
+}
+
+// History of readings
+// -------------------
+
+/**
+ * The history is streamed directly from the ring buffer, a few samples at a
+ * time, without ever being copied as a whole in memory:
+ *
+ * - `/history` (or `/history?format=bin`) sends the raw samples, packed as
+ *   described above (little endian), from the oldest to the most recent
+ * - `/history?format=csv` sends them as `uptime,temperature,humidity` lines
+ *
+ * The history of the control sensor is sent by default, another one can be
+ * designated by its index: `/history?sensor=1`. The state of the control
+ * loop is sent instead with `/history?series=control` (as `ControlSample`s,
+ * or `uptime,output,mode,relay` lines).
+ *
+ * In both cases, the `X-Uptime` header gives the current uptime in seconds,
+ * which allows the client to convert the uptimes into absolute dates.
+ *
+ * The range of samples to be sent is set when the request is received.
+ * If one of them is overwritten in the meantime (which can only happen to
+ * the oldest ones if the client is very slow), it is sent as unavailable.
+ */
+
+struct HistoryCursor {
+    uint8_t  sensor;
+    bool     control; // -> the samples of the control loop are sent instead
+    uint32_t next;    // -> absolute rank of the next sample to be sent
+    uint32_t end;     // -> absolute rank following the last sample to be sent
+
+    HistoryCursor(uint8_t sensor, bool control) : sensor(sensor), control(control) {
+        end  = getHistoryTotal();
+        next = end > HISTORY_SIZE ? end - HISTORY_SIZE : 0;
+    }
+
+    HistorySample fetch(uint32_t rank) const {
+        HistorySample sample;
+        if (!getHistorySample(sensor, rank, sample)) {
+            sample = { 0, HISTORY_NO_TEMP, HISTORY_NO_HUMIDITY };
+        }
+        return sample;
+    }
+
+    ControlSample fetchControl(uint32_t rank) const {
+        ControlSample sample;
+        if (!getControlSample(rank, sample)) {
+            sample = { 0, 0, HISTORY_NO_MODE, 0 };
+        }
+        return sample;
+    }
+
+    // Raw bytes of a sample, whichever the series:
+    void read(uint32_t rank, uint8_t *record) const {
+        if (control) {
+            ControlSample sample = fetchControl(rank);
+            memcpy(record, &sample, sizeof(sample));
+        } else {
+            HistorySample sample = fetch(rank);
+            memcpy(record, &sample, sizeof(sample));
+        }
+    }
+};
+
+// Binary format: the content length is known in advance,
+// and the library tells us the offset of each chunk to be filled.
+
+struct HistoryBinaryFiller {
+    HistoryCursor cursor;
+
+    HistoryBinaryFiller(uint8_t sensor, bool control) : cursor(sensor, control) {}
+
+    size_t operator()(uint8_t *buffer, size_t maxLen, size_t index) {
+        constexpr size_t size = sizeof(HistorySample);
+        size_t length = 0;
+
+        while (length < maxLen) {
+            uint32_t rank   = cursor.next + (index + length) / size;
+            size_t   offset = (index + length) % size;
+            size_t   count  = min(size - offset, maxLen - length);
+            if (rank >= cursor.end) break;
+            uint8_t record[size];
+            cursor.read(rank, record);
+            memcpy(buffer + length, record + offset, count);
+            length += count;
+        }
+
+        return length;
+    }
+};
+
+// CSV format: one line per item of the writer.
+
+struct HistoryCsvWriter : ChunkedWriter {
+    HistoryCursor cursor;
+    bool          header = true;
+
+    HistoryCsvWriter(uint8_t sensor, bool control) : cursor(sensor, control) {}
+
+    bool next() override {
+        if (header) {
+            header = false;
+            print(cursor.control ? "uptime,output,mode,relay\n" : "uptime,temperature,humidity\n");
+        } else if (cursor.next < cursor.end && cursor.control) {
+            ControlSample sample = cursor.fetchControl(cursor.next++);
+            printf("%u,%u,%s,%u\n", sample.uptime, sample.output,
+                sample.mode == HISTORY_NO_MODE ? "" : CONTROL_MODE_NAMES[sample.mode], sample.relay);
+        } else if (cursor.next < cursor.end) {
+            HistorySample sample = cursor.fetch(cursor.next++);
+            printf("%u,", sample.uptime);
+            if (sample.temperature != HISTORY_NO_TEMP) {
+                int t = sample.temperature;
+                printf("%s%d.%d", t < 0 ? "-" : "", abs(t) / 10, abs(t) % 10);
+            }
+            print(',');
+            if (sample.humidity != HISTORY_NO_HUMIDITY) {
+                printf("%u.%u", sample.humidity / 10, sample.humidity % 10);
+            }
+            print('\n');
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+void onHistory(AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response;
+    uint8_t sensor;
+    bool    csv     = false;
+    bool    control = false;
+
+    if (!parseSensor(request, sensor)) {
+        request->send(404);
+        return;
+    }
+
+    for (size_t i = 0; i < request->params(); i++) {
+        AsyncWebParameter *param = request->getParam(i);
+        const char *name = param->name().c_str();
+        switch (hashKey(name)) {
+            KEY_CASE(name, "format") csv     = strcmp(param->value().c_str(), "csv") == 0;     break;
+            KEY_CASE(name, "series") control = strcmp(param->value().c_str(), "control") == 0; break;
+        }
+    }
+
+    if (csv) {
+        response = request->beginChunkedResponse("text/csv", HistoryCsvWriter(sensor, control));
+    } else {
+        HistoryBinaryFiller filler(sensor, control);
+        size_t length = (filler.cursor.end - filler.cursor.next) * sizeof(HistorySample);
+        response = request->beginResponse("application/octet-stream", length, filler);
+    }
+
+    char uptime[11];
+    snprintf(uptime, sizeof(uptime), "%u", millis() / 1000);
+    response->addHeader("X-Uptime", uptime);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+}
+
+// Metrics
+// -------
+
+/**
+ * The metrics are exported in the Prometheus text format:
+ * - the latency histograms of the HTTP routes (time spent in the handler)
+ * - the duration of the readings of each sensor and the number of failures
+ * - the duration of the settings commits in the flash memory
+ * - the state of the control engine (mode, output, PID terms and gains)
+ * - the state of the heap (fragmentation is what eventually makes it fail)
+ * - the number of clients currently connected
+ * - the time taken by each stage of the startup
+ *
+ * The document is streamed, one line at a time. Each family of metrics is
+ * described by its number of lines (0 to leave it out) and the function
+ * that formats one of them. The lines of a histogram all come from the copy
+ * made when its first line is formatted, so that its buckets add up to its
+ * count; the other values are read as their line is formatted.
+ */
+
+constexpr uint8_t HISTOGRAM_LINES = LATENCY_BUCKETS + 3; // -> buckets, +Inf, sum and count
+
+void printHistogramLine(ChunkedWriter &out, const char *name, const char *labels, const LatencyHistogram &histogram, uint8_t line) {
+    const char *separator = *labels ? "," : "";
+
+    if (line < LATENCY_BUCKETS) {
+        uint32_t cumulated = 0;
+        for (uint8_t i = 0; i <= line; i++) cumulated += histogram.buckets[i];
+        out.printf("%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, separator, LATENCY_BOUNDS[line] / 1e6, cumulated);
+    } else if (line == LATENCY_BUCKETS) {
+        out.printf("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, separator, histogram.count);
+    } else if (line == LATENCY_BUCKETS + 1) {
+        out.printf("%s_sum{%s} %.6f\n", name, labels, histogram.sum / 1e6);
+    } else {
+        out.printf("%s_count{%s} %u\n", name, labels, histogram.count);
+    }
+}
+
+uint16_t oneLine()          { return 1; }
+uint16_t sensorLines()      { return SENSOR_COUNT; }
+uint16_t mqttLines()        { return MQTT_ENABLED ? 1 : 0; }
+uint16_t controlModeLines() { return (uint8_t) ControlMode::Autotune + 1; }
+uint16_t bootStageLines()   { return BOOT_STAGE_COUNT; }
+
+// A time that has not been reached yet is exported as `NaN`:
+
+void printBootSeconds(ChunkedWriter &out, const char *name, uint8_t stage, uint32_t time) {
+    if (stage < BOOT_STAGE_COUNT) out.printf("%s{stage=\"%s\"} ", name, BOOT_STAGE_NAMES[stage]);
+    else                          out.printf("%s ", name);
+
+    if (time > 0) out.printf("%.6f\n", time / 1e6);
+    else          out.print("NaN\n");
+}
+
+struct MetricFamily {
+    const char *name;
+    const char *type;
+    const char *help;
+    uint16_t  (*lines)();
+    // `histogram` is kept by the writer from one line to the next:
+    void      (*format)(ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &histogram);
+};
+
+const MetricFamily METRIC_FAMILIES[] = {
+    { "thermostat_http_request_duration_seconds", "histogram", "Time spent handling HTTP requests.",
+      [] { return (uint16_t) (ROUTE_COUNT * HISTOGRAM_LINES); },
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &histogram) {
+          uint8_t route = line / HISTOGRAM_LINES;
+          char    labels[32];
+          if (line % HISTOGRAM_LINES == 0) histogram = metrics.routes[route];
+          snprintf(labels, sizeof(labels), "route=\"%s\"", ROUTE_NAMES[route]);
+          printHistogramLine(out, name, labels, histogram, line % HISTOGRAM_LINES);
+      } },
+    { "thermostat_sensor_read_duration_seconds", "histogram", "Duration of the sensor readings.",
+      [] { return (uint16_t) (SENSOR_COUNT * HISTOGRAM_LINES); },
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &histogram) {
+          uint8_t sensor = line / HISTOGRAM_LINES;
+          char    labels[32];
+          if (line % HISTOGRAM_LINES == 0) {
+              portENTER_CRITICAL(&metricsMux);
+              histogram = metrics.sensorReads[sensor];
+              portEXIT_CRITICAL(&metricsMux);
+          }
+          snprintf(labels, sizeof(labels), "sensor=\"%s\"", sensors[sensor]->name);
+          printHistogramLine(out, name, labels, histogram, line % HISTOGRAM_LINES);
+      } },
+    { "thermostat_sensor_read_failures_total", "counter", "Number of failed sensor readings.", sensorLines,
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          out.printf("%s{sensor=\"%s\"} %u\n", name, sensors[line]->name, metrics.sensorFailures[line]);
+      } },
+    { "thermostat_sensor_outliers_total", "counter", "Number of readings rejected by the filter.", sensorLines,
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          out.printf("%s{sensor=\"%s\"} %u\n", name, sensors[line]->name, metrics.sensorOutliers[line]);
+      } },
+    { "thermostat_settings_commit_duration_seconds", "histogram", "Duration of the settings writes in flash memory.",
+      [] { return (uint16_t) HISTOGRAM_LINES; },
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &histogram) {
+          if (line == 0) {
+              portENTER_CRITICAL(&metricsMux);
+              histogram = metrics.settingsCommits;
+              portEXIT_CRITICAL(&metricsMux);
+          }
+          printHistogramLine(out, name, "", histogram, line);
+      } },
+    { "thermostat_control_mode", "gauge", "Current mode of the control engine.", controlModeLines,
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          portENTER_CRITICAL(&controlMux);
+          ControlMode mode = engine.mode();
+          portEXIT_CRITICAL(&controlMux);
+          out.printf("%s{mode=\"%s\"} %u\n", name, CONTROL_MODE_NAMES[line], line == (uint8_t) mode);
+      } },
+    { "thermostat_control_output_permille", "gauge", "Cooling demand computed by the control engine.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&controlMux);
+          uint16_t output = engine.output();
+          portEXIT_CRITICAL(&controlMux);
+          out.printf("%s %u\n", name, output);
+      } },
+    { "thermostat_control_setpoint_celsius", "gauge", "Temperature the control engine is aiming at.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&controlMux);
+          int32_t setpoint = engine.setpoint();
+          portEXIT_CRITICAL(&controlMux);
+          out.printf("%s %.2f\n", name, setpoint / 100.0);
+      } },
+    { "thermostat_control_term_permille", "gauge", "Terms of the PID output.",
+      [] { return (uint16_t) 3; },
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          portENTER_CRITICAL(&controlMux);
+          float_t term = line == 0 ? engine.proportional() : line == 1 ? engine.integral() : engine.derivative();
+          portEXIT_CRITICAL(&controlMux);
+          out.printf("%s{term=\"%s\"} %.1f\n", name, CONTROL_TERM_NAMES[line], term);
+      } },
+    { "thermostat_control_gain", "gauge", "Gains of the PID (kp in per mille per °C, ti and td in seconds).",
+      [] { return (uint16_t) 3; },
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          portENTER_CRITICAL(&controlMux);
+          PidGains gains = engine.gains();
+          portEXIT_CRITICAL(&controlMux);
+          switch (line) {
+              case 0: out.printf("%s{gain=\"kp\"} %.2f\n", name, gains.kp); break;
+              case 1: out.printf("%s{gain=\"ti\"} %.1f\n", name, gains.ti); break;
+              case 2: out.printf("%s{gain=\"td\"} %.1f\n", name, gains.td); break;
+          }
+      } },
+    { "thermostat_control_autotune_cycles", "gauge", "Oscillations measured by the running autotune.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&controlMux);
+          uint8_t tuned = engine.tuneProgress();
+          portEXIT_CRITICAL(&controlMux);
+          out.printf("%s %u\n", name, tuned);
+      } },
+    { "thermostat_relay_on", "gauge", "Whether the cooling unit is powered.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, control.relayOn);
+      } },
+    { "thermostat_heap_free_bytes", "gauge", "Free heap.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, ESP.getFreeHeap());
+      } },
+    { "thermostat_heap_largest_free_block_bytes", "gauge", "Largest block that can be allocated.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, (unsigned) heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+      } },
+    { "thermostat_heap_min_free_bytes", "gauge", "Lowest free heap since startup.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, ESP.getMinFreeHeap());
+      } },
+    { "thermostat_log_dropped_total", "counter", "Log messages dropped because the log buffer was full.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, logDropped);
+      } },
+    { "thermostat_journal_events_total", "counter", "Events recorded in the journal since it was formatted.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&journalMux);
+          uint32_t recorded = journalQueue.tail;
+          portEXIT_CRITICAL(&journalMux);
+          out.printf("%s %u\n", name, recorded);
+      } },
+    { "thermostat_journal_dropped_total", "counter", "Events dropped because the journal queue was full.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&journalMux);
+          uint32_t dropped = journalQueue.dropped;
+          portEXIT_CRITICAL(&journalMux);
+          out.printf("%s %u\n", name, dropped);
+      } },
+    { "thermostat_mqtt_published_total", "counter", "MQTT messages handed over to the broker.", mqttLines,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&outboxMux);
+          uint32_t published = mqttOutbox.published;
+          portEXIT_CRITICAL(&outboxMux);
+          out.printf("%s %u\n", name, published);
+      } },
+    { "thermostat_mqtt_dropped_total", "counter", "MQTT messages dropped because the outbox was full.", mqttLines,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&outboxMux);
+          uint32_t dropped = mqttOutbox.dropped;
+          portEXIT_CRITICAL(&outboxMux);
+          out.printf("%s %u\n", name, dropped);
+      } },
+    { "thermostat_mqtt_queued_messages", "gauge", "MQTT messages waiting in the outbox.", mqttLines,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          portENTER_CRITICAL(&outboxMux);
+          uint32_t queued = mqttOutbox.tail - mqttOutbox.head;
+          portEXIT_CRITICAL(&outboxMux);
+          out.printf("%s %u\n", name, queued);
+      } },
+    { "thermostat_http_active_requests", "gauge", "HTTP requests whose connection is still open.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, metrics.activeRequests);
+      } },
+    { "thermostat_http_refused_total", "counter", "HTTP requests and subscriptions refused by the admission control.",
+      [] { return (uint16_t) 3; },
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          switch (line) {
+              case 0: out.printf("%s{reason=\"overload\"} %u\n",   name, metrics.shedRequests);       break;
+              case 1: out.printf("%s{reason=\"rate_limit\"} %u\n", name, metrics.throttledRequests);  break;
+              case 2: out.printf("%s{reason=\"events\"} %u\n",     name, metrics.refusedSubscribers); break;
+          }
+      } },
+    { "thermostat_events_clients", "gauge", "Browsers subscribed to the /events stream.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          out.printf("%s %u\n", name, (unsigned) events.count());
+      } },
+    { "thermostat_boot_stage_start_seconds", "gauge", "Time from the startup to the beginning of each initialization stage.", bootStageLines,
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          printBootSeconds(out, name, line, bootTimings[line].start);
+      } },
+    { "thermostat_boot_stage_duration_seconds", "gauge", "Duration of each initialization stage.", bootStageLines,
+      [](ChunkedWriter &out, const char *name, uint16_t line, LatencyHistogram &) {
+          BootTiming timing = bootTimings[line];
+          printBootSeconds(out, name, line, timing.end > 0 ? timing.end - timing.start : 0);
+      } },
+    { "thermostat_boot_ready_seconds", "gauge", "Time from the startup to the end of the initialization.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          printBootSeconds(out, name, BOOT_STAGE_COUNT, bootReady);
+      } },
+    { "thermostat_boot_wifi_connected_seconds", "gauge", "Time from the startup to the first WiFi connection.", oneLine,
+      [](ChunkedWriter &out, const char *name, uint16_t, LatencyHistogram &) {
+          printBootSeconds(out, name, BOOT_STAGE_COUNT, bootConnected);
+      } }
+};
+
+constexpr uint8_t METRIC_FAMILY_COUNT = sizeof(METRIC_FAMILIES) / sizeof(METRIC_FAMILIES[0]);
+
+struct MetricsWriter : ChunkedWriter {
+    uint8_t          family = 0;
+    int32_t          line   = -1; // -> -1 for the HELP and TYPE lines of the family
+    uint16_t         lines  = 0;
+    LatencyHistogram histogram;
+
+    bool next() override {
+        while (family < METRIC_FAMILY_COUNT) {
+            const MetricFamily &metric = METRIC_FAMILIES[family];
+            if (line == -1) {
+                lines = metric.lines();
+                if (lines > 0) printf("# HELP %s %s\n# TYPE %s %s\n", metric.name, metric.help, metric.name, metric.type);
+            } else if (line < lines) {
+                metric.format(*this, metric.name, line, histogram);
+            }
+            if (++line == lines) {
+                family++;
+                line = -1;
+            }
+            if (lines > 0) return true;
+        }
+        return false;
+    }
+};
+
+void onMetrics(AsyncWebServerRequest *request) {
+    request->send(request->beginChunkedResponse("text/plain; version=0.0.4", MetricsWriter()));
+}
+
+#ifdef PROFILING
+// Latency profiling
+// -----------------
+
+/**
+ * Plain text table of the percentiles (nearest rank) of the latest
+ * `PROFILE_SAMPLES` durations of each probe, in microseconds. The probes are
+ * cleared by `/profile?reset`, which the load-test script calls before each
+ * run. This route is not instrumented, so as not to skew the figures.
+ */
+
+void formatProfileName(uint16_t probe, char *buffer, size_t size) {
+    if (probe < PROFILE_CONNECTIONS) {
+        snprintf(buffer, size, "handler %s", ROUTE_NAMES[probe - PROFILE_HANDLERS]);
+    } else if (probe < PROFILE_SENSORS) {
+        snprintf(buffer, size, "connection %s", ROUTE_NAMES[probe - PROFILE_CONNECTIONS]);
+    } else {
+        snprintf(buffer, size, "sensor %s", sensors[probe - PROFILE_SENSORS]->name);
+    }
+}
+
+uint32_t percentile(const uint32_t sorted[], uint16_t count, uint8_t rank) {
+    return sorted[(count * rank + 99) / 100 - 1];
+}
+
+// One line per probe, sorted when it is formatted.
+
+struct ProfileWriter : ChunkedWriter {
+    int32_t probe = -1; // -> -1 for the header
+
+    bool next() override {
+        // only ever used by the AsyncTCP task, while a line is formatted:
+        static uint32_t sorted[PROFILE_SAMPLES];
+
+        if (probe == -1) {
+            printf("%-32s %8s %8s %8s %8s %8s\n", "probe (us)", "count", "p50", "p90", "p99", "max");
+        } else if (probe < PROFILE_PROBES) {
+            portENTER_CRITICAL(&profileMux);
+            uint32_t count = profile[probe].count;
+            uint16_t n     = min(count, (uint32_t) PROFILE_SAMPLES);
+            memcpy(sorted, profile[probe].samples, n * sizeof(uint32_t));
+            portEXIT_CRITICAL(&profileMux);
+
+            if (n > 0) {
+                char name[40];
+                std::sort(sorted, sorted + n);
+                formatProfileName(probe, name, sizeof(name));
+                printf("%-32s %8u %8u %8u %8u %8u\n", name, count,
+                    percentile(sorted, n, 50), percentile(sorted, n, 90), percentile(sorted, n, 99), sorted[n - 1]);
+            }
+        } else {
+            return false;
+        }
+        probe++;
+        return true;
+    }
+};
+
+void onProfile(AsyncWebServerRequest *request) {
+    if (request->hasParam("reset")) {
+        portENTER_CRITICAL(&profileMux);
+        memset(profile, 0, sizeof(profile));
+        portEXIT_CRITICAL(&profileMux);
+        request->send(204);
+        return;
+    }
+
+    request->send(request->beginChunkedResponse("text/plain", ProfileWriter()));
+}
+#endif
+
+// Admission control
+// -----------------
+
+/**
+ * Returns 0 if the tokens could be taken, or else the number of seconds
+ * after which they will be available. A new address takes the bucket of the
+ * one that has been idle for the longest time, and starts with a full one.
+ */
+
+uint32_t takeTokens(uint32_t address, uint8_t cost) {
+    uint32_t     now    = millis();
+    TokenBucket *bucket = &tokenBuckets[0];
+
+    for (TokenBucket &candidate : tokenBuckets) {
+        if (candidate.address == address) {
+            bucket = &candidate;
+            break;
+        }
+        if (now - candidate.updated > now - bucket->updated) bucket = &candidate;
+    }
+
+    if (bucket->address != address) {
+        *bucket = { address, RATE_LIMIT_BURST * 1000u, now };
+    } else {
+        uint32_t idle   = min(now - bucket->updated, RATE_LIMIT_BURST * 1000u / RATE_LIMIT_RATE);
+        bucket->tokens  = min(bucket->tokens + idle * RATE_LIMIT_RATE, RATE_LIMIT_BURST * 1000u);
+        bucket->updated = now;
+    }
+
+    uint32_t needed = cost * 1000u;
+    if (bucket->tokens >= needed) {
+        bucket->tokens -= needed;
+        return 0;
+    }
+    return (needed - bucket->tokens + RATE_LIMIT_RATE * 1000u - 1) / (RATE_LIMIT_RATE * 1000u);
+}
+
+void refuseRequest(AsyncWebServerRequest *request, int code, uint32_t retryAfter) {
+    char seconds[12];
+    snprintf(seconds, sizeof(seconds), "%u", retryAfter);
+    AsyncWebServerResponse *response = request->beginResponse(code);
+    response->addHeader("Retry-After", seconds);
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
+bool admitRequest(AsyncWebServerRequest *request, Route route) {
+    RouteClass type = ROUTE_CLASSES[route];
+
+    uint32_t wait = takeTokens(request->client()->remoteIP(), type == ROUTE_COMMAND ? RATE_LIMIT_COMMAND : 1);
+    if (wait) {
+        metrics.throttledRequests++;
+        refuseRequest(request, 429, wait);
+        return false;
+    }
+
+    uint8_t limit = type == ROUTE_BULK ? ADMISSION_MAX_BULK : type == ROUTE_READING ? ADMISSION_MAX_READINGS : ADMISSION_MAX_COMMANDS;
+    bool    heap  = type == ROUTE_COMMAND || ESP.getFreeHeap() >= ADMISSION_MIN_HEAP;
+    if (metrics.activeRequests >= limit || !heap) {
+        metrics.shedRequests++;
+        refuseRequest(request, 503, ADMISSION_RETRY_AFTER);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * The verdict given to the first chunk of a body holds for the whole
+ * request, whose request handler must not answer it a second time. A request
+ * that has not been tracked is left to its request handler.
+ *
+ * When no slot is free, the request is refused at once, and the refusal is
+ * recorded in the request itself: its `_tempObject` points to `bodyRefused`
+ * until the disconnection, whose callback runs before the library frees it.
+ */
+
+BodyAdmission *findBodyAdmission(AsyncWebServerRequest *request) {
+    for (BodyAdmission &admission : bodyAdmissions) {
+        if (admission.request == request) return &admission;
+    }
+    return NULL;
+}
+
+void forgetBodyAdmission(AsyncWebServerRequest *request) {
+    BodyAdmission *admission = findBodyAdmission(request);
+    if (admission) admission->request = NULL;
+}
+
+bool admitBody(AsyncWebServerRequest *request, Route route, size_t index) {
+    BodyAdmission *admission = findBodyAdmission(request);
+    if (admission) return admission->admitted;
+
+    if (request->_tempObject == &bodyRefused) return false;
+
+    admission = index == 0 ? findBodyAdmission(NULL) : NULL;
+    if (!admission) {
+        metrics.shedRequests++;
+        refuseRequest(request, 503, ADMISSION_RETRY_AFTER);
+        request->_tempObject = &bodyRefused;
+        request->onDisconnect([request]() { request->_tempObject = NULL; });
+        return false;
+    }
+
+    *admission = { request, admitRequest(request, route) };
+    request->onDisconnect([request]() { forgetBodyAdmission(request); });
+    return admission->admitted;
+}
+
+// Instrumentation of the request handlers
+// ---------------------------------------
+
+/**
+ * Each handler is wrapped so as to measure the time spent in it and to count
+ * the requests whose connection is still open (the library closes the
+ * connection once the response has been sent). The refused requests are
+ * neither counted nor measured.
+ */
+
+ArRequestHandlerFunction instrument(Route route, ArRequestHandlerFunction handler) {
+    return [route, handler](AsyncWebServerRequest *request) {
+        BodyAdmission *admission = findBodyAdmission(request);
+        bool           admitted  = admission ? admission->admitted
+                                 : request->_tempObject != &bodyRefused && admitRequest(request, route);
+        if (admission) admission->request = NULL;
+        if (!admitted) return;
+
+        uint32_t start = micros();
+        metrics.activeRequests++;
+        request->onDisconnect([route, start]() {
+            metrics.activeRequests--;
+            recordProfile(PROFILE_CONNECTIONS + route, micros() - start);
+        });
+        handler(request);
+        uint32_t duration = micros() - start;
+        observeLatency(metrics.routes[route], duration);
+        recordProfile(PROFILE_HANDLERS + route, duration);
+    };
+}
+
+ArBodyHandlerFunction instrumentBody(Route route, ArBodyHandlerFunction handler) {
+    return [route, handler](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        if (admitBody(request, route, index)) handler(request, data, len, index, total);
+    };
+}
+
+ArUploadHandlerFunction instrumentUpload(Route route, ArUploadHandlerFunction handler) {
+    return [route, handler](AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+        if (admitBody(request, route, index)) handler(request, filename, index, data, len, final);
+    };
+}
+
+// Factory reset
+// -------------
+
+void onReset(AsyncWebServerRequest *request) {
+    resetTempRange();
+    logEvent(JournalEvent::Reset);
+
+    portENTER_CRITICAL(&rangeMux);
+    TempRange range = tempRange;
+    portEXIT_CRITICAL(&rangeMux);
+
+    LOG_INFO("Factory reset");
+    LOG_INFO("-> Temperature range is set to [ %.1f°C , %.1f°C ]", range.lower, range.upper);
+
+    // Requests are asynchronous and must always be resolved:
+    request->send(200);
+}
+
+// ESP32 restart request manager
+// -----------------------------
+
+void reboot() {
+    // pending changes must not be lost:
+    logEvent(JournalEvent::Reboot);
+    commitSettings();
+    flushJournal(true);
+
+    LOG_INFO("%s", CLOSING);
+    LOG_INFO("Rebooting...");
+    flushLog();
+    ESP.restart();
+}
+
+void onReboot(AsyncWebServerRequest *request) {
+    // Requests are asynchronous and must always be resolved:
+    request->send(200);
+    reboot();
+}
+
+// Batch configuration
+// -------------------
+
+/**
+ * `POST /config` applies several settings in a single round trip, either as
+ * a flat JSON object (`Content-Type: application/json`):
+ *
+ *     {"lower": 12.5, "upper": 18, "reboot": true}
+ *
+ * or as a form (`lower=12.5&upper=18&reboot=true`), which the web server
+ * library already parses into parameters. The recognized keys are listed
+ * with `ConfigParser` (lib/thermostat); the temperature range must lie
+ * within [ MIN_TEMP , MAX_TEMP ] (and so must the ranges of the schedule
+ * rules), and the gains within [ 0 , PID_MAX_KP ] and [ 0 , PID_MAX_TIME ].
+ *
+ * Nothing is applied unless the whole document is valid. The new settings
+ * are then applied at once, and stored by the persistence task (like the
+ * range of `/savethresholds`, which goes through the same routine): writing
+ * the flash memory would otherwise stall the
+ * callback (of the web server, or of the MQTT client) for the whole commit.
+ * Only a `reboot` waits for the commit, which `reboot()` makes itself, once
+ * the response (the `/state` document) has been delivered.
+ */
+
+/**
+ * The resulting range is computed and checked inside the critical section,
+ * so that it cannot be mixed with a concurrent change. Returns the reason
+ * why the update is rejected, or NULL once it is applied.
+ */
+
+const char *applyConfig(const ConfigUpdate &update) {
+    // (NAN, for a gain not provided, is never out of bounds)
+    const PidGains &gains = update.gains;
+    if (gains.kp < 0 || gains.kp > PID_MAX_KP)   return "gains out of bounds";
+    if (gains.ti < 0 || gains.ti > PID_MAX_TIME) return "gains out of bounds";
+    if (gains.td < 0 || gains.td > PID_MAX_TIME) return "gains out of bounds";
+
+    for (uint8_t i = 0; i < SCHEDULE_MAX_RULES; i++) {
+        const ScheduleRule &rule = update.rules[i];
+        bool inside = rule.days == 0 || (MIN_TEMP * 10 <= rule.lower && rule.upper <= MAX_TEMP * 10);
+        if (update.rulesSet & 1 << i && !inside) return "schedule range out of bounds";
+    }
+
+    portENTER_CRITICAL(&rangeMux);
+    TempRange range = update.reset ? TempRange{ false, MIN_TEMP, MAX_TEMP } : tempRange;
+    if (!isnan(update.lower)) range.lower = update.lower;
+    if (!isnan(update.upper)) range.upper = update.upper;
+    if (!isnan(update.lower) || !isnan(update.upper)) range.initialized = true;
+    bool valid = !setsTempRange(update) || isValidTempRange(range.lower, range.upper, MIN_TEMP, MAX_TEMP);
+    if (valid) tempRange = range;
+    portEXIT_CRITICAL(&rangeMux);
+
+    if (!valid) return "temperature range out of bounds";
+
+    portENTER_CRITICAL(&controlMux);
+    PidGains current = engine.gains();
+    if (!isnan(gains.kp)) current.kp = gains.kp;
+    if (!isnan(gains.ti)) current.ti = gains.ti;
+    if (!isnan(gains.td)) current.td = gains.td;
+    engine.setGains(current);
+    if (update.hasMode) engine.setMode(update.mode, millis());
+    ControlMode mode = engine.mode();
+    portEXIT_CRITICAL(&controlMux);
+
+    if (update.hasSchedule || update.rulesSet) {
+        portENTER_CRITICAL(&scheduleMux);
+        if (update.hasSchedule) schedule.enabled = update.schedule;
+        for (uint8_t i = 0; i < SCHEDULE_MAX_RULES; i++) {
+            if (update.rulesSet & 1 << i) schedule.rules[i] = update.rules[i];
+        }
+        scheduler.invalidate(); // -> the rule in force is applied at the next sample
+        portEXIT_CRITICAL(&scheduleMux);
+    }
+
+    LOG_INFO("Configuration received: [ %.1f°C , %.1f°C ], %s", range.lower, range.upper, CONTROL_MODE_NAMES[(uint8_t) mode]);
+    xTaskNotifyGive(persister);
+    LOG_INFO("-> Will be stored in flash memory");
+    return NULL;
+}
+
+void sendConfigError(AsyncWebServerRequest *request, const char *error) {
+    char json[64];
+    snprintf(json, sizeof(json), "{\"error\":\"%s\"}", error);
+    request->send(400, "application/json", json);
+}
+
+/**
+ * The JSON parser is attached to the request by the body handler (the
+ * library frees `_tempObject` along with the request, the parser has nothing
+ * else to release). The request handler is only called once the whole body
+ * has been received.
+ */
+
+void onConfigBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (index == 0 && total <= CONFIG_MAX_BODY) {
+        void *memory = malloc(sizeof(ConfigParser));
+        if (memory) request->_tempObject = new (memory) ConfigParser();
+    }
+    ConfigParser *parser = static_cast<ConfigParser*>(request->_tempObject);
+    if (parser) parser->feed(data, len);
+}
+
+void onConfig(AsyncWebServerRequest *request) {
+    ConfigParser *parser = static_cast<ConfigParser*>(request->_tempObject);
+    ConfigUpdate  form   = EMPTY_CONFIG_UPDATE;
+    ConfigUpdate *update = &form;
+
+    if (parser) {
+        update = &parser->finish();
+    } else if (request->contentLength() > 0 && request->params() == 0) {
+        // the body handler did not keep it
+        sendConfigError(request, "document too large");
+        return;
+    } else {
+        for (size_t i = 0; i < request->params(); i++) {
+            AsyncWebParameter *param = request->getParam(i);
+            const char *name = param->name().c_str();
+            if (param->isPost()) setConfigField(form, hashKey(name), name, param->value().c_str());
+        }
+    }
+
+    const char *error = update->error;
+    if (!error) error = applyConfig(*update);
+
+    if (error) {
+        sendConfigError(request, error);
+    } else {
+        // the restart waits for the response to be delivered:
+        if (update->reboot) request->onDisconnect(reboot);
+        onState(request);
+    }
+}
+
+// Manager for queries to define the temperature range set by the operator
+// -----------------------------------------------------------------------
+
+void onSaveThresholds(AsyncWebServerRequest *request) {
+    float_t lower = NAN;
+    float_t upper = NAN;
+
+    for (size_t i = 0; i < request->params(); i++) {
+        AsyncWebParameter *param = request->getParam(i);
+        const char *name = param->name().c_str();
+        switch (hashKey(name)) {
+            KEY_CASE(name, "lower") lower = parseFloat(param); break;
+            KEY_CASE(name, "upper") upper = parseFloat(param); break;
+        }
+    }
+
+    if (isnan(lower) || isnan(upper)) {
+        // Requests are asynchronous and must always be resolved:
+        request->send(200);
+        return;
+    }
+
+    LOG_INFO("Temperature range received: [ %.1f°C , %.1f°C ]", lower, upper);
+
+    // checked and stored like a `/config` document
+    ConfigUpdate update = EMPTY_CONFIG_UPDATE;
+    update.lower = lower;
+    update.upper = upper;
+    const char *error = applyConfig(update);
+
+    if (error) sendConfigError(request, error);
+    else       request->send(200);
+}
+
+// Schedule
+// --------
+
+/**
+ * `GET /schedule` describes the schedule, with the rules in the format of
+ * `/config` (null for the empty slots):
+ *
+ *     {"enabled":true,"clock":"2026-10-14 07:42","active":0,"next":"2026-10-14 19:00",
+ *      "rules":["12345 07:30 12.0 14.0",null,...]}
+ *
+ * The times are local, and null until the clock is set. `next` is the next
+ * transition (or the next evaluation, if none is scheduled within a week).
+ */
+
+void formatLocalMinutes(uint32_t minutes, char *buffer, size_t size) {
+    int      year;
+    unsigned month, day;
+    civilDate(minutes / (24 * 60), year, month, day);
+    snprintf(buffer, size, "\"%04d-%02u-%02u %02u:%02u\"", year, month, day, minutes / 60 % 24, minutes % 60);
+}
+
+// The table is copied when the request is received, and then streamed
+// one rule at a time.
+
+struct ScheduleWriter : ChunkedWriter {
+    ScheduleTable table;
+    int8_t        active;
+    uint32_t      transition;
+    int8_t        item = -1; // -> -1 for the header, then index of the rule
+
+    ScheduleWriter() {
+        portENTER_CRITICAL(&scheduleMux);
+        table      = schedule;
+        active     = scheduler.active();
+        transition = scheduler.nextTransition();
+        portEXIT_CRITICAL(&scheduleMux);
+    }
+
+    bool next() override {
+        if (item == -1) {
+            char     clock[24] = "null";
+            char     next[24]  = "null";
+            char     rule[8]   = "null";
+            uint32_t now;
+            if (getLocalMinutes(now)) {
+                formatLocalMinutes(now, clock, sizeof(clock));
+                if (table.enabled) formatLocalMinutes(transition, next, sizeof(next));
+                if (table.enabled && active >= 0) snprintf(rule, sizeof(rule), "%d", active);
+            }
+            printf("{\"enabled\":%s,\"clock\":%s,\"active\":%s,\"next\":%s,\"rules\":[",
+                table.enabled ? "true" : "false", clock, rule, next);
+        } else if (item < SCHEDULE_MAX_RULES) {
+            if (item > 0) print(',');
+            if (table.rules[item].days == 0) {
+                print("null");
+            } else {
+                char text[SCHEDULE_RULE_SIZE + 1];
+                formatScheduleRule(table.rules[item], text, sizeof(text));
+                printf("\"%s\"", text);
+            }
+        } else if (item == SCHEDULE_MAX_RULES) {
+            print("]}");
+        } else {
+            return false;
+        }
+        item++;
+        return true;
+    }
+};
+
+void onSchedule(AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", ScheduleWriter());
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+}
 
-// Serial monitor
-// --------------
+// Event journal
+// -------------
 
-constexpr char PREAMBLE[] = R"PREAMBLE(
+/**
+ * `GET /events/log` serves the journal one page of `JOURNAL_PAGE_SIZE`
+ * events at a time, the most recent first:
+ *
+ *     {"first":0,"end":57,"page":0,"pages":2,"events":[
+ *      {"seq":56,"time":1760427720,"uptime":5392,"event":"excursion","zone":"high","temp":14.6,"limit":14.0},...]}
+ *
+ * - `page` (0 by default) designates the page
+ * - `before` anchors the pages on a sequence (the end of the journal by
+ *   default): passing on the `end` of the first page keeps the next ones
+ *   from shifting while new events are recorded
+ *
+ * `time` is null for the events recorded before the clock was set, whose
+ * `uptime` is then the only reference. The events that can no longer be
+ * read (overwritten, or damaged) are left out.
+ */
 
--------------------------------
-ESP32 Web Controlled Thermostat
--------------------------------
-   © 2020 Stéphane Calderoni
--------------------------------
+void printEventDetails(ChunkedWriter &out, const JournalRecord &record) {
+    char value[8];
+    char extra[8];
+    formatJsonValue(record.value / 10.0f, record.value != INT16_MIN, value, sizeof(value));
+    formatJsonValue(record.extra / 10.0f, record.extra != INT16_MIN, extra, sizeof(extra));
 
--------------------------------
-     Initialization process
--------------------------------
-)PREAMBLE";
+    switch ((JournalEvent) record.type) {
+        case JournalEvent::Boot:
+            out.printf(",\"reason\":\"%s\"",
+                record.source < sizeof(RESET_REASON_NAMES) / sizeof(RESET_REASON_NAMES[0]) ? RESET_REASON_NAMES[record.source] : "unknown");
+            break;
+        case JournalEvent::Excursion:
+            out.printf(",\"zone\":\"%s\",\"temp\":%s,\"limit\":%s", ZONE_NAMES[min(record.source, (uint8_t) TempZone::High)], value, extra);
+            break;
+        case JournalEvent::SensorFailure:
+        case JournalEvent::SensorRecovery:
+            out.printf(",\"sensor\":\"%s\",\"temp\":%s", record.source < SENSOR_COUNT ? sensors[record.source]->name : "", value);
+            break;
+        case JournalEvent::RangeChanged:
+            out.printf(",\"lower\":%s,\"upper\":%s,\"factory\":%s", value, extra, record.source ? "false" : "true");
+            break;
+        case JournalEvent::ControlChanged:
+            out.printf(",\"mode\":\"%s\",\"kp\":%s",
+                CONTROL_MODE_NAMES[min(record.source, (uint8_t) ControlMode::Autotune)], value);
+            break;
+        case JournalEvent::ScheduleChanged:
+            out.printf(",\"enabled\":%s,\"rules\":%u", record.value > 0 ? "true" : "false", record.source);
+            break;
+        default:
+            break;
+    }
+}
 
-constexpr char CLOSING[] = "\n-------------------------------\n";
+struct EventLogWriter : ChunkedWriter {
+    uint32_t first;    // -> oldest event kept
+    uint32_t end;      // -> sequence following the most recent event
+    uint32_t page;
+    uint32_t from;     // -> events of the page
+    uint32_t to;
+    uint32_t cursor;   // -> the events are sent backwards, from `to` to `from`
+    bool     header  = true;
+    bool     started = false; // -> whether an event has been sent
+    bool     closed  = false;
 
-// ----------------------------------------------------------------------------
-// Global variables
-// ----------------------------------------------------------------------------
+    bool next() override {
+        if (header) {
+            header = false;
+            uint32_t pages = (end - first + JOURNAL_PAGE_SIZE - 1) / JOURNAL_PAGE_SIZE;
+            printf("{\"first\":%u,\"end\":%u,\"page\":%u,\"pages\":%u,\"events\":[", first, end, page, pages);
+            return true;
+        }
 
-// Temperature range supported by the thermostat
-// ---------------------------------------------
+        JournalRecord record;
+        while (cursor > from) {
+            if (!readEvent(--cursor, record)) continue;
+            if (started) print(',');
+            started = true;
+            printf("{\"seq\":%u,\"time\":", record.sequence);
+            if (record.time == 0) print("null"); else printf("%u", record.time);
+            printf(",\"uptime\":%u,\"event\":\"%s\"", record.uptime,
+                record.type < JOURNAL_EVENT_COUNT ? JOURNAL_EVENT_NAMES[record.type] : "unknown");
+            printEventDetails(*this, record);
+            print('}');
+            return true;
+        }
 
-struct TempRange {
-    bool    initialized;
-    float_t lower;
-    float_t upper;
+        if (closed) return false;
+        closed = true;
+        print("]}");
+        return true;
+    }
 };
 
-TempRange tempRange;
+void onEventLog(AsyncWebServerRequest *request) {
+    if (!journal.ready()) {
+        request->send(503);
+        return;
+    }
 
-// Temperature sensor reading parameters
-// -------------------------------------
+    EventLogWriter writer;
+    portENTER_CRITICAL(&journalMux);
+    writer.end = journalQueue.tail;
+    portEXIT_CRITICAL(&journalMux);
+    writer.first = journal.first();
+    writer.page  = 0;
 
-bool readingTemperature; // -> DHT11 LED indicator
-uint32_t startRead;      // -> start time of reading
+    uint32_t before = writer.end;
+    for (size_t i = 0; i < request->params(); i++) {
+        AsyncWebParameter *param = request->getParam(i);
+        const char *name = param->name().c_str();
+        switch (hashKey(name)) {
+            KEY_CASE(name, "page")   writer.page = strtoul(param->value().c_str(), NULL, 10); break;
+            KEY_CASE(name, "before") before      = strtoul(param->value().c_str(), NULL, 10); break;
+        }
+    }
 
-// Firmware operating modules
-// --------------------------
+    before = constrain(before, writer.first, writer.end);
 
-DHT dht(DHT_PIN, DHT_TYPE);       // -> DHT11 temperature sensor
-AsyncWebServer server(HTTP_PORT); // -> Web server
+    uint32_t skipped = min(writer.page * (uint32_t) JOURNAL_PAGE_SIZE, before - writer.first);
+    writer.to        = before - skipped;
+    writer.from      = writer.to - min(writer.to - writer.first, (uint32_t) JOURNAL_PAGE_SIZE);
+    writer.cursor    = writer.to;
 
-// ----------------------------------------------------------------------------
-// Initialization procedures
-// ----------------------------------------------------------------------------
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", writer);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+}
 
-// Serial monitor initialization
-// -----------------------------
+// Over-the-air updates
+// --------------------
 
-void initSerial() {
-    Serial.begin(115200);
-    delay(500);
-    Serial.println(PREAMBLE);
+/**
+ * `POST /update` takes the image as a multipart upload, with Digest (or
+ * Basic) authentication:
+ *
+ *     curl --digest -u admin:thermostat -F image=@firmware.bin \
+ *          "http://thermostat-xxxxxx.local/update?md5=$(md5sum firmware.bin | cut -c1-32)"
+ *
+ * - `target=firmware` (default) or `target=filesystem` for the SPIFFS image
+ * - `md5`, if provided, is checked against the whole image before it is
+ *   activated
+ *
+ * The library calls the upload handler for each chunk received, in the
+ * AsyncTCP task, which writes it at once into the inactive OTA partition (or
+ * the SPIFFS one): the image is never held in memory, and the other
+ * requests keep being served in between (except the SPIFFS assets during a
+ * filesystem update). A single update may run at a time, and the device
+ * restarts once the response has been sent. A firmware that fails to be
+ * written leaves the current one untouched, whereas a failed filesystem
+ * update must be retried.
+ */
+
+void abortUpdate(const char *reason) {
+    Update.abort();
+    otaUpload.request = NULL;
+    LOG_ERROR("Update aborted: %s", reason);
 }
 
-// LED indicator initialization
-// ----------------------------
+void onUpdateUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+    if (index == 0) {
+        // otherwise, the request is rejected by `onUpdate()`:
+        if (otaUpload.request || !request->authenticate(OTA_USER, OTA_PASS)) return;
 
-void initLEDs() {
-    pinMode(INIT_LED, OUTPUT);
-    pinMode(TEMP_LED, OUTPUT);
-    readingTemperature = false;
-    startRead = 0;
-    Serial.println(F("1. LED indicators activated"));
-}
+        bool filesystem = request->hasParam("target") && request->getParam("target")->value() == "filesystem";
+        otaUpload = { request, filesystem ? U_SPIFFS : U_FLASH, 0, millis(), NULL };
+        request->onDisconnect([request]() {
+            forgetBodyAdmission(request); // -> replaces the handler set by `admitBody()`
+            if (otaUpload.request == request) abortUpdate("connection lost");
+        });
 
-// EEPROM initialization
-// ---------------------
+        // the volume must not be written while the image replaces it:
+        if (filesystem) SPIFFS.end();
 
-void initEEPROM() {
-    Serial.print(F("2. Initializing EEPROM... "));
-    if (EEPROM.begin(EEPROM_SIZE)) {
-        // display of the values currently stored in the EEPROM
-        Serial.print(F("done\n   -> [ "));
-        uint8_t e1 = EEPROM.readByte(ADDR_INIT_FLAG);
-        float_t e2 = EEPROM.readFloat(ADDR_MIN_TEMP);
-        float_t e3 = EEPROM.readFloat(ADDR_MAX_TEMP);
-        Serial.printf("0x%02x => %u | 0x%02x => %.1f | 0x%02x => %.1f ]\n", ADDR_INIT_FLAG, e1, ADDR_MIN_TEMP, e2, ADDR_MAX_TEMP, e3);
-    } else {
-        Serial.println("error!");
+        if (!Update.begin(UPDATE_SIZE_UNKNOWN, otaUpload.command)) {
+            otaUpload.error = "cannot start the update";
+        } else if (request->hasParam("md5") && !Update.setMD5(request->getParam("md5")->value().c_str())) {
+            otaUpload.error = "invalid MD5 hash";
+        } else {
+            LOG_INFO("Update of the %s started", filesystem ? "filesystem" : "firmware");
+        }
     }
-}
 
-void initTempRange() {
-    // the temperature range stored in the EEPROM is read out
-    float_t minTemp = EEPROM.readFloat(ADDR_MIN_TEMP);
-    float_t maxTemp = EEPROM.readFloat(ADDR_MAX_TEMP);
-    // whether these values are to be taken into account
-    // (only if they have already been stored in the EEPROM at least once)
-    tempRange.initialized = EEPROM.readByte(ADDR_INIT_FLAG) == INIT_FLAG;
-    // the temperature range to be taken over by the thermostat is deduced from this:
-    tempRange.lower = tempRange.initialized ? minTemp : MIN_TEMP;
-    tempRange.upper = tempRange.initialized ? maxTemp : MAX_TEMP;
-    Serial.print(F("3. Temperature range set to "));
-    Serial.printf("[ %.1f°C , %.1f°C ]\n", tempRange.lower, tempRange.upper);
-}
+    if (otaUpload.request != request || otaUpload.error) return;
 
-// DHT11 temperature sensor initialization
-// ---------------------------------------
+    if (Update.write(data, len) != len) {
+        otaUpload.error = "flash write failed";
+        return;
+    }
+    otaUpload.written += len;
 
-void initTempSensor() {
-    dht.begin();
-    Serial.println(F("4. DHT11 temperature sensor activated"));
+    if (final && !Update.end(true)) {
+        otaUpload.error = Update.getError() == UPDATE_ERROR_MD5 ? "MD5 hash mismatch" : "invalid image";
+    }
 }
 
-// SPIFFS initialization
-// ---------------------
+void sendUpdateError(AsyncWebServerRequest *request, int code, const char *error) {
+    char json[64];
+    snprintf(json, sizeof(json), "{\"error\":\"%s\"}", error);
+    request->send(code, "application/json", json);
+}
 
-/**
- * The web user interface will be stored on the ESP32 Flash memory file system
- * as 5 separate files :
- * - index.html  (the interface structure)
- * - index.css   (the graphical layout of the interface)
- * - index.js    (the dynamic interface management program)
- * - D7MR.woff2  (the font used for numeric displays)
- * - favicon.ico (the tiny icon for the browser)
- */
+void onUpdate(AsyncWebServerRequest *request) {
+    if (!request->authenticate(OTA_USER, OTA_PASS)) {
+        request->requestAuthentication();
+        return;
+    }
 
-void initSPIFFS() {
-    if (!SPIFFS.begin()) {
-        Serial.println(F("Cannot mount SPIFFS volume..."));
-        while(1) digitalWrite(INIT_LED, millis() % 200 < 20 ? HIGH : LOW);
+    if (otaUpload.request != request) {
+        if (otaUpload.request) sendUpdateError(request, 409, "another update is in progress");
+        else sendUpdateError(request, 400, "no image received");
+        return;
+    }
+
+    if (otaUpload.error) {
+        abortUpdate(otaUpload.error);
+        sendUpdateError(request, 500, otaUpload.error);
+        return;
+    }
+
+    LOG_INFO("-> %u bytes written in %u ms", (unsigned) otaUpload.written, millis() - otaUpload.start);
+    if (otaUpload.command == U_FLASH) {
+        // the new firmware is on probation from its first boot:
+        xSemaphoreTake(settingsLock, portMAX_DELAY);
+        preferences.putUChar(OTA_BOOTS_KEY, 1);
+        xSemaphoreGive(settingsLock);
     }
-    Serial.println(F("5. SPIFFS volume is mounted"));
+    otaUpload.request = NULL;
+
+    // the restart waits for the response to be delivered:
+    request->onDisconnect(reboot);
+    request->send(200, "application/json", "{\"status\":\"updated\"}");
 }
 
-// WiFi connection initialization
-// ------------------------------
+// Definition of request handlers and server initialization
+// --------------------------------------------------------
 
 /**
- * A connection to the ambient WiFi network is required here to be able to
- * interact with an operator (who will access ESP32 through a web browser).
+ * This is where we will define the HTTP routes of the application,
+ * as well as the handlers associated with each route.
  */
 
-void initWiFi() {
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(WIFI_SSID, WIFI_PASS);
-    Serial.printf("6. Trying to connect to [%s] network ", WIFI_SSID);
-    while (WiFi.status() != WL_CONNECTED) {
-        Serial.print('.');
-        delay(1000);
+void initWebServer() {
+
+    // Routes that simply return one of the files present on SPIFFS, or
+    // embedded in the firmware (including the root page, which no longer
+    // needs any processing):
+
+    for (StaticAsset &asset : assets) {
+        initStaticAsset(asset);
+        Route route = strcmp(asset.url, "/") == 0 ? ROUTE_ROOT : ROUTE_STATIC;
+        server.on(asset.url, HTTP_GET, instrument(route, [&asset](AsyncWebServerRequest *request) {
+            onStaticAsset(request, asset);
+        }));
     }
-    Serial.printf("\n7. Connected! => %s\n", WiFi.localIP().toString().c_str());
+
+    server.onNotFound(onNotFound);
+
+    // Routes that correspond to dynamic processing by the microcontroller:
+
+    server.on("/state",          instrument(ROUTE_STATE,           onState));
+    server.on("/temp",           instrument(ROUTE_TEMP,            onTemp));
+    server.on("/reset",          instrument(ROUTE_RESET,           onReset));
+    server.on("/reboot",         instrument(ROUTE_REBOOT,          onReboot));
+    server.on("/savethresholds", instrument(ROUTE_SAVE_THRESHOLDS, onSaveThresholds));
+    server.on("/history",        instrument(ROUTE_HISTORY,         onHistory));
+    server.on("/metrics",        instrument(ROUTE_METRICS,         onMetrics));
+    server.on("/config", HTTP_POST, instrument(ROUTE_CONFIG, onConfig), NULL, instrumentBody(ROUTE_CONFIG, onConfigBody));
+    server.on("/update", HTTP_POST, instrument(ROUTE_UPDATE, onUpdate), instrumentUpload(ROUTE_UPDATE, onUpdateUpload));
+    server.on("/schedule", HTTP_GET, instrument(ROUTE_SCHEDULE, onSchedule));
+    server.on("/events/log", HTTP_GET, instrument(ROUTE_EVENTS_LOG, onEventLog));
+
+#ifdef PROFILING
+    server.on("/profile", HTTP_GET, onProfile);
+    LOG_INFO("-> Profiling mode: percentiles served on /profile");
+#endif
+
+    // Stream on which each new reading is pushed to the browsers:
+
+    events.onConnect(onEventsConnect);
+    server.addHandler(&events);
+    startBroadcaster();
+
+    // Server initialization
+
+    server.begin();
+    LOG_INFO("8. Web server started");
 }
 
 // ----------------------------------------------------------------------------
-// Temperature handling
+// MQTT client
 // ----------------------------------------------------------------------------
 
-// Sensor reading
-// --------------
+// Callbacks of the client (called by the AsyncTCP task)
+// -----------------------------------------------------
+
+void onMqttConnect(bool sessionPresent) {
+    mqtt.publish(mqttStatusTopic, 1, true, "online");
+    mqtt.subscribe(mqttConfigTopic, 1);
+    LOG_INFO("-> MQTT broker connected");
+    xTaskNotifyGive(mqttPublisher);
+}
 
 /**
- * A temperature reading on the sensor will trigger a flash of the LED indicator.
- * It is therefore necessary to store the instant of this reading, in order to
- * later determine when the LED should turn off.
+ * The messages waiting for their acknowledgement will be published again
+ * once reconnected (that's QoS 1: at least once).
  */
 
-float_t readTemperature() {
-    startRead = millis();
-    readingTemperature = true;
-    return dht.readTemperature();
+void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
+    portENTER_CRITICAL(&outboxMux);
+    MqttOutbox &outbox = mqttOutbox;
+    for (uint32_t i = outbox.head; i != outbox.sent; i++) outbox.messages[i % MQTT_OUTBOX_SIZE].done = false;
+    outbox.sent = outbox.head;
+    portEXIT_CRITICAL(&outboxMux);
+    LOG_INFO("-> MQTT broker disconnected (%u)", (unsigned) reason);
+    xTaskNotifyGive(mqttPublisher);
 }
 
-// Triggers
-// --------
+void onMqttPublish(uint16_t packetId) {
+    portENTER_CRITICAL(&outboxMux);
+    MqttOutbox &outbox = mqttOutbox;
+    for (uint32_t i = outbox.head; i != outbox.sent; i++) {
+        MqttMessage &message = outbox.messages[i % MQTT_OUTBOX_SIZE];
+        if (message.packetId == packetId) message.done = true;
+    }
+    while (outbox.head != outbox.sent && outbox.messages[outbox.head % MQTT_OUTBOX_SIZE].done) outbox.head++;
+    portEXIT_CRITICAL(&outboxMux);
+    xTaskNotifyGive(mqttPublisher); // -> room for the next batch
+}
 
 /**
- * When temperatures are outside the range allowed by the operator,
- * special actions may be desired. These must be defined here.
- * 
- * Be careful to understand, however, that in the case of this demonstration,
- * only the client browser is at the origin of the temperature control,
- * by making successive periodic requests.
- * 
- * If you want ESP32 to also monitor the temperature on its own initiative,
- * you will have to add this monitoring to the main control loop!
+ * The configuration documents may arrive in several chunks, which are fed
+ * to the same streaming parser as the `/config` route.
  */
 
-void lowTemperatureTrigger () {
-    // trigger whatever you want here...
-}
+ConfigParser mqttConfigParser;
 
-void highTemperatureTrigger () {
-    // trigger whatever you want here...
-}
+void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    if (strcmp(topic, mqttConfigTopic) != 0) return;
+
+    if (index == 0) mqttConfigParser = ConfigParser();
+    mqttConfigParser.feed((const uint8_t*) payload, len);
+    if (index + len < total) return;
+
+    ConfigUpdate &update = mqttConfigParser.finish();
+    const char   *error  = update.error;
+    if (!error) error = applyConfig(update);
 
-void checkForTriggers(float_t temp) {
-    if (temp < tempRange.lower) {
-        lowTemperatureTrigger();
-    } else if (temp > tempRange.upper) {
-        highTemperatureTrigger();
+    if (error) {
+        LOG_ERROR("MQTT configuration rejected: %s", error);
+    } else if (update.reboot) {
+        reboot();
     }
 }
 
-// Temperature range backup
-// ------------------------
+// Overflow of the outbox into the flash memory
+// --------------------------------------------
 
 /**
- * The lower and upper temperature limits are only saved if the current values
- * differ from the values already stored in the EEPROM. There is no need to
- * write to the EEPROM if this is not necessary.
+ * While the broker is unreachable, the oldest half of a full outbox is
+ * appended to the spool file, as raw `MqttMessage` records.
  */
 
-void saveTempRangeToEEPROM(float_t lower, float_t upper) {
-    bool hasToBeSaved = false;
+void spoolMqttOutbox() {
+    portENTER_CRITICAL(&outboxMux);
+    bool full = mqttOutbox.tail - mqttOutbox.head >= MQTT_OUTBOX_SIZE - 1;
+    portEXIT_CRITICAL(&outboxMux);
+    if (!full) return;
 
-    // Remember that `tempRange` contains the values that were
-    // read from the EEPROM during initialization.
+    File file = SPIFFS.open(MQTT_SPOOL_FILE, FILE_APPEND);
+    if (!file) return;
 
-    if (lower != tempRange.lower) {
-        tempRange.lower = lower;
-        EEPROM.writeFloat(ADDR_MIN_TEMP, lower);
-        hasToBeSaved = true;
+    for (uint8_t n = 0; n < MQTT_OUTBOX_SIZE / 2 && file.size() + sizeof(MqttMessage) <= MQTT_SPOOL_MAX; n++) {
+        MqttMessage message;
+        portENTER_CRITICAL(&outboxMux);
+        bool available = mqttOutbox.sent == mqttOutbox.head && mqttOutbox.head != mqttOutbox.tail;
+        if (available) {
+            message = mqttOutbox.messages[mqttOutbox.head % MQTT_OUTBOX_SIZE];
+            mqttOutbox.head++;
+            mqttOutbox.sent++;
+        }
+        portEXIT_CRITICAL(&outboxMux);
+        if (!available) break;
+        file.write((const uint8_t*) &message, sizeof(message));
+        mqttSpoolPending = true;
     }
+    file.close();
+}
 
-    if (upper != tempRange.upper) {
-        tempRange.upper = upper;
-        EEPROM.writeFloat(ADDR_MAX_TEMP, upper);
-        hasToBeSaved = true;
+/**
+ * The spooled messages are older than those of the outbox: they are
+ * replayed first, one batch at a time, without waiting for their
+ * acknowledgements. Returns `false` as long as the file has not been
+ * entirely replayed.
+ */
+
+bool replayMqttSpool() {
+    if (!mqttSpoolPending) return true;
+
+    File file = SPIFFS.open(MQTT_SPOOL_FILE, FILE_READ);
+    if (!file) {
+        mqttSpoolPending = false;
+        return true;
     }
 
-    if (hasToBeSaved) {
-        // If no storage has ever taken place in the EEPROM,
-        // a control value is also stored so that it can be remembered
-        // that it has actually taken place at least once.
-        if (!tempRange.initialized) {
-            EEPROM.writeByte(ADDR_INIT_FLAG, INIT_FLAG);
-            tempRange.initialized = true;
+    file.seek(mqttSpoolOffset);
+    MqttMessage message;
+    for (uint8_t n = 0; n < MQTT_BATCH; n++) {
+        if (file.read((uint8_t*) &message, sizeof(message)) != sizeof(message)) {
+            file.close();
+            SPIFFS.remove(MQTT_SPOOL_FILE);
+            mqttSpoolOffset  = 0;
+            mqttSpoolPending = false;
+            return true;
         }
-        // we end by actually writing in the EEPROM:
-        EEPROM.commit();
-        Serial.println(F("-> Has been stored in EEPROM\n"));
-    } else {
-        Serial.println(F("Already stored in EEPROM (no change)\n"));
+        if (mqtt.publish(mqttTopics[message.topic], message.qos, message.retain, message.payload, message.length) == 0) break;
+        mqttSpoolOffset += sizeof(message);
     }
+    file.close();
+    return false;
 }
 
-// ----------------------------------------------------------------------------
-// HTTP route definition & request processing
-// ----------------------------------------------------------------------------
-
-// Processing of the `index.html` template
-// ---------------------------------------
+// Publication of the outbox
+// -------------------------
 
 /**
- * The HTML page (index.html) that is stored in SPIFFS has generic markers
- * of the form `%TAG%`. This routine is responsible for substituting these
- * markers with the actual values that correspond to them and must be included
- * in the page that is sent to the browser.
- * 
- * There are 4 of these markers:
- * - %TEMP%       (the current temperature read by the sensor)
- * - %MIN_TEMP%   (factory setting of the minimum temperature)
- * - %MAX_TEMP%   (Factory setting of the maximum temperature)
- * - %LOWER_TEMP% (the lower limit of the temperature range set by the operator)
- * - %UPPER_TEMP% (the upper limit of the temperature range set by the operator)
+ * Publishes a batch of the messages that have not been sent yet, without
+ * ever exceeding `MQTT_BATCH` unacknowledged messages.
  */
 
-String processor(const String &var)
-{
-    if (var == "TEMP") {
-        float_t t = readTemperature();
-        return isnan(t) ? String("Error") : String(t, 1);
-    } else if (var == "MIN_TEMP") {
-        return String(MIN_TEMP, 1);
-    } else if (var == "MAX_TEMP") {
-        return String(MAX_TEMP, 1);
-    } else if (var == "LOWER_TEMP") {
-        return String(tempRange.lower, 1);
-    } else if (var == "UPPER_TEMP") {
-        return String(tempRange.upper, 1);
-    }
+void publishMqttOutbox() {
+    MqttOutbox &outbox = mqttOutbox;
+
+    for (uint8_t n = 0; n < MQTT_BATCH; n++) {
+        MqttMessage message;
+        uint32_t    index;
+
+        portENTER_CRITICAL(&outboxMux);
+        bool available = outbox.sent != outbox.tail && outbox.sent - outbox.head < MQTT_BATCH;
+        if (available) {
+            index   = outbox.sent;
+            message = outbox.messages[index % MQTT_OUTBOX_SIZE];
+        }
+        portEXIT_CRITICAL(&outboxMux);
+        if (!available) break;
 
-    return String();
+        uint16_t packetId = mqtt.publish(mqttTopics[message.topic], message.qos, message.retain, message.payload, message.length);
+        if (packetId == 0) break; // -> disconnected meanwhile, or the TCP buffer is full
+
+        portENTER_CRITICAL(&outboxMux);
+        if (index == outbox.sent) {
+            MqttMessage &sent = outbox.messages[index % MQTT_OUTBOX_SIZE];
+            sent.packetId = packetId;
+            sent.done     = message.qos == 0;
+            outbox.sent++;
+            outbox.published++;
+            while (outbox.head != outbox.sent && outbox.messages[outbox.head % MQTT_OUTBOX_SIZE].done) outbox.head++;
+        }
+        portEXIT_CRITICAL(&outboxMux);
+    }
 }
 
-// Specific treatment of the root page (as a template)
-// ---------------------------------------------------
+// Background publishing task
+// --------------------------
 
 /**
- * When the browser requests access to the main page `index.html`,
- * the server must first replace the generic markers declared above
- * with their respective values.
+ * The task wakes up when a message is queued (or every `MQTT_RETRY_DELAY`),
+ * connects to the broker if necessary, and then publishes a batch every
+ * `MQTT_BATCH_PERIOD` until the outbox is empty.
  */
 
-void onRootRequest(AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/index.html", "text/html", false, processor);
-}
+void publishMqtt(void *parameter) {
+    uint32_t lastAttempt = millis() - MQTT_RETRY_DELAY;
 
-// Method of fallback in case no request could be resolved
-// -------------------------------------------------------
+    for (;;) {
+        if (!mqtt.connected()) {
+            if (MQTT_SPOOL) spoolMqttOutbox();
+            if (wifiConnected && millis() - lastAttempt >= MQTT_RETRY_DELAY) {
+                lastAttempt = millis();
+                mqtt.connect();
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_RETRY_DELAY));
+            continue;
+        }
 
-void onNotFound(AsyncWebServerRequest *request) {
-    request->send(404);
-}
+        if (replayMqttSpool()) publishMqttOutbox();
 
-// Sensor temperature reading query manager
-// ----------------------------------------
+        portENTER_CRITICAL(&outboxMux);
+        bool pending = mqttOutbox.sent != mqttOutbox.tail || mqttSpoolPending;
+        portEXIT_CRITICAL(&outboxMux);
 
-void onTemp(AsyncWebServerRequest *request) {
-    Serial.println(F("Received temperature request\n-> Performs a sensor reading"));
-    float_t temp = readTemperature();
-    
-    if (isnan(temp)) {
-        Serial.println(F("** Failed to read from DHT sensor!\n"));
-        request->send(200, "text/plain", String("Error"));
-    } else {
-        checkForTriggers(temp);
-        Serial.print(F("-> DHT sensor readout: "));
-        Serial.printf("%.1f°C\n", temp);
-        Serial.println(F("-> Sends the data back to the client\n"));
-        request->send(200, "text/plain", String(temp));
+        ulTaskNotifyTake(pdTRUE, pending ? pdMS_TO_TICKS(MQTT_BATCH_PERIOD) : portMAX_DELAY);
     }
 }
 
-// Factory reset
-// -------------
+void startMQTT() {
+    if (!MQTT_ENABLED) return;
 
-void onReset(AsyncWebServerRequest *request) {
-    // No point in writing in the EEPROM if it's never been done before...
-    if (tempRange.initialized) {
-        EEPROM.writeByte(ADDR_INIT_FLAG, 0xff);
-        EEPROM.commit();
+    for (uint8_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+        snprintf(mqttTopics[i], sizeof(mqttTopics[i]), "%s/%s/%s", MQTT_TOPIC_PREFIX, deviceName, MQTT_TOPIC_NAMES[i]);
     }
+    snprintf(mqttStatusTopic, sizeof(mqttStatusTopic), "%s/%s/status",     MQTT_TOPIC_PREFIX, deviceName);
+    snprintf(mqttConfigTopic, sizeof(mqttConfigTopic), "%s/%s/config/set", MQTT_TOPIC_PREFIX, deviceName);
 
-    tempRange.initialized = false;
-    tempRange.lower       = MIN_TEMP;
-    tempRange.upper       = MAX_TEMP;
+    // the client keeps these pointers:
+    mqtt.setServer(MQTT_HOST, MQTT_PORT);
+    mqtt.setClientId(deviceName);
+    mqtt.setWill(mqttStatusTopic, 1, true, "offline");
+    if (*MQTT_USER) mqtt.setCredentials(MQTT_USER, MQTT_PASS);
 
-    Serial.println(F("\nFactory reset\n"));
-    Serial.print(F("-> Temperature range is set to "));
-    Serial.printf("[ %.1f°C , %.1f°C ]\n\n", tempRange.lower, tempRange.upper);
+    mqtt.onConnect(onMqttConnect);
+    mqtt.onDisconnect(onMqttDisconnect);
+    mqtt.onPublish(onMqttPublish);
+    mqtt.onMessage(onMqttMessage);
 
-    // Requests are asynchronous and must always be resolved:
-    request->send(200);
+    mqttSpoolPending = MQTT_SPOOL && SPIFFS.exists(MQTT_SPOOL_FILE);
+
+    xTaskCreatePinnedToCore(
+        publishMqtt,      // -> task function
+        "mqtt",           // -> task name
+        MQTT_STACK,       // -> stack size
+        NULL,             // -> task parameter
+        MQTT_PRIORITY,    // -> task priority
+        &mqttPublisher,   // -> task handle
+        NETWORK_CORE      // -> core on which the task runs
+    );
+
+    LOG_INFO("9. MQTT publisher started (%s:%u)", MQTT_HOST, MQTT_PORT);
 }
 
-// ESP32 restart request manager
-// -----------------------------
+// ----------------------------------------------------------------------------
+// Low-power mode
+// ----------------------------------------------------------------------------
 
-void onReboot(AsyncWebServerRequest *request) {
-    // Requests are asynchronous and must always be resolved:
-    request->send(200);
+#ifdef LOW_POWER
 
-    Serial.println(CLOSING);
-    Serial.println(F("Rebooting...\n"));
-    Serial.flush();
-    ESP.restart();
-}
+// Sampling at each wake
+// ---------------------
 
-// Manager for queries to define the temperature range set by the operator
-// -----------------------------------------------------------------------
+void recordLowPowerSample(const Reading readings[], const bool success[]) {
+    LowPowerBatch  &batch  = lowPowerBatch;
+    LowPowerSample &sample = batch.samples[batch.sequence++ % LOW_POWER_BATCH];
 
-void onSaveThresholds(AsyncWebServerRequest *request) {
-    if (request->hasParam("lower") && request->hasParam("upper")) {
-        float_t lower = request->getParam("lower")->value().toFloat();
-        float_t upper = request->getParam("upper")->value().toFloat();
-        Serial.printf("Temperature range received: [ %.1f°C , %.1f°C ]\n", lower, upper);
-        saveTempRangeToEEPROM(lower, upper);
+    sample.time = time(NULL);
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        TempSnapshot snapshot = { readings[i].temperature, readings[i].humidity, 0, batch.sequence, !success[i] };
+        HistorySample quantized = quantize(snapshot, sample.time);
+        sample.records[i].temperature = quantized.temperature;
+        sample.records[i].humidity    = quantized.humidity;
     }
-
-    // Requests are asynchronous and must always be resolved:
-    request->send(200);
+    if (batch.count < LOW_POWER_BATCH) batch.count++;
 }
 
-// Definition of request handlers and server initialization
-// --------------------------------------------------------
+// Upload of the batch
+// -------------------
 
 /**
- * This is where we will define the HTTP routes of the application,
- * as well as the handlers associated with each route.
+ * Each sample is pushed with the same datagram as in normal operation (its
+ * sequence number reveals the samples lost in between), and as a QoS 1
+ * `state` message. The batch is only cleared once the broker has
+ * acknowledged all of them: after a timeout, they are pushed again at the
+ * next upload (at least once).
  */
 
-void initWebServer() {
+TempSnapshot lowPowerSnapshot(const TelemetryRecord &record) {
+    TempSnapshot snapshot = { NAN, NAN, 0, 0, record.temperature == HISTORY_NO_TEMP };
+    if (!snapshot.error) snapshot.temperature = record.temperature / 10.0f;
+    if (record.humidity != HISTORY_NO_HUMIDITY) snapshot.humidity = record.humidity / 10.0f;
+    return snapshot;
+}
 
-    // Routes that simply return one of the files present on SPIFFS:
-
-    /*
-     * for some reason, this doesn't work:
-     * -> server.serveStatic("/", SPIFFS, "/index.html");
-     *
-     * but this does:
-     * -> server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
-     *
-     * and this messes up the rendering in the browser:
-     * -> server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html").setTemplateProcessor(processor);
-     *
-     * So, I prefer to fall back on the classic method:
-     */
-    server.on("/", onRootRequest);
-
-    server.serveStatic("/index.js",    SPIFFS, "/index.js");
-    server.serveStatic("/index.css",   SPIFFS, "/index.css");
-    server.serveStatic("/D7MR.woff2",  SPIFFS, "/D7MR.woff2");
-    server.serveStatic("/favicon.ico", SPIFFS, "/favicon.ico");
+bool isMqttOutboxEmpty() {
+    portENTER_CRITICAL(&outboxMux);
+    bool empty = mqttOutbox.head == mqttOutbox.tail;
+    portEXIT_CRITICAL(&outboxMux);
+    return empty;
+}
 
-    server.onNotFound(onNotFound);
+bool uploadLowPowerBatch() {
+    LowPowerBatch &batch = lowPowerBatch;
+    uint32_t first = batch.sequence - batch.count;
 
-    // Routes that correspond to dynamic processing by the microcontroller:
+    initWiFi();
+    uint32_t start = millis();
+    while (!wifiConnected && millis() - start < LOW_POWER_WIFI_TIMEOUT) vTaskDelay(pdMS_TO_TICKS(10));
+    if (!wifiConnected) {
+        LOG_ERROR("No WiFi connection, %u sample(s) kept for the next upload", batch.count);
+        return false;
+    }
 
-    server.on("/temp",           onTemp);
-    server.on("/reset",          onReset);
-    server.on("/reboot",         onReboot);
-    server.on("/savethresholds", onSaveThresholds);
+    if (TELEMETRY_ENABLED) {
+        for (uint32_t n = first; n != batch.sequence; n++) {
+            const LowPowerSample &sample = batch.samples[n % LOW_POWER_BATCH];
+            TelemetryDatagram datagram;
+            makeTelemetryHeader(datagram.header, sample.time, n);
+            memcpy(datagram.records, sample.records, sizeof(datagram.records));
+            telemetry.writeTo((const uint8_t*) &datagram, sizeof(datagram), TELEMETRY_COLLECTOR, TELEMETRY_PORT);
+        }
+    }
 
-    // Server initialization
+    bool delivered = true;
+    if (MQTT_ENABLED) {
+        startMQTT();
+        for (uint32_t n = first; n != batch.sequence; n++) {
+            const LowPowerSample &sample = batch.samples[n % LOW_POWER_BATCH];
+            publishMqttState(lowPowerSnapshot(sample.records[CONTROL_SENSOR]), sample.time, 1);
+        }
+        start = millis();
+        while (!isMqttOutboxEmpty() && millis() - start < LOW_POWER_UPLOAD_TIMEOUT) vTaskDelay(pdMS_TO_TICKS(10));
+        delivered = isMqttOutboxEmpty();
+        mqtt.disconnect();
+    }
 
-    server.begin();
-    Serial.println(F("8. Web server started"));
+    vTaskDelay(pdMS_TO_TICKS(LOW_POWER_FLUSH_DELAY));
+
+    if (delivered) {
+        LOG_INFO("-> %u sample(s) pushed in %u ms", batch.count, millis() - wifiStartTime);
+        batch.count = 0;
+    } else {
+        LOG_ERROR("MQTT broker unavailable, %u sample(s) kept for the next upload", batch.count);
+    }
+    return delivered;
+}
+
+// Wake cycle
+// ----------
+
+/**
+ * The sleep duration is corrected by the time spent awake, so that the
+ * samples remain evenly spaced.
+ */
+
+void runLowPowerCycle() {
+    LowPowerBatch &batch = lowPowerBatch;
+    batch.wakes++;
+
+    Reading readings[SENSOR_COUNT];
+    bool    success[SENSOR_COUNT];
+    readSensors(readings, success);
+    recordLowPowerSample(readings, success);
+    LOG_INFO("Wake %u: %u sample(s) in the batch", batch.wakes, batch.count);
+
+    if (batch.wakes % LOW_POWER_UPLOAD_WAKES == 0) uploadLowPowerBatch();
+
+    uint64_t awake  = millis() * 1000ULL; // in microseconds, since the wake
+    uint64_t period = LOW_POWER_PERIOD * 1000000ULL;
+    uint64_t sleep  = awake + 1000000ULL < period ? period - awake : 1000000ULL;
+
+    LOG_INFO("Sleeping for %u s", (unsigned) (sleep / 1000000ULL));
+    flushLog();
+    WiFi.mode(WIFI_OFF);
+    esp_sleep_enable_timer_wakeup(sleep);
+    esp_deep_sleep_start();
 }
 
+#endif
+
 // ----------------------------------------------------------------------------
 // General initialization procedure
 // ----------------------------------------------------------------------------
 
-// Each module is initialized in turn, in a precise order:
+#ifdef LOW_POWER
+
+// Only what is needed to take a sample is initialized, at each wake:
 
 void setup() {
     initSerial();
     initLEDs();
-    initEEPROM();
-    initTempRange();
+    initRelay();
+    initSettings();
     initTempSensor();
-    initSPIFFS();
-    initWiFi();
-    initWebServer();
+    runLowPowerCycle(); // -> ends in deep sleep
+}
+
+#else
+
+/**
+ * The modules are grouped into stages, which only wait for the stages they
+ * actually depend on: the sensors are probed (the BME280 alone takes more
+ * than 100 ms), the settings and the journal are loaded, the SPIFFS volume
+ * is mounted and the WiFi interface is started, all at the same time. The
+ * serial monitor comes first, and then the outputs, since the relay must be
+ * released before anything else.
+ *
+ * The readings, the settings and the control engine must be ready before
+ * the first request, or the first MQTT message, can be handled.
+ */
+
+struct BootTask {
+    BootStage   stage;
+    EventBits_t after; // -> stages that must be complete first
+    BaseType_t  core;  // -> on which the stage runs
+    void      (*run)();
+};
+
+constexpr EventBits_t bootBit(BootStage stage) { return (EventBits_t) 1 << stage; }
 
-    Serial.println(CLOSING);
+constexpr EventBits_t BOOT_COMPLETE   = bootBit(BOOT_STAGE_COUNT) - 1;
+constexpr EventBits_t BOOT_CONTROL    = bootBit(BOOT_SETTINGS) | bootBit(BOOT_SENSORS);
+constexpr EventBits_t BOOT_NETWORKING = bootBit(BOOT_SAMPLER) | bootBit(BOOT_SPIFFS) | bootBit(BOOT_WIFI);
+
+void initOutputs() {
+    initLEDs();
+    initRelay();
 }
 
-// ----------------------------------------------------------------------------
-// LED indicator handlers
-// ----------------------------------------------------------------------------
+void loadSettings() {
+    initSettings();
+    initJournal();
+    checkFirmware();
+    initTempRange();
+}
 
-// WiFi connection indicator
-// -------------------------
+void startControl() {
+    startSampler();
+    startPersister();
+}
 
-void flashWiFiBeacon() {
-    digitalWrite(INIT_LED, millis() % 2000 < 50 ? HIGH : LOW);
+const BootTask BOOT_TASKS[] = {
+    { BOOT_WIFI,       0,               NETWORK_CORE, initWiFi       }, // -> the association takes the longest
+    { BOOT_SETTINGS,   0,               CONTROL_CORE, loadSettings   },
+    { BOOT_SENSORS,    0,               CONTROL_CORE, initTempSensor },
+    { BOOT_SPIFFS,     0,               NETWORK_CORE, initSPIFFS     },
+    { BOOT_SAMPLER,    BOOT_CONTROL,    CONTROL_CORE, startControl   },
+    { BOOT_WEB_SERVER, BOOT_NETWORKING, NETWORK_CORE, initWebServer  },
+    { BOOT_MQTT,       BOOT_NETWORKING, NETWORK_CORE, startMQTT      }
+};
+
+void runBootStage(BootStage stage, void (*run)()) {
+    bootTimings[stage].start = esp_timer_get_time();
+    run();
+    bootTimings[stage].end = esp_timer_get_time();
+    xEventGroupSetBits(bootEvents, bootBit(stage));
 }
 
-// DHT reading indicator
-// ---------------------
+void bootTask(void *parameter) {
+    const BootTask *task = (const BootTask*) parameter;
+    runBootStage(task->stage, task->run);
+    vTaskDelete(NULL);
+}
 
-void flashTempBeacon() {
-    if (readingTemperature) {
-        readingTemperature = millis() - startRead < 50;
-        digitalWrite(TEMP_LED, readingTemperature ? HIGH : LOW);
+void setup() {
+    bootEvents = xEventGroupCreate();
+    runBootStage(BOOT_SERIAL, initSerial);
+    runBootStage(BOOT_OUTPUTS, initOutputs);
+
+    // each time a stage is complete, the ones that were waiting for it are started:
+    EventBits_t started  = bootBit(BOOT_SERIAL) | bootBit(BOOT_OUTPUTS);
+    EventBits_t complete = started;
+
+    while (complete != BOOT_COMPLETE) {
+        for (const BootTask &task : BOOT_TASKS) {
+            if ((started & bootBit(task.stage)) || (complete & task.after) != task.after) continue;
+            started |= bootBit(task.stage);
+            xTaskCreatePinnedToCore(
+                bootTask,                      // -> task function
+                BOOT_STAGE_NAMES[task.stage],  // -> task name
+                BOOT_STACK,                    // -> stack size
+                (void*) &task,                 // -> task parameter
+                BOOT_PRIORITY,                 // -> task priority
+                NULL,                          // -> task handle
+                task.core                      // -> core on which the task runs
+            );
+        }
+        complete = xEventGroupWaitBits(bootEvents, BOOT_COMPLETE & ~complete, pdFALSE, pdFALSE, portMAX_DELAY) & BOOT_COMPLETE;
     }
+
+    bootReady = esp_timer_get_time();
+    LOG_INFO("-> Ready in %u ms", bootReady / 1000);
+    LOG_INFO("%s", CLOSING);
 }
 
+#endif
+
 // ----------------------------------------------------------------------------
 // Main control loop
 // ----------------------------------------------------------------------------
 
 /**
  * All processing that is the responsibility of the web server is carried out
- * asynchronously. There is therefore not much to do in the main loop, except
- * to manage the operation of the LEDs.
+ * asynchronously, the sensors are read by the sampling task, and the LEDs
+ * are driven by the hardware. There is therefore nothing left to do in the
+ * main loop, whose task is simply deleted.
  */
 
 void loop() {
-    flashWiFiBeacon();
-    flashTempBeacon();
+    vTaskDelete(NULL);
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+/**
+ * Micro-benchmarks of the hot paths of lib/thermostat, on the host:
+ *
+ *     pio test -e native -f test_benchmarks -v
+ *
+ * Each benchmark prints its mean duration per operation. The figures are
+ * only meaningful compared with each other, or with those of a previous
+ * commit on the same machine.
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <ConfigParser.h>
+#include <ControlEngine.h>
+#include <Format.h>
+#include <Settings.h>
+#include <SignalFilter.h>
+
+constexpr uint32_t ITERATIONS = 200000;
+
+volatile uint32_t sink; // -> keeps the results from being optimized away
+
+template <typename Operation>
+void benchmark(const char *name, Operation operation) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < ITERATIONS; i++) operation(i);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    char message[80];
+    snprintf(message, sizeof(message), "%-24s %8.1f ns/op", name, elapsed.count() / ITERATIONS);
+    TEST_MESSAGE(message);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void bench_filter_pipeline() {
+    SignalFilter filter({ 5, 0.4, 1.5, 0.05, 3 });
+    benchmark("filter update", [&](uint32_t i) {
+        filter.update(12 + (i % 7) * 0.1f, i * 2000);
+        sink = (uint32_t) filter.value();
+    });
+}
+
+void bench_reading_formatting() {
+    char buffer[80];
+    benchmark("reading JSON", [&](uint32_t i) {
+        formatReadingJson(0, "cellar", 12 + (i % 7) * 0.1f, 65.5, true, buffer, sizeof(buffer));
+        sink = buffer[20];
+    });
+}
+
+void bench_settings_serialization() {
+    SettingsRecord record;
+    benchmark("settings record", [&](uint32_t i) {
+        makeSettingsRecord(record, 8 + (i % 4), 12);
+        sink = isValidSettingsRecord(record);
+    });
+}
+
+void bench_pid_update() {
+    ControlEngine engine({ 50, 20, 3, 3600000 }, { 400, 1800, 60 });
+    engine.setMode(ControlMode::Pid, 0);
+    benchmark("PID update", [&](uint32_t i) {
+        sink = engine.update(1200 + (int32_t) (i % 7) * 10, 1000, 1400, i * 2000);
+    });
+}
+
+void bench_config_parsing() {
+    const char  *document = "{\"lower\": 12.5, \"upper\": 18, \"reset\": false, \"reboot\": false}";
+    const size_t length   = strlen(document);
+    benchmark("config document", [&](uint32_t i) {
+        ConfigParser parser;
+        parser.feed((const uint8_t*) document, length);
+        sink = parser.finish().error == NULL;
+    });
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(bench_filter_pipeline);
+    RUN_TEST(bench_reading_formatting);
+    RUN_TEST(bench_settings_serialization);
+    RUN_TEST(bench_pid_update);
+    RUN_TEST(bench_config_parsing);
+    return UNITY_END();
+}
@@ -0,0 +1,123 @@
+/**
+ * Unit tests of the streamed responses (lib/thermostat/ChunkedWriter).
+ */
+
+#include <string.h>
+#include <unity.h>
+#include <ChunkedWriter.h>
+
+// A JSON array of `count` numbers, one item per element:
+
+struct ArrayWriter : ChunkedWriter {
+    uint16_t count;
+    int32_t  item = -1;
+
+    ArrayWriter(uint16_t count) : count(count) {}
+
+    bool next() override {
+        if (item == count) return false;
+        if (item == -1) {
+            print('[');
+        } else {
+            if (item > 0) print(',');
+            printf("%d", 1000 + item);
+        }
+        if (++item == count) print(']');
+        return true;
+    }
+};
+
+// Drains the writer with chunks of `size` bytes at most:
+
+size_t drain(ChunkedWriter &writer, size_t size, char *document, size_t capacity) {
+    size_t total = 0;
+    uint8_t chunk[256];
+    while (true) {
+        size_t n = writer.fill(chunk, size);
+        if (n == 0) break;
+        TEST_ASSERT_TRUE(n <= size);
+        TEST_ASSERT_TRUE(total + n < capacity);
+        memcpy(document + total, chunk, n);
+        total += n;
+    }
+    document[total] = '\0';
+    return total;
+}
+
+char expected[8192];
+char document[8192];
+
+void setUp() {}
+void tearDown() {}
+
+void test_document_does_not_depend_on_the_chunk_size() {
+    ArrayWriter reference(500);
+    size_t length = drain(reference, 256, expected, sizeof(expected));
+    TEST_ASSERT_EQUAL(1 + 500 * 5, length);
+    TEST_ASSERT_EQUAL_STRING_LEN("[1000,1001,", expected, 11);
+    TEST_ASSERT_EQUAL_STRING("1499]", expected + length - 5);
+
+    static const size_t sizes[] = { 1, 2, 3, 7, 64, 191, 192, 193 };
+    for (size_t size : sizes) {
+        ArrayWriter writer(500);
+        TEST_ASSERT_EQUAL(length, drain(writer, size, document, sizeof(document)));
+        TEST_ASSERT_EQUAL_STRING(expected, document);
+    }
+}
+
+void test_empty_items_are_skipped() {
+    struct SparseWriter : ChunkedWriter {
+        uint8_t item = 0;
+        bool next() override {
+            if (item == 10) return false;
+            if (item++ % 3 == 0) print('x');
+            return true;
+        }
+    } writer;
+
+    drain(writer, 2, document, sizeof(document));
+    TEST_ASSERT_EQUAL_STRING("xxxx", document);
+}
+
+void test_empty_document() {
+    struct EmptyWriter : ChunkedWriter {
+        bool next() override { return false; }
+    } writer;
+
+    uint8_t chunk[16];
+    TEST_ASSERT_EQUAL(0, writer.fill(chunk, sizeof(chunk)));
+    TEST_ASSERT_EQUAL(0, writer.fill(chunk, sizeof(chunk)));
+}
+
+void test_long_items_are_truncated() {
+    struct LongWriter : ChunkedWriter {
+        uint8_t item = 0;
+        bool next() override {
+            if (item++ == 2) return false;
+            for (uint8_t i = 0; i < 25; i++) printf("%08u;", i);
+            return true;
+        }
+    } writer;
+
+    size_t length = drain(writer, 100, document, sizeof(document));
+    TEST_ASSERT_EQUAL(2 * (CHUNK_ITEM_SIZE - 1), length);
+    TEST_ASSERT_TRUE(writer.truncated() > 0);
+    TEST_ASSERT_EQUAL_STRING_LEN("00000000;00000001;", document + CHUNK_ITEM_SIZE - 1, 18);
+}
+
+void test_writer_can_be_copied_before_use() {
+    ArrayWriter original(3);
+    ArrayWriter copy = original;
+    drain(copy, 4, document, sizeof(document));
+    TEST_ASSERT_EQUAL_STRING("[1000,1001,1002]", document);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_document_does_not_depend_on_the_chunk_size);
+    RUN_TEST(test_empty_items_are_skipped);
+    RUN_TEST(test_empty_document);
+    RUN_TEST(test_long_items_are_truncated);
+    RUN_TEST(test_writer_can_be_copied_before_use);
+    return UNITY_END();
+}
@@ -0,0 +1,156 @@
+/**
+ * Unit tests of the parsing of the configuration documents
+ * (lib/thermostat/ConfigParser).
+ */
+
+#include <string.h>
+#include <unity.h>
+#include <ConfigParser.h>
+
+ConfigParser parser;
+
+ConfigUpdate &parse(const char *document, size_t chunk = 0) {
+    parser = ConfigParser();
+    size_t length = strlen(document);
+    if (chunk == 0) chunk = length;
+    for (size_t i = 0; i < length; i += chunk) {
+        parser.feed((const uint8_t*) document + i, length - i < chunk ? length - i : chunk);
+    }
+    return parser.finish();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_all_keys() {
+    ConfigUpdate &update = parse("{\"lower\": 12.5, \"upper\":18,\"reset\":false, \"reboot\":true}");
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 12.5, update.lower);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 18.0, update.upper);
+    TEST_ASSERT_FALSE(update.reset);
+    TEST_ASSERT_TRUE(update.reboot);
+}
+
+void test_document_fed_byte_by_byte() {
+    ConfigUpdate &update = parse(" {\n  \"lower\" : 8,\n  \"upper\" : 11.5\n}\n", 1);
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 8.0, update.lower);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 11.5, update.upper);
+}
+
+void test_missing_keys_are_left_unset() {
+    ConfigUpdate &update = parse("{\"upper\":null}");
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_TRUE(isnan(update.lower));
+    TEST_ASSERT_TRUE(isnan(update.upper));
+    TEST_ASSERT_NULL(parse("{}").error);
+}
+
+void test_string_values_are_read_like_form_values() {
+    ConfigUpdate &update = parse("{\"lower\":\"3\",\"reset\":\"1\"}");
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 3.0, update.lower);
+    TEST_ASSERT_TRUE(update.reset);
+}
+
+void test_control_keys() {
+    ConfigUpdate &update = parse("{\"mode\":\"pid\",\"kp\":400,\"ti\":1800}");
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_TRUE(update.hasMode);
+    TEST_ASSERT_TRUE(update.mode == ControlMode::Pid);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 400.0, update.gains.kp);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 1800.0, update.gains.ti);
+    TEST_ASSERT_TRUE(isnan(update.gains.td));
+    TEST_ASSERT_FALSE(parse("{\"lower\":8}").hasMode);
+    TEST_ASSERT_EQUAL_STRING("invalid value", parse("{\"mode\":\"fuzzy\"}").error);
+}
+
+void test_schedule_keys() {
+    ConfigUpdate &update = parse("{\"schedule\":true,\"rule0\":\"12345 07:30 12.0 14.0\",\"rule15\":\"\"}");
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_TRUE(update.hasSchedule && update.schedule);
+    TEST_ASSERT_EQUAL_UINT32(0x8001, update.rulesSet);
+    TEST_ASSERT_EQUAL_UINT32(7 * 60 + 30, update.rules[0].minute);
+    TEST_ASSERT_EQUAL_UINT8(0, update.rules[15].days);
+    TEST_ASSERT_EQUAL_STRING("invalid value", parse("{\"rule3\":\"12345 25:00 12 14\"}").error);
+    TEST_ASSERT_EQUAL_STRING("unknown key",   parse("{\"rule16\":\"\"}").error);
+}
+
+void test_invalid_documents() {
+    TEST_ASSERT_EQUAL_STRING("invalid value",                   parse("{\"lower\":1x}").error);
+    TEST_ASSERT_EQUAL_STRING("invalid value",                   parse("{\"reboot\":yes}").error);
+    TEST_ASSERT_EQUAL_STRING("unknown key",                     parse("{\"foo\":1}").error);
+    TEST_ASSERT_EQUAL_STRING("malformed document",              parse("{\"lower\":1").error);
+    TEST_ASSERT_EQUAL_STRING("nested values are not supported", parse("{\"lower\":{}}").error);
+    TEST_ASSERT_EQUAL_STRING("key expected",                    parse("{\"lower\":1,}").error);
+    TEST_ASSERT_EQUAL_STRING("trailing characters",             parse("{}x").error);
+    TEST_ASSERT_EQUAL_STRING("object expected",                 parse("[1]").error);
+    TEST_ASSERT_EQUAL_STRING("value too long",                  parse("{\"lower\":\"12345678901234567890123456789012345678901\"}").error);
+}
+
+void test_form_fields() {
+    ConfigUpdate update = EMPTY_CONFIG_UPDATE;
+    setConfigField(update, hashKey("lower"), "lower", "9.5");
+    setConfigField(update, hashKey("reboot"), "reboot", "true");
+    TEST_ASSERT_NULL(update.error);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 9.5, update.lower);
+    TEST_ASSERT_TRUE(update.reboot);
+    setConfigField(update, hashKey("upper"), "upper", "");
+    TEST_ASSERT_EQUAL_STRING("invalid value", update.error);
+}
+
+void test_range_is_only_checked_when_it_is_set() {
+    TEST_ASSERT_FALSE(setsTempRange(parse("{\"mode\":\"pid\",\"schedule\":true}")));
+    TEST_ASSERT_TRUE(setsTempRange(parse("{\"lower\":11}")));
+    TEST_ASSERT_TRUE(setsTempRange(parse("{\"upper\":13}")));
+    TEST_ASSERT_TRUE(setsTempRange(parse("{\"reset\":true}")));
+
+    TEST_ASSERT_TRUE(isValidTempRange(10, 14, 10, 14));
+    TEST_ASSERT_TRUE(isValidTempRange(11.5, 12, 10, 14));
+    TEST_ASSERT_FALSE(isValidTempRange(9.5, 12, 10, 14));
+    TEST_ASSERT_FALSE(isValidTempRange(11, 14.5, 10, 14));
+    TEST_ASSERT_FALSE(isValidTempRange(12, 12, 10, 14));
+    TEST_ASSERT_FALSE(isValidTempRange(13, 11, 10, 14));
+    TEST_ASSERT_FALSE(isValidTempRange(NAN, 12, 10, 14));
+}
+
+void test_colliding_names_are_not_mistaken_for_keys() {
+    // "eawekic" and "reboot", "mfvbko" and "1" have the same FNV-1a hash
+    TEST_ASSERT_EQUAL_UINT32(hashKey("reboot"), hashKey("eawekic"));
+    TEST_ASSERT_EQUAL_UINT32(hashKey("1"), hashKey("mfvbko"));
+
+    ConfigUpdate update = EMPTY_CONFIG_UPDATE;
+    setConfigField(update, hashKey("eawekic"), "eawekic", "true");
+    TEST_ASSERT_EQUAL_STRING("unknown key", update.error);
+    TEST_ASSERT_FALSE(update.reboot);
+
+    update = EMPTY_CONFIG_UPDATE;
+    setConfigField(update, hashKey("reboot"), "reboot", "mfvbko");
+    TEST_ASSERT_EQUAL_STRING("invalid value", update.error);
+    TEST_ASSERT_FALSE(update.reboot);
+
+    TEST_ASSERT_EQUAL_STRING("unknown key", parse("{\"eawekic\":true}").error);
+    TEST_ASSERT_EQUAL_STRING("unknown key", parse("{\"schedule0\":true}").error);
+}
+
+void test_incremental_hash_matches_the_compile_time_one() {
+    uint32_t hash = HASH_KEY_BASIS;
+    for (const char *c = "lower"; *c; c++) hash = hashKeyChar(hash, *c);
+    TEST_ASSERT_EQUAL_UINT32(hashKey("lower"), hash);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_all_keys);
+    RUN_TEST(test_document_fed_byte_by_byte);
+    RUN_TEST(test_missing_keys_are_left_unset);
+    RUN_TEST(test_string_values_are_read_like_form_values);
+    RUN_TEST(test_control_keys);
+    RUN_TEST(test_schedule_keys);
+    RUN_TEST(test_invalid_documents);
+    RUN_TEST(test_form_fields);
+    RUN_TEST(test_range_is_only_checked_when_it_is_set);
+    RUN_TEST(test_colliding_names_are_not_mistaken_for_keys);
+    RUN_TEST(test_incremental_hash_matches_the_compile_time_one);
+    return UNITY_END();
+}
@@ -0,0 +1,59 @@
+/**
+ * Unit tests of the threshold evaluation (lib/thermostat/Control).
+ */
+
+#include <unity.h>
+#include <Control.h>
+
+constexpr float_t LOWER      = 10;
+constexpr float_t UPPER      = 14;
+constexpr float_t HYSTERESIS = 0.5;
+
+TempZone next(TempZone zone, float_t temp) {
+    return evaluateZone(zone, temp, LOWER, UPPER, HYSTERESIS);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_inside_the_range() {
+    TEST_ASSERT_TRUE(next(TempZone::Normal, 12)    == TempZone::Normal);
+    TEST_ASSERT_TRUE(next(TempZone::Normal, LOWER) == TempZone::Normal);
+    TEST_ASSERT_TRUE(next(TempZone::Normal, UPPER) == TempZone::Normal);
+}
+
+void test_excursions_begin_as_soon_as_a_limit_is_crossed() {
+    TEST_ASSERT_TRUE(next(TempZone::Normal, 9.9)  == TempZone::Low);
+    TEST_ASSERT_TRUE(next(TempZone::Normal, 14.1) == TempZone::High);
+}
+
+void test_excursions_end_past_the_hysteresis() {
+    TEST_ASSERT_TRUE(next(TempZone::High, 13.6) == TempZone::High);
+    TEST_ASSERT_TRUE(next(TempZone::High, 13.4) == TempZone::Normal);
+    TEST_ASSERT_TRUE(next(TempZone::Low,  10.4) == TempZone::Low);
+    TEST_ASSERT_TRUE(next(TempZone::Low,  10.6) == TempZone::Normal);
+}
+
+void test_no_chattering_around_a_limit() {
+    const float_t readings[] = { 14.1, 13.9, 14.2, 13.8, 14.0, 13.7 };
+    TempZone zone = TempZone::Normal;
+    for (float_t temp : readings) {
+        zone = next(zone, temp);
+        TEST_ASSERT_TRUE(zone == TempZone::High);
+    }
+}
+
+void test_direct_swing_to_the_other_limit() {
+    TEST_ASSERT_TRUE(next(TempZone::High, 9) == TempZone::Low);
+    TEST_ASSERT_TRUE(next(TempZone::Low, 15) == TempZone::High);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_inside_the_range);
+    RUN_TEST(test_excursions_begin_as_soon_as_a_limit_is_crossed);
+    RUN_TEST(test_excursions_end_past_the_hysteresis);
+    RUN_TEST(test_no_chattering_around_a_limit);
+    RUN_TEST(test_direct_swing_to_the_other_limit);
+    return UNITY_END();
+}
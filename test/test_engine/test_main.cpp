@@ -0,0 +1,188 @@
+/**
+ * Unit tests of the control engine (lib/thermostat/ControlEngine).
+ *
+ * The closed-loop tests drive a simulated cellar: a first-order thermal
+ * model, warmed by the outside air and cooled in proportion to the output,
+ * with a dead time between the cooling unit and the probe.
+ */
+
+#include <unity.h>
+#include <ControlEngine.h>
+
+constexpr uint32_t PERIOD = 2000; // in milliseconds, as the sampler
+
+constexpr ControlConfig CONFIG = { 50, 20, 3, 12 * 3600 * 1000 };
+constexpr PidGains      GAINS  = { 100, 0, 0 };
+
+// temperatures in hundredths of a degree
+constexpr int32_t LOWER = 1000;
+constexpr int32_t UPPER = 1400;
+
+struct Cellar {
+    static constexpr float_t  AMBIENT   = 20;     // in °C
+    static constexpr float_t  TAU       = 3600;   // in seconds
+    static constexpr float_t  COOLING   = 0.01;   // in °C per second, at full output
+    static constexpr uint16_t DEAD_TIME = 30;     // in samples
+
+    float_t  temperature;
+    uint16_t delayed[DEAD_TIME] = {};
+    uint16_t head = 0;
+
+    explicit Cellar(float_t temperature) : temperature(temperature) {}
+
+    int32_t reading() const { return (int32_t) lroundf(temperature * 100); }
+
+    void step(uint16_t output) {
+        uint16_t effective = delayed[head];
+        delayed[head] = output;
+        head = (head + 1) % DEAD_TIME;
+        float_t dt = PERIOD / 1000.0f;
+        temperature += dt * ((AMBIENT - temperature) / TAU - COOLING * effective / CONTROL_OUTPUT_MAX);
+    }
+};
+
+// Runs the closed loop for `samples` periods, starting at `now`:
+uint32_t run(ControlEngine &engine, Cellar &cellar, uint32_t now, uint32_t samples) {
+    for (uint32_t i = 0; i < samples; i++, now += PERIOD) {
+        cellar.step(engine.update(cellar.reading(), LOWER, UPPER, now));
+    }
+    return now;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_bang_bang_keeps_the_former_behaviour() {
+    ControlEngine engine(CONFIG, GAINS);
+    TEST_ASSERT_EQUAL_UINT16(0,    engine.update(1200, LOWER, UPPER, 0));
+    TEST_ASSERT_EQUAL_UINT16(0,    engine.update(1400, LOWER, UPPER, 2000));
+    TEST_ASSERT_EQUAL_UINT16(1000, engine.update(1401, LOWER, UPPER, 4000));
+    TEST_ASSERT_EQUAL_UINT16(1000, engine.update(1360, LOWER, UPPER, 6000));
+    TEST_ASSERT_EQUAL_UINT16(0,    engine.update(1350, LOWER, UPPER, 8000));
+    TEST_ASSERT_EQUAL_UINT16(0,    engine.update(1390, LOWER, UPPER, 10000));
+}
+
+void test_proportional_action_around_the_middle_of_the_range() {
+    ControlEngine engine(CONFIG, GAINS);
+    engine.setMode(ControlMode::Pid, 0);
+    TEST_ASSERT_EQUAL_UINT16(200, engine.update(1400, LOWER, UPPER, 0));
+    TEST_ASSERT_EQUAL_INT32(1200, engine.setpoint());
+    TEST_ASSERT_EQUAL_UINT16(50,  engine.update(1250, LOWER, UPPER, 2000));
+    TEST_ASSERT_EQUAL_UINT16(0,   engine.update(1100, LOWER, UPPER, 4000));
+    TEST_ASSERT_EQUAL_UINT16(1000, engine.update(2500, LOWER, UPPER, 6000));
+}
+
+void test_integral_action_removes_the_offset() {
+    ControlEngine engine(CONFIG, { 100, 600, 0 });
+    engine.setMode(ControlMode::Pid, 0);
+    // 1 °C of error during the integral time doubles the proportional action
+    uint16_t output = 0;
+    for (uint32_t now = 0; now <= 600 * 1000; now += PERIOD) output = engine.update(1300, LOWER, UPPER, now);
+    TEST_ASSERT_UINT16_WITHIN(1, 200, output);
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 100, engine.integral());
+}
+
+void test_integral_does_not_wind_up_while_saturated() {
+    ControlEngine engine(CONFIG, { 100, 600, 0 });
+    engine.setMode(ControlMode::Pid, 0);
+    uint32_t now = 0;
+    for (; now < 3600 * 1000; now += PERIOD) engine.update(2200, LOWER, UPPER, now);
+    TEST_ASSERT_EQUAL_UINT16(1000, engine.output());
+    TEST_ASSERT_TRUE(engine.integral() <= 1000);
+
+    // as soon as the setpoint is crossed, the output drops
+    TEST_ASSERT_TRUE(engine.update(1000, LOWER, UPPER, now) < 1000);
+}
+
+void test_derivative_acts_on_the_measurement() {
+    ControlEngine engine(CONFIG, { 100, 0, 60 });
+    engine.setMode(ControlMode::Pid, 0);
+    engine.update(1200, LOWER, UPPER, 0);
+    // 0.1 °C in 2 s, over 60 s of derivative time: 3 °C of equivalent error
+    TEST_ASSERT_EQUAL_UINT16(310, engine.update(1210, LOWER, UPPER, 2000));
+    // a change of the range does not kick the output
+    TEST_ASSERT_EQUAL_UINT16(0, engine.update(1210, LOWER + 100, UPPER + 100, 4000));
+}
+
+void test_gains_are_clamped() {
+    ControlEngine engine(CONFIG, { 1e9, 1e-6, 1e9 });
+    TEST_ASSERT_EQUAL_FLOAT(PID_MAX_KP,   engine.gains().kp);
+    TEST_ASSERT_EQUAL_FLOAT(PID_MAX_TIME, engine.gains().td);
+    TEST_ASSERT_TRUE(engine.gains().ti > 0);
+
+    // the integral time still acts, instead of disabling the integral
+    engine.setGains({ 1, 1e-6, 0 });
+    engine.setMode(ControlMode::Pid, 0);
+    engine.update(1201, LOWER, UPPER, 0);
+    engine.update(1201, LOWER, UPPER, PERIOD);
+    TEST_ASSERT_TRUE(engine.integral() > 0);
+}
+
+void test_switch_to_pid_is_bumpless() {
+    ControlEngine engine(CONFIG, { 100, 600, 0 });
+    TEST_ASSERT_EQUAL_UINT16(1000, engine.update(1500, LOWER, UPPER, 0));
+    engine.setMode(ControlMode::Pid, 2000);
+    TEST_ASSERT_EQUAL_UINT16(1000, engine.update(1450, LOWER, UPPER, 2000));
+}
+
+void test_autotune_finds_stable_gains() {
+    ControlEngine engine(CONFIG, GAINS);
+    Cellar        cellar(15);
+    engine.setMode(ControlMode::Autotune, 0);
+
+    uint32_t now = 0;
+    while (engine.mode() == ControlMode::Autotune && now < CONFIG.tuneTimeout) now = run(engine, cellar, now, 1);
+    TEST_ASSERT_TRUE(engine.mode() == ControlMode::Pid);
+    TEST_ASSERT_TRUE(engine.gains().kp > 0);
+    TEST_ASSERT_TRUE(engine.gains().ti > 0);
+    TEST_ASSERT_TRUE(engine.gains().td > 0);
+
+    // the tuned loop settles at the middle of the range
+    now = run(engine, cellar, now, 6 * 1800);
+    float_t worst = 0;
+    for (uint32_t i = 0; i < 1800; i++) {
+        now = run(engine, cellar, now, 1);
+        worst = fmaxf(worst, fabsf(cellar.temperature - 12));
+    }
+    TEST_ASSERT_TRUE(worst < 0.2);
+}
+
+void test_autotune_gives_up_without_oscillation() {
+    ControlEngine engine(CONFIG, GAINS);
+    engine.setMode(ControlMode::Autotune, 0);
+    uint32_t now = 0;
+    for (; now < CONFIG.tuneTimeout; now += 60 * 1000) engine.update(1300, LOWER, UPPER, now);
+    engine.update(1300, LOWER, UPPER, now);
+    TEST_ASSERT_TRUE(engine.mode() == ControlMode::BangBang);
+}
+
+void test_relay_on_time_follows_the_output() {
+    constexpr uint32_t WINDOW = 900, MIN_ON = 300, MIN_OFF = 180;
+    TEST_ASSERT_EQUAL_UINT32(0,      relayOnTime(0,    WINDOW, MIN_ON, MIN_OFF));
+    TEST_ASSERT_EQUAL_UINT32(450,    relayOnTime(500,  WINDOW, MIN_ON, MIN_OFF));
+    TEST_ASSERT_EQUAL_UINT32(WINDOW, relayOnTime(1000, WINDOW, MIN_ON, MIN_OFF));
+}
+
+void test_relay_on_time_respects_the_minimum_times() {
+    constexpr uint32_t WINDOW = 900, MIN_ON = 300, MIN_OFF = 180;
+    TEST_ASSERT_EQUAL_UINT32(0,      relayOnTime(100, WINDOW, MIN_ON, MIN_OFF)); //  90 s
+    TEST_ASSERT_EQUAL_UINT32(MIN_ON, relayOnTime(200, WINDOW, MIN_ON, MIN_OFF)); // 180 s
+    TEST_ASSERT_EQUAL_UINT32(720,    relayOnTime(850, WINDOW, MIN_ON, MIN_OFF)); // 135 s off
+    TEST_ASSERT_EQUAL_UINT32(WINDOW, relayOnTime(950, WINDOW, MIN_ON, MIN_OFF)); //  45 s off
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_bang_bang_keeps_the_former_behaviour);
+    RUN_TEST(test_proportional_action_around_the_middle_of_the_range);
+    RUN_TEST(test_integral_action_removes_the_offset);
+    RUN_TEST(test_integral_does_not_wind_up_while_saturated);
+    RUN_TEST(test_derivative_acts_on_the_measurement);
+    RUN_TEST(test_gains_are_clamped);
+    RUN_TEST(test_switch_to_pid_is_bumpless);
+    RUN_TEST(test_autotune_finds_stable_gains);
+    RUN_TEST(test_autotune_gives_up_without_oscillation);
+    RUN_TEST(test_relay_on_time_follows_the_output);
+    RUN_TEST(test_relay_on_time_respects_the_minimum_times);
+    return UNITY_END();
+}
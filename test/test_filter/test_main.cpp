@@ -0,0 +1,137 @@
+/**
+ * Unit tests of the signal filtering (lib/thermostat/SignalFilter).
+ *
+ * The readings are produced by a fake sensor, which replays a script of
+ * values instead of driving a DHT.
+ */
+
+#include <unity.h>
+#include <Sensor.h>
+#include <SignalFilter.h>
+
+constexpr uint32_t     PERIOD   = 2000; // -> sampling period, in milliseconds
+constexpr FilterConfig RAW      = { 1, 1,   1000, 0,    1 }; // -> no filtering at all
+constexpr FilterConfig SMOOTHED = { 5, 0.4, 1.5,  0.05, 3 };
+
+class FakeSensor : public Sensor {
+public:
+    FakeSensor(const float_t *script, uint8_t length) : Sensor("fake"), script(script), length(length), index(0) {}
+
+    void     begin() override {}
+    uint32_t startConversion() override { return 0; }
+
+    bool collect(Reading &reading) override {
+        reading.temperature = index < length ? script[index++] : NAN;
+        reading.humidity    = NAN;
+        return !isnan(reading.temperature);
+    }
+
+private:
+    const float_t *script;
+    uint8_t        length;
+    uint8_t        index;
+};
+
+// Feeds the whole script of a sensor to a filter, one reading per period
+
+float_t run(Sensor &sensor, SignalFilter &filter, uint8_t samples, uint8_t *rejected = nullptr) {
+    Reading reading;
+    for (uint8_t i = 0; i < samples; i++) {
+        sensor.collect(reading);
+        if (filter.update(reading.temperature, (i + 1) * PERIOD) == SignalFilter::Rejected && rejected) (*rejected)++;
+    }
+    return filter.value();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_no_value_before_the_first_reading() {
+    SignalFilter filter(SMOOTHED);
+    TEST_ASSERT_TRUE(isnan(filter.value()));
+}
+
+void test_first_reading_is_taken_as_is() {
+    SignalFilter filter(SMOOTHED);
+    TEST_ASSERT_EQUAL(SignalFilter::Accepted, filter.update(12.0, PERIOD));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 12.0, filter.value());
+}
+
+void test_without_filtering_the_readings_go_through() {
+    const float_t script[] = { 10, 30, 5 };
+    FakeSensor   sensor(script, 3);
+    SignalFilter filter(RAW);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 5, run(sensor, filter, 3));
+}
+
+void test_missing_reading_holds_the_last_good_value() {
+    SignalFilter filter(SMOOTHED);
+    filter.update(12.0, PERIOD);
+    TEST_ASSERT_EQUAL(SignalFilter::Missing, filter.update(NAN, 2 * PERIOD));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 12.0, filter.value());
+    TEST_ASSERT_EQUAL_UINT32(PERIOD, filter.age(2 * PERIOD));
+}
+
+void test_single_spike_is_rejected() {
+    const float_t script[] = { 12, 12, 25, 12, 12 };
+    FakeSensor   sensor(script, 5);
+    SignalFilter filter(SMOOTHED);
+    uint8_t rejected = 0;
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 12.0, run(sensor, filter, 5, &rejected));
+    TEST_ASSERT_EQUAL_UINT8(1, rejected);
+}
+
+void test_persistent_step_is_eventually_followed() {
+    const float_t script[] = { 12, 12, 20, 20, 20, 20 };
+    FakeSensor   sensor(script, 6);
+    SignalFilter filter(SMOOTHED);
+    uint8_t rejected = 0;
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 20.0, run(sensor, filter, 6, &rejected));
+    TEST_ASSERT_EQUAL_UINT8(SMOOTHED.maxRejects - 1, rejected);
+}
+
+void test_tolerance_grows_with_the_elapsed_time() {
+    SignalFilter filter(SMOOTHED);
+    filter.update(12.0, 0);
+    // 3°C after 10 s is rejected, but not after 60 s (1.5 + 0.05 * 60 = 4.5)
+    TEST_ASSERT_EQUAL(SignalFilter::Rejected, filter.update(15.0, 10000));
+    TEST_ASSERT_EQUAL(SignalFilter::Accepted, filter.update(15.0, 60000));
+}
+
+void test_median_ignores_isolated_quantization_steps() {
+    const float_t script[] = { 12, 13, 12, 12, 13, 12 };
+    FakeSensor   sensor(script, 6);
+    SignalFilter filter({ 5, 1, 1.5, 0.05, 3 }); // -> median only
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 12.0, run(sensor, filter, 6));
+}
+
+void test_median_of_an_even_window_is_the_mean_of_the_middle_values() {
+    SignalFilter filter({ 4, 1, 10, 0, 3 });
+    filter.update(10, 0);
+    filter.update(11, 1000);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 10.5, filter.value());
+}
+
+void test_moving_average_converges() {
+    SignalFilter filter({ 1, 0.5, 10, 0, 3 }); // -> EMA only
+    filter.update(10, 0);
+    filter.update(12, 1000);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 11.0, filter.value());
+    for (uint32_t t = 2000; t < 40000; t += 1000) filter.update(12, t);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 12.0, filter.value());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_value_before_the_first_reading);
+    RUN_TEST(test_first_reading_is_taken_as_is);
+    RUN_TEST(test_without_filtering_the_readings_go_through);
+    RUN_TEST(test_missing_reading_holds_the_last_good_value);
+    RUN_TEST(test_single_spike_is_rejected);
+    RUN_TEST(test_persistent_step_is_eventually_followed);
+    RUN_TEST(test_tolerance_grows_with_the_elapsed_time);
+    RUN_TEST(test_median_ignores_isolated_quantization_steps);
+    RUN_TEST(test_median_of_an_even_window_is_the_mean_of_the_middle_values);
+    RUN_TEST(test_moving_average_converges);
+    return UNITY_END();
+}
@@ -0,0 +1,47 @@
+/**
+ * Unit tests of the formatting of the readings (lib/thermostat/Format).
+ */
+
+#include <unity.h>
+#include <Format.h>
+
+char buffer[80];
+
+void setUp() {}
+void tearDown() {}
+
+void test_values_have_one_decimal() {
+    formatJsonValue(12.34, true, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("12.3", buffer);
+    formatJsonValue(-4.04, true, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("-4.0", buffer);
+}
+
+void test_unavailable_values_are_null() {
+    formatJsonValue(12, false, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("null", buffer);
+    formatJsonValue(NAN, true, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("null", buffer);
+}
+
+void test_reading_document() {
+    formatReadingJson(1, "rack", 11.5, NAN, true, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("{\"sensor\":1,\"name\":\"rack\",\"temp\":11.5,\"humidity\":null}", buffer);
+    formatReadingJson(0, "cellar", 11.5, 70, false, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("{\"sensor\":0,\"name\":\"cellar\",\"temp\":null,\"humidity\":null}", buffer);
+}
+
+void test_reading_document_is_truncated_to_the_buffer() {
+    char small[16];
+    formatReadingJson(0, "cellar", 11.5, 70, true, small, sizeof(small));
+    TEST_ASSERT_EQUAL_STRING("{\"sensor\":0,\"na", small);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_values_have_one_decimal);
+    RUN_TEST(test_unavailable_values_are_null);
+    RUN_TEST(test_reading_document);
+    RUN_TEST(test_reading_document_is_truncated_to_the_buffer);
+    return UNITY_END();
+}
@@ -0,0 +1,225 @@
+/**
+ * Unit tests of the event journal (lib/thermostat/Journal).
+ */
+
+#include <string.h>
+#include <unity.h>
+#include <Journal.h>
+
+// NOR flash memory: a write can only clear bits, and is undone by an erase
+// of the whole sector.
+
+constexpr uint32_t SECTORS = 4;
+
+struct FakeFlash : JournalFlash {
+    uint8_t  memory[SECTORS * JOURNAL_SECTOR_SIZE];
+    uint32_t erases[SECTORS];
+    uint32_t size = sizeof(memory);
+    bool     broken = false; // -> the erases fail
+
+    FakeFlash() {
+        memset(memory, 0xff, sizeof(memory));
+        memset(erases, 0, sizeof(erases));
+    }
+
+    bool read(uint32_t offset, void *data, size_t length) override {
+        if (offset + length > size) return false;
+        memcpy(data, memory + offset, length);
+        return true;
+    }
+
+    bool write(uint32_t offset, const void *data, size_t length) override {
+        if (offset + length > size) return false;
+        for (size_t i = 0; i < length; i++) memory[offset + i] &= ((const uint8_t*) data)[i];
+        return true;
+    }
+
+    bool erase(uint32_t offset, size_t length) override {
+        if (broken || offset % JOURNAL_SECTOR_SIZE || length % JOURNAL_SECTOR_SIZE || offset + length > size) return false;
+        memset(memory + offset, 0xff, length);
+        for (uint32_t s = offset / JOURNAL_SECTOR_SIZE; s < (offset + length) / JOURNAL_SECTOR_SIZE; s++) erases[s]++;
+        return true;
+    }
+};
+
+FakeFlash flash;
+
+JournalRecord event(JournalEvent type, int16_t value) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.time   = 1760000000 + value;
+    record.uptime = value;
+    record.type   = (uint8_t) type;
+    record.value  = value;
+    return record;
+}
+
+void appendEvents(Journal &journal, uint32_t count, uint16_t batch = 8) {
+    JournalRecord records[32];
+    for (uint32_t done = 0; done < count; done += batch) {
+        uint16_t n = count - done < batch ? count - done : batch;
+        for (uint16_t i = 0; i < n; i++) records[i] = event(JournalEvent::Excursion, (journal.end() + i) % 30000);
+        TEST_ASSERT_TRUE(journal.append(records, n));
+    }
+}
+
+void setUp() {
+    flash = FakeFlash();
+}
+
+void tearDown() {}
+
+void test_empty_partition_is_formatted() {
+    Journal journal;
+    TEST_ASSERT_TRUE(journal.begin(&flash, flash.size));
+    TEST_ASSERT_TRUE(journal.ready());
+    TEST_ASSERT_EQUAL(0, journal.first());
+    TEST_ASSERT_EQUAL(0, journal.end());
+    TEST_ASSERT_EQUAL(1, flash.erases[0]);
+
+    JournalRecord record;
+    TEST_ASSERT_FALSE(journal.read(0, record));
+}
+
+void test_records_round_trip() {
+    Journal journal;
+    journal.begin(&flash, flash.size);
+
+    JournalRecord records[] = { event(JournalEvent::Boot, 0), event(JournalEvent::SensorFailure, -42) };
+    records[1].source = 2;
+    TEST_ASSERT_TRUE(journal.append(records, 2));
+    TEST_ASSERT_EQUAL(2, journal.end());
+
+    JournalRecord record;
+    TEST_ASSERT_TRUE(journal.read(1, record));
+    TEST_ASSERT_EQUAL(1, record.sequence);
+    TEST_ASSERT_EQUAL((uint8_t) JournalEvent::SensorFailure, record.type);
+    TEST_ASSERT_EQUAL(2, record.source);
+    TEST_ASSERT_EQUAL(-42, record.value);
+    TEST_ASSERT_FALSE(journal.read(2, record));
+}
+
+void test_journal_survives_a_restart() {
+    Journal journal;
+    journal.begin(&flash, flash.size);
+    appendEvents(journal, JOURNAL_SECTOR_RECORDS + 50);
+
+    Journal restarted;
+    TEST_ASSERT_TRUE(restarted.begin(&flash, flash.size));
+    TEST_ASSERT_EQUAL(0, restarted.first());
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS + 50, restarted.end());
+
+    JournalRecord record;
+    TEST_ASSERT_TRUE(restarted.read(JOURNAL_SECTOR_RECORDS + 49, record));
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS + 49, record.value);
+    TEST_ASSERT_TRUE(restarted.read(0, record));
+
+    // and goes on where it stopped
+    appendEvents(restarted, 1);
+    TEST_ASSERT_TRUE(restarted.read(JOURNAL_SECTOR_RECORDS + 50, record));
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS + 50, record.value);
+}
+
+void test_oldest_sector_is_overwritten() {
+    Journal journal;
+    journal.begin(&flash, flash.size);
+    appendEvents(journal, SECTORS * JOURNAL_SECTOR_RECORDS + 10);
+
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS, journal.first());
+    JournalRecord record;
+    TEST_ASSERT_FALSE(journal.read(JOURNAL_SECTOR_RECORDS - 1, record));
+    TEST_ASSERT_TRUE(journal.read(JOURNAL_SECTOR_RECORDS, record));
+    TEST_ASSERT_TRUE(journal.read(journal.end() - 1, record));
+
+    Journal restarted;
+    restarted.begin(&flash, flash.size);
+    TEST_ASSERT_EQUAL(journal.first(), restarted.first());
+    TEST_ASSERT_EQUAL(journal.end(), restarted.end());
+    TEST_ASSERT_TRUE(restarted.read(JOURNAL_SECTOR_RECORDS, record));
+}
+
+void test_sectors_wear_evenly() {
+    Journal journal;
+    journal.begin(&flash, flash.size);
+    appendEvents(journal, 25 * SECTORS * JOURNAL_SECTOR_RECORDS, 16);
+
+    for (uint32_t s = 0; s < SECTORS; s++) {
+        TEST_ASSERT_UINT16_WITHIN(1, 25, flash.erases[s]);
+    }
+}
+
+void test_torn_record_is_skipped() {
+    Journal journal;
+    journal.begin(&flash, flash.size);
+    appendEvents(journal, 10);
+
+    // power failure in the middle of the last write
+    uint32_t offset = sizeof(JournalHeader) + 9 * sizeof(JournalRecord) + 12;
+    memset(flash.memory + offset, 0xff, sizeof(JournalRecord) - 12);
+
+    Journal restarted;
+    restarted.begin(&flash, flash.size);
+    TEST_ASSERT_EQUAL(10, restarted.end());
+
+    JournalRecord record;
+    TEST_ASSERT_TRUE(restarted.read(8, record));
+    TEST_ASSERT_FALSE(restarted.read(9, record));
+}
+
+void test_records_without_a_sector_can_be_appended_again() {
+    Journal journal;
+    TEST_ASSERT_TRUE(journal.begin(&flash, flash.size));
+    appendEvents(journal, JOURNAL_SECTOR_RECORDS - 2);
+
+    JournalRecord records[4];
+    for (uint16_t i = 0; i < 4; i++) records[i] = event(JournalEvent::Excursion, i);
+    flash.broken = true;
+    TEST_ASSERT_FALSE(journal.append(records, 4));
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS, journal.end()); // -> the first 2 fitted
+
+    flash.broken = false;
+    TEST_ASSERT_TRUE(journal.append(records + 2, 2));
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS + 2, journal.end());
+
+    JournalRecord record;
+    for (uint32_t sequence = 0; sequence < journal.end(); sequence++) {
+        TEST_ASSERT_TRUE(journal.read(sequence, record));
+    }
+    TEST_ASSERT_EQUAL(3, record.value);
+}
+
+void test_foreign_content_is_formatted() {
+    memset(flash.memory, 0x5a, sizeof(flash.memory));
+
+    Journal journal;
+    TEST_ASSERT_TRUE(journal.begin(&flash, flash.size));
+    TEST_ASSERT_EQUAL(0, journal.end());
+    appendEvents(journal, 2 * JOURNAL_SECTOR_RECORDS);
+
+    JournalRecord record;
+    TEST_ASSERT_TRUE(journal.read(JOURNAL_SECTOR_RECORDS + 1, record));
+    TEST_ASSERT_EQUAL(JOURNAL_SECTOR_RECORDS + 1, record.value);
+}
+
+void test_partition_too_small() {
+    Journal journal;
+    TEST_ASSERT_FALSE(journal.begin(&flash, JOURNAL_SECTOR_SIZE));
+    TEST_ASSERT_FALSE(journal.ready());
+
+    JournalRecord record = event(JournalEvent::Boot, 0);
+    TEST_ASSERT_FALSE(journal.append(&record, 1));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_partition_is_formatted);
+    RUN_TEST(test_records_round_trip);
+    RUN_TEST(test_journal_survives_a_restart);
+    RUN_TEST(test_oldest_sector_is_overwritten);
+    RUN_TEST(test_sectors_wear_evenly);
+    RUN_TEST(test_torn_record_is_skipped);
+    RUN_TEST(test_records_without_a_sector_can_be_appended_again);
+    RUN_TEST(test_foreign_content_is_formatted);
+    RUN_TEST(test_partition_too_small);
+    return UNITY_END();
+}
@@ -0,0 +1,162 @@
+/**
+ * Unit tests of the scheduled temperature ranges (lib/thermostat/Schedule).
+ */
+
+#include <string.h>
+#include <unity.h>
+#include <Schedule.h>
+
+ScheduleTable table;
+
+void setRule(uint8_t slot, const char *text) {
+    TEST_ASSERT_TRUE(parseScheduleRule(text, table.rules[slot]));
+}
+
+// 2026-10-12 is a Monday
+uint32_t at(unsigned month, unsigned day, unsigned hour, unsigned minute) {
+    return localMinutes(2026, month, day, hour, minute);
+}
+
+void setUp() {
+    memset(&table, 0, sizeof(table));
+    table.enabled = true;
+}
+
+void tearDown() {}
+
+void test_civil_calendar() {
+    TEST_ASSERT_EQUAL_UINT32(0,     civilDay(1970, 1, 1));
+    TEST_ASSERT_EQUAL_UINT32(11016, civilDay(2000, 2, 29));
+    TEST_ASSERT_EQUAL_UINT32(20738, civilDay(2026, 10, 12));
+
+    int year; unsigned month, day;
+    civilDate(11016, year, month, day);
+    TEST_ASSERT_EQUAL(2000, year);
+    TEST_ASSERT_EQUAL(2, month);
+    TEST_ASSERT_EQUAL(29, day);
+}
+
+void test_rule_round_trip() {
+    const char *rules[] = { "12345 07:30 12.0 14.0", "67 09:00 11.0 13.5 0301-0415", "* 22:00 -2.5 12.0 1101-0228" };
+    char buffer[SCHEDULE_RULE_SIZE + 1];
+    for (const char *text : rules) {
+        ScheduleRule rule;
+        TEST_ASSERT_TRUE(parseScheduleRule(text, rule));
+        formatScheduleRule(rule, buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_STRING(text, buffer);
+    }
+}
+
+void test_empty_and_invalid_rules() {
+    ScheduleRule rule;
+    TEST_ASSERT_TRUE(parseScheduleRule("", rule));
+    TEST_ASSERT_EQUAL_UINT8(0, rule.days);
+    TEST_ASSERT_TRUE(parseScheduleRule("off", rule));
+
+    const char *invalid[] = {
+        "8 07:30 12 14", "12345 7:30", "12345 24:00 12 14", "12345 07:3 12 14", "12345 07:30 14 12",
+        "12345 07:30 12 14 1301-0101", "12345 07:30 12 14 0301", "12345 07:30 12 14 x", " 07:30 12 14"
+    };
+    for (const char *text : invalid) {
+        TEST_ASSERT_FALSE(parseScheduleRule(text, rule));
+        TEST_ASSERT_EQUAL_UINT8(0, rule.days);
+    }
+}
+
+void test_weekdays_and_periods_of_the_year() {
+    ScheduleRule rule;
+    parseScheduleRule("5 07:00 12 14", rule);
+    TEST_ASSERT_FALSE(ruleAppliesOn(rule, civilDay(2026, 10, 15)));
+    TEST_ASSERT_TRUE(ruleAppliesOn(rule, civilDay(2026, 10, 16))); // -> Friday
+
+    parseScheduleRule("* 07:00 12 14 1101-0228", rule);
+    TEST_ASSERT_TRUE(ruleAppliesOn(rule, civilDay(2026, 12, 31)));
+    TEST_ASSERT_TRUE(ruleAppliesOn(rule, civilDay(2027, 1, 1)));
+    TEST_ASSERT_FALSE(ruleAppliesOn(rule, civilDay(2027, 3, 1)));
+}
+
+void test_latest_transition_is_in_force() {
+    setRule(0, "12345 07:00 12 14");
+    setRule(1, "12345 19:00 10 12");
+    ScheduleEvaluator evaluator;
+
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 14, 12, 0)));
+    TEST_ASSERT_EQUAL(0, evaluator.active());
+    TEST_ASSERT_EQUAL_UINT32(at(10, 14, 19, 0), evaluator.nextTransition());
+
+    // the evening rule of Friday lasts all the weekend
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 18, 12, 0)));
+    TEST_ASSERT_EQUAL(1, evaluator.active());
+    TEST_ASSERT_EQUAL_UINT32(at(10, 19, 7, 0), evaluator.nextTransition());
+}
+
+void test_table_is_only_scanned_at_transitions() {
+    setRule(0, "* 07:00 12 14");
+    ScheduleEvaluator evaluator;
+    evaluator.update(table, at(10, 14, 12, 0));
+
+    // a change of the table is only taken into account once invalidated
+    setRule(1, "* 12:30 10 12");
+    TEST_ASSERT_FALSE(evaluator.update(table, at(10, 14, 12, 31)));
+    TEST_ASSERT_EQUAL(0, evaluator.active());
+
+    evaluator.invalidate();
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 14, 12, 31)));
+    TEST_ASSERT_EQUAL(1, evaluator.active());
+    TEST_ASSERT_FALSE(evaluator.update(table, at(10, 14, 12, 32)));
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 15, 7, 0)));
+    TEST_ASSERT_EQUAL(0, evaluator.active());
+}
+
+void test_last_rule_wins_at_the_same_minute() {
+    setRule(0, "* 07:00 12 14");
+    setRule(1, "* 07:00 10 12 1001-1031");
+    ScheduleEvaluator evaluator;
+    evaluator.update(table, at(10, 14, 8, 0));
+    TEST_ASSERT_EQUAL(1, evaluator.active());
+}
+
+void test_clock_going_back() {
+    setRule(0, "* 07:00 12 14");
+    setRule(1, "* 19:00 10 12");
+    ScheduleEvaluator evaluator;
+    evaluator.update(table, at(10, 14, 19, 30));
+    TEST_ASSERT_EQUAL(1, evaluator.active());
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 14, 18, 30)));
+    TEST_ASSERT_EQUAL(0, evaluator.active());
+}
+
+void test_recurring_rule_is_applied_again() {
+    setRule(0, "* 07:00 12 14");
+    ScheduleEvaluator evaluator;
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 14, 7, 0)));
+    TEST_ASSERT_FALSE(evaluator.update(table, at(10, 14, 12, 0)));
+
+    // the same rule, but a new transition (which ends an override)
+    TEST_ASSERT_TRUE(evaluator.update(table, at(10, 15, 7, 0)));
+    TEST_ASSERT_EQUAL(0, evaluator.active());
+    TEST_ASSERT_FALSE(evaluator.update(table, at(10, 15, 7, 1)));
+}
+
+void test_no_rule() {
+    setRule(0, "* 07:00 12 14 0101-0131");
+    ScheduleEvaluator evaluator;
+    TEST_ASSERT_FALSE(evaluator.update(table, at(10, 14, 12, 0)));
+    TEST_ASSERT_EQUAL(-1, evaluator.active());
+    TEST_ASSERT_EQUAL_UINT32(at(10, 22, 0, 0), evaluator.nextTransition());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_civil_calendar);
+    RUN_TEST(test_rule_round_trip);
+    RUN_TEST(test_empty_and_invalid_rules);
+    RUN_TEST(test_weekdays_and_periods_of_the_year);
+    RUN_TEST(test_latest_transition_is_in_force);
+    RUN_TEST(test_table_is_only_scanned_at_transitions);
+    RUN_TEST(test_last_rule_wins_at_the_same_minute);
+    RUN_TEST(test_clock_going_back);
+    RUN_TEST(test_recurring_rule_is_applied_again);
+    RUN_TEST(test_no_rule);
+    return UNITY_END();
+}
@@ -0,0 +1,123 @@
+/**
+ * Unit tests of the persistent settings layout (lib/thermostat/Settings).
+ *
+ * The NVS blob is simulated by a plain byte array, written and read back
+ * the way `Preferences::putBytes()` and `getBytes()` do.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <unity.h>
+#include <Settings.h>
+
+uint8_t flash[sizeof(SettingsRecord)];
+
+void store(const SettingsRecord &record) {
+    memcpy(flash, &record, sizeof(record));
+}
+
+SettingsRecord load() {
+    SettingsRecord record;
+    memcpy(&record, flash, sizeof(record));
+    return record;
+}
+
+void setUp() {
+    memset(flash, 0xff, sizeof(flash)); // -> erased flash
+}
+
+void tearDown() {}
+
+void test_round_trip() {
+    SettingsRecord record;
+    makeSettingsRecord(record, 8.5, 12);
+    store(record);
+
+    SettingsRecord loaded = load();
+    TEST_ASSERT_TRUE(isValidSettingsRecord(loaded));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 8.5, loaded.lower);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 12.0, loaded.upper);
+}
+
+void test_erased_flash_is_not_a_record() {
+    TEST_ASSERT_FALSE(isValidSettingsRecord(load()));
+}
+
+void test_damaged_record_is_detected() {
+    SettingsRecord record;
+    makeSettingsRecord(record, 8.5, 12);
+    store(record);
+    flash[offsetof(SettingsRecord, upper)] ^= 0x01;
+    TEST_ASSERT_FALSE(isValidSettingsRecord(load()));
+}
+
+void test_other_version_is_rejected() {
+    SettingsRecord record;
+    makeSettingsRecord(record, 8.5, 12);
+    record.version = SETTINGS_VERSION + 1;
+    record.crc     = settingsCRC(record);
+    TEST_ASSERT_FALSE(isValidSettingsRecord(record));
+}
+
+// The records written by the firmware (ROM CRC) must be readable by the host
+// build: 01 000000 (padding) 00000841 (8.5) 00004041 (12.0)
+
+void test_crc_is_the_standard_crc32() {
+    SettingsRecord record;
+    makeSettingsRecord(record, 8.5, 12);
+    TEST_ASSERT_EQUAL_UINT32(12, offsetof(SettingsRecord, crc));
+    TEST_ASSERT_EQUAL_HEX32(0x98124797, record.crc); // -> zlib.crc32() of the 12 bytes
+}
+
+void test_control_round_trip() {
+    ControlRecord record;
+    makeControlRecord(record, ControlMode::Pid, { 400, 1800, 60 });
+    TEST_ASSERT_TRUE(isValidControlRecord(record));
+    TEST_ASSERT_TRUE((ControlMode) record.mode == ControlMode::Pid);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 1800.0, record.gains.ti);
+
+    record.gains.kp = 0;
+    TEST_ASSERT_FALSE(isValidControlRecord(record));
+}
+
+void test_unknown_control_mode_is_rejected() {
+    ControlRecord record;
+    makeControlRecord(record, ControlMode::Pid, { 400, 1800, 60 });
+    record.mode = 3;
+    record.crc  = controlCRC(record);
+    TEST_ASSERT_FALSE(isValidControlRecord(record));
+}
+
+void test_schedule_round_trip() {
+    ScheduleTable table;
+    memset(&table, 0xa5, sizeof(table)); // -> garbage in the padding
+    table.enabled = true;
+    for (ScheduleRule &rule : table.rules) parseScheduleRule("", rule);
+    parseScheduleRule("12345 07:30 12.0 14.0", table.rules[3]);
+
+    ScheduleRecord record, other;
+    makeScheduleRecord(record, table);
+    TEST_ASSERT_TRUE(isValidScheduleRecord(record));
+    TEST_ASSERT_TRUE(record.table.enabled);
+    TEST_ASSERT_EQUAL_UINT32(7 * 60 + 30, record.table.rules[3].minute);
+
+    memset(&table, 0x5a, sizeof(table));
+    table.enabled = true;
+    for (ScheduleRule &rule : table.rules) parseScheduleRule("", rule);
+    parseScheduleRule("12345 07:30 12.0 14.0", table.rules[3]);
+    makeScheduleRecord(other, table);
+    TEST_ASSERT_EQUAL_HEX32(record.crc, other.crc);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_erased_flash_is_not_a_record);
+    RUN_TEST(test_damaged_record_is_detected);
+    RUN_TEST(test_other_version_is_rejected);
+    RUN_TEST(test_crc_is_the_standard_crc32);
+    RUN_TEST(test_control_round_trip);
+    RUN_TEST(test_unknown_control_mode_is_rejected);
+    RUN_TEST(test_schedule_round_trip);
+    return UNITY_END();
+}
@@ -0,0 +1,134 @@
+# ----------------------------------------------------------------------------
+# ESP32 Web Controlled Thermostat
+# ----------------------------------------------------------------------------
+# PlatformIO pre-build script
+# ----------------------------------------------------------------------------
+# The web user interface is not uploaded to SPIFFS as is: the files of the
+# `data` directory are first copied to a staging directory, where the ones
+# that compress well are replaced by their gzipped version (`index.js` ->
+# `index.js.gz`). The SPIFFS image is then built from that staging directory.
+#
+# When the firmware is built with `-D EMBEDDED_ASSETS` (the `embedded`
+# environment), the same files are instead generated as constant byte arrays
+# in `EmbeddedAssets.h`, which the firmware serves straight from flash,
+# without any SPIFFS image.
+#
+# The firmware serves the `.gz` variants with `Content-Encoding: gzip`.
+# ----------------------------------------------------------------------------
+
+Import("env")
+
+import gzip
+import io
+import os
+import shutil
+import zlib
+
+# Files that are already compressed (like the woff2 font) are copied as is.
+COMPRESSED_TYPES = (".html", ".css", ".js", ".ico", ".svg", ".json")
+
+FS_TARGETS = ("buildfs", "uploadfs", "uploadfsota")
+
+EMBEDDED_HEADER = "EmbeddedAssets.h"
+BYTES_PER_LINE  = 16
+
+
+def read_asset(path):
+    """Returns the content to serve for a file, and whether it is gzipped."""
+    with open(path, "rb") as f:
+        content = f.read()
+    if not path.endswith(COMPRESSED_TYPES):
+        return content, False
+    buffer = io.BytesIO()
+    # mtime=0 makes the archive reproducible (and so its ETag)
+    with gzip.GzipFile(filename="", mode="wb", fileobj=buffer, compresslevel=9, mtime=0) as gz:
+        gz.write(content)
+    return buffer.getvalue(), True
+
+
+def list_assets(source):
+    for name in sorted(os.listdir(source)):
+        path = os.path.join(source, name)
+        if os.path.isfile(path):
+            yield name, path
+
+
+def stage_assets(source, target):
+    if os.path.isdir(target):
+        shutil.rmtree(target)
+    os.makedirs(target)
+
+    for name, src in list_assets(source):
+        content, gzipped = read_asset(src)
+        dst = os.path.join(target, name + ".gz" if gzipped else name)
+        with open(dst, "wb") as f:
+            f.write(content)
+        print("  %-16s %6d -> %6d bytes" % (name, os.path.getsize(src), len(content)))
+
+
+def embed_assets(source, header):
+    lines = [
+        "// Generated by tools/compress_assets.py from the `data` directory: do not edit.",
+        "",
+        "#ifndef EMBEDDED_ASSETS_H",
+        "#define EMBEDDED_ASSETS_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "struct EmbeddedFile {",
+        "    const char    *path;    // -> name of the file on SPIFFS",
+        "    const uint8_t *data;",
+        "    uint32_t       size;    // in bytes",
+        "    bool           gzipped;",
+        "    const char    *etag;    // -> same ETag as the SPIFFS file",
+        "};",
+        ""
+    ]
+    files = []
+    for index, (name, path) in enumerate(list_assets(source)):
+        content, gzipped = read_asset(path)
+        lines.append("static const uint8_t EMBEDDED_FILE_%u[] PROGMEM = {" % index)
+        for i in range(0, len(content), BYTES_PER_LINE):
+            lines.append("    " + ", ".join("0x%02x" % b for b in content[i:i + BYTES_PER_LINE]) + ",")
+        lines += ["};", ""]
+        etag = '\\"%08x-%x\\"' % (zlib.crc32(content) & 0xffffffff, len(content))
+        files.append('    { "/%s", EMBEDDED_FILE_%u, %u, %s, "%s" }' % (
+            name, index, len(content), "true" if gzipped else "false", etag))
+        print("  %-16s %6d -> %6d bytes" % (name, os.path.getsize(path), len(content)))
+
+    lines.append("static const EmbeddedFile EMBEDDED_FILES[] = {")
+    lines.append(",\n".join(files))
+    lines += ["};", "", "#endif", ""]
+    text = "\n".join(lines)
+
+    # left untouched if nothing has changed, so as not to rebuild the firmware
+    if os.path.isfile(header):
+        with open(header) as f:
+            if f.read() == text:
+                return
+    with open(header, "w") as f:
+        f.write(text)
+
+
+def has_build_flag(name):
+    flags = env.GetProjectOption("build_flags", "")
+    if isinstance(flags, (list, tuple)):
+        flags = " ".join(flags)
+    return ("-D %s" % name) in flags or ("-D%s" % name) in flags
+
+
+source = env.subst("$PROJECT_DATA_DIR")
+
+if any(t in COMMAND_LINE_TARGETS for t in FS_TARGETS):
+    target = os.path.join(env.subst("$BUILD_DIR"), "data")
+    print("Compressing web assets from %s" % source)
+    stage_assets(source, target)
+    env.Replace(PROJECT_DATA_DIR=target)
+
+elif has_build_flag("EMBEDDED_ASSETS"):
+    target = os.path.join(env.subst("$BUILD_DIR"), "generated")
+    if not os.path.isdir(target):
+        os.makedirs(target)
+    print("Embedding web assets from %s" % source)
+    embed_assets(source, os.path.join(target, EMBEDDED_HEADER))
+    env.Append(CPPPATH=[target])
@@ -0,0 +1,371 @@
+#!/usr/bin/env python3
+# ----------------------------------------------------------------------------
+# ESP32 Web Controlled Thermostat
+# ----------------------------------------------------------------------------
+# HTTP load generator
+# ----------------------------------------------------------------------------
+# Simulates many browsers at once, as described by a scenario (see the
+# `scenarios` directory):
+#
+# - each virtual client first loads the page (the `session` paths), then
+#   polls the routes of the `mix`, picked at random according to their
+#   weights, with a think time between two requests
+# - the `listeners` keep the `/events` stream open, like the dashboards do
+#
+# It reports the throughput and the latency percentiles of each path, which
+# can be compared from one firmware to the next:
+#
+#   python3 tools/loadtest.py 192.168.1.42 tools/scenarios/dashboards.json
+#
+# With `--profile`, the percentiles measured by the firmware itself (built
+# with the `profiling` environment) are fetched from `/profile` at the end of
+# the run. With `--find-max`, the number of clients is increased step by step
+# until the p99 latency or the error rate exceeds its limit, which gives the
+# maximum number of concurrent clients the device can handle.
+#
+# Only the standard library is used. The web server does not keep the
+# connections alive, so each request opens a new one, like the browsers do.
+# ----------------------------------------------------------------------------
+
+import argparse
+import asyncio
+import json
+import os
+import random
+import sys
+import time
+
+SCENARIOS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "scenarios")
+
+DEFAULTS = {
+    "description": "",
+    "clients":     10,          # -> virtual clients polling the mix
+    "listeners":   0,           # -> clients holding the /events stream open
+    "ramp_up":     5.0,         # in seconds, to start all the clients
+    "duration":    30.0,        # in seconds, ramp-up included
+    "think_time":  [1.0, 2.0],  # in seconds, between two requests of a client
+    "revalidate":  True,        # -> sends `If-None-Match` once an ETag is known
+    "session":     [],          # -> paths requested once by each client
+    "mix":         []           # -> [{"path": ..., "weight": ...}]
+}
+
+
+# ----------------------------------------------------------------------------
+# HTTP client
+# ----------------------------------------------------------------------------
+
+class Response:
+    def __init__(self, status, headers, size):
+        self.status  = status
+        self.headers = headers
+        self.size    = size
+
+
+async def read_head(reader):
+    status_line = await reader.readline()
+    if not status_line:
+        raise ConnectionError("connection closed by the server")
+    status = int(status_line.split()[1])
+    headers = {}
+    while True:
+        line = await reader.readline()
+        if line in (b"\r\n", b"\n", b""):
+            break
+        name, _, value = line.decode("latin-1").partition(":")
+        headers[name.strip().lower()] = value.strip()
+    return status, headers
+
+
+async def request(host, port, path, headers=None, timeout=5.0):
+    async def exchange():
+        reader, writer = await asyncio.open_connection(host, port)
+        try:
+            lines = ["GET %s HTTP/1.1" % path, "Host: %s" % host, "Connection: close"]
+            lines += ["%s: %s" % item for item in (headers or {}).items()]
+            writer.write(("\r\n".join(lines) + "\r\n\r\n").encode("latin-1"))
+            await writer.drain()
+            status, response_headers = await read_head(reader)
+            size = len(await reader.read())  # -> until the server closes the connection
+            return Response(status, response_headers, size)
+        finally:
+            writer.close()
+
+    return await asyncio.wait_for(exchange(), timeout)
+
+
+# ----------------------------------------------------------------------------
+# Statistics
+# ----------------------------------------------------------------------------
+
+def percentile(values, rank):
+    """Nearest-rank percentile (the same definition as the firmware)."""
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[max(0, -(-len(ordered) * rank // 100) - 1)]
+
+
+class PathStats:
+    def __init__(self):
+        self.latencies   = []  # in seconds, of the successful requests
+        self.errors      = 0
+        self.not_changed = 0   # -> 304 responses
+
+    @property
+    def count(self):
+        return len(self.latencies) + self.errors
+
+
+class Run:
+    def __init__(self):
+        self.paths       = {}
+        self.in_flight   = 0
+        self.max_flight  = 0
+        self.events      = 0   # -> messages received on the /events streams
+        self.lost_events = 0   # -> streams closed before the end of the run
+        self.elapsed     = 0.0
+
+    def stats(self, path):
+        return self.paths.setdefault(path.split("?")[0], PathStats())
+
+    def totals(self):
+        total = PathStats()
+        for stats in self.paths.values():
+            total.latencies   += stats.latencies
+            total.errors      += stats.errors
+            total.not_changed += stats.not_changed
+        return total
+
+    def error_rate(self):
+        total = self.totals()
+        return 100.0 * total.errors / total.count if total.count else 0.0
+
+    def report(self, out=sys.stdout):
+        columns = "%-18s %8s %7s %6s %8s %8s %8s %8s %8s"
+        out.write(columns % ("path", "requests", "errors", "304", "req/s", "p50 ms", "p90 ms", "p99 ms", "max ms") + "\n")
+        rows = sorted(self.paths.items()) + [("total", self.totals())]
+        for path, stats in rows:
+            out.write(columns % (
+                path, stats.count, stats.errors, stats.not_changed,
+                "%.1f" % (stats.count / self.elapsed if self.elapsed else 0),
+                "%.1f" % (percentile(stats.latencies, 50) * 1000),
+                "%.1f" % (percentile(stats.latencies, 90) * 1000),
+                "%.1f" % (percentile(stats.latencies, 99) * 1000),
+                "%.1f" % (max(stats.latencies, default=0) * 1000)) + "\n")
+        out.write("max. requests in flight: %u\n" % self.max_flight)
+        if self.events or self.lost_events:
+            out.write("events received: %u, streams lost: %u\n" % (self.events, self.lost_events))
+
+
+# ----------------------------------------------------------------------------
+# Virtual clients
+# ----------------------------------------------------------------------------
+
+class Client:
+    def __init__(self, args, scenario, run, deadline):
+        self.args     = args
+        self.scenario = scenario
+        self.run      = run
+        self.deadline = deadline
+        self.etags    = {}
+
+    async def fetch(self, path):
+        headers = {}
+        if self.scenario["revalidate"] and path in self.etags:
+            headers["If-None-Match"] = self.etags[path]
+
+        stats = self.run.stats(path)
+        self.run.in_flight += 1
+        self.run.max_flight = max(self.run.max_flight, self.run.in_flight)
+        start = time.monotonic()
+        try:
+            response = await request(self.args.host, self.args.port, path, headers, self.args.timeout)
+        except (OSError, asyncio.TimeoutError, ValueError, IndexError):
+            stats.errors += 1
+            return
+        finally:
+            self.run.in_flight -= 1
+
+        if response.status >= 400:
+            stats.errors += 1
+            return
+        stats.latencies.append(time.monotonic() - start)
+        if response.status == 304:
+            stats.not_changed += 1
+        if "etag" in response.headers:
+            self.etags[path] = response.headers["etag"]
+
+    async def think(self):
+        think_time = self.scenario["think_time"]
+        if isinstance(think_time, (list, tuple)):
+            think_time = random.uniform(*think_time)
+        await asyncio.sleep(min(think_time, max(0, self.deadline - time.monotonic())))
+
+    async def browse(self):
+        for path in self.scenario["session"]:
+            if time.monotonic() >= self.deadline:
+                return
+            await self.fetch(path)
+
+        mix = self.scenario["mix"]
+        if not mix:
+            return
+        paths   = [entry["path"] for entry in mix]
+        weights = [entry.get("weight", 1) for entry in mix]
+        while time.monotonic() < self.deadline:
+            await self.think()
+            if time.monotonic() < self.deadline:
+                await self.fetch(random.choices(paths, weights)[0])
+
+    async def listen(self):
+        try:
+            reader, writer = await asyncio.wait_for(asyncio.open_connection(self.args.host, self.args.port), self.args.timeout)
+        except (OSError, asyncio.TimeoutError):
+            self.run.lost_events += 1
+            return
+        try:
+            writer.write(("GET /events HTTP/1.1\r\nHost: %s\r\nAccept: text/event-stream\r\n\r\n" % self.args.host).encode())
+            await writer.drain()
+            while True:
+                remaining = self.deadline - time.monotonic()
+                if remaining <= 0:
+                    return
+                try:
+                    line = await asyncio.wait_for(reader.readline(), remaining)
+                except asyncio.TimeoutError:
+                    return
+                if not line:
+                    self.run.lost_events += 1
+                    return
+                if line.startswith(b"data:"):
+                    self.run.events += 1
+        except OSError:
+            self.run.lost_events += 1
+        finally:
+            writer.close()
+
+
+async def run_scenario(args, scenario, clients):
+    run      = Run()
+    start    = time.monotonic()
+    deadline = start + scenario["duration"]
+    ramp_up  = scenario["ramp_up"]
+    total    = clients + scenario["listeners"]
+
+    async def start_client(index, listener):
+        await asyncio.sleep(ramp_up * index / total if total else 0)
+        client = Client(args, scenario, run, deadline)
+        await (client.listen() if listener else client.browse())
+
+    tasks  = [start_client(i, False) for i in range(clients)]
+    tasks += [start_client(clients + i, True) for i in range(scenario["listeners"])]
+    await asyncio.gather(*tasks)
+
+    run.elapsed = time.monotonic() - start
+    return run
+
+
+# ----------------------------------------------------------------------------
+# Profiling mode of the firmware
+# ----------------------------------------------------------------------------
+
+async def fetch_text(args, path):
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(args.host, args.port), args.timeout)
+    try:
+        writer.write(("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % (path, args.host)).encode())
+        await writer.drain()
+        status, _ = await read_head(reader)
+        body = await asyncio.wait_for(reader.read(), args.timeout)
+        return status, body.decode("utf-8", "replace")
+    finally:
+        writer.close()
+
+
+async def reset_profile(args):
+    status, _ = await fetch_text(args, "/profile?reset")
+    if status == 404:
+        sys.exit("The firmware has not been built with the `profiling` environment")
+
+
+async def print_profile(args):
+    _, body = await fetch_text(args, "/profile")
+    print("\nOn-device profile:")
+    print(body, end="")
+
+
+# ----------------------------------------------------------------------------
+# Main program
+# ----------------------------------------------------------------------------
+
+def load_scenario(name):
+    path = name if os.path.exists(name) else os.path.join(SCENARIOS_DIR, name + ".json")
+    with open(path) as f:
+        scenario = dict(DEFAULTS, **json.load(f))
+    if not scenario["session"] and not scenario["mix"] and not scenario["listeners"]:
+        sys.exit("%s: the scenario requests nothing" % path)
+    return scenario
+
+
+async def main(args):
+    scenario = load_scenario(args.scenario)
+    for key in ("clients", "listeners", "duration", "ramp_up"):
+        if getattr(args, key) is not None:
+            scenario[key] = getattr(args, key)
+
+    if scenario["description"]:
+        print(scenario["description"])
+
+    if not args.find_max:
+        if args.profile:
+            await reset_profile(args)
+        print("%u clients, %u listeners, %.0f s\n" % (scenario["clients"], scenario["listeners"], scenario["duration"]))
+        run = await run_scenario(args, scenario, scenario["clients"])
+        run.report()
+        if args.profile:
+            await print_profile(args)
+        return
+
+    # Search of the maximum number of clients:
+    clients, best = args.step, 0
+    while clients <= args.max_clients:
+        if args.profile:
+            await reset_profile(args)
+        run = await run_scenario(args, scenario, clients)
+        p99 = percentile(run.totals().latencies, 99) * 1000
+        errors = run.error_rate()
+        passed = p99 <= args.max_p99 and errors <= args.max_errors
+        print("%4u clients: %7.1f req/s, p99 %7.1f ms, %5.1f%% errors -> %s" % (
+            clients, run.totals().count / run.elapsed, p99, errors, "ok" if passed else "limit exceeded"))
+        if not passed:
+            break
+        best = clients
+        clients += args.step
+        await asyncio.sleep(args.cool_down)
+
+    print("\nmax. concurrent clients: %u (p99 <= %.0f ms, errors <= %.1f%%)" % (best, args.max_p99, args.max_errors))
+    if args.profile:
+        await print_profile(args)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="HTTP load generator for the ESP32 thermostat")
+    parser.add_argument("host", help="address of the thermostat (IP address or mDNS name)")
+    parser.add_argument("scenario", help="scenario file, or name of one of the tools/scenarios files")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--clients", type=int, help="overrides the number of clients of the scenario")
+    parser.add_argument("--listeners", type=int, help="overrides the number of /events listeners")
+    parser.add_argument("--duration", type=float, help="overrides the duration of the scenario (in seconds)")
+    parser.add_argument("--ramp-up", dest="ramp_up", type=float, help="overrides the ramp-up time (in seconds)")
+    parser.add_argument("--timeout", type=float, default=5.0, help="request timeout, in seconds (default: 5)")
+    parser.add_argument("--profile", action="store_true", help="resets and then prints the on-device profile")
+    parser.add_argument("--find-max", action="store_true", help="increases the number of clients until a limit is exceeded")
+    parser.add_argument("--step", type=int, default=5, help="client increment of --find-max (default: 5)")
+    parser.add_argument("--max-clients", type=int, default=200, help="upper bound of --find-max (default: 200)")
+    parser.add_argument("--max-p99", type=float, default=500.0, help="p99 latency limit of --find-max, in ms (default: 500)")
+    parser.add_argument("--max-errors", type=float, default=1.0, help="error rate limit of --find-max, in %% (default: 1)")
+    parser.add_argument("--cool-down", type=float, default=5.0, help="pause between two --find-max steps, in seconds (default: 5)")
+
+    try:
+        asyncio.get_event_loop().run_until_complete(main(parser.parse_args()))
+    except KeyboardInterrupt:
+        pass